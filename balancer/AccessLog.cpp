@@ -0,0 +1,57 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include "AccessLog.h"
+#include "LbConstants.h"
+
+AccessLog::~AccessLog() {
+    if (fd >= 0) {
+        flush();
+        close(fd);
+    }
+}
+
+/**
+ * append to path, header written only when file is new or empty
+ */
+bool AccessLog::open(const std::string& path) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) return false;
+    struct stat st {};
+    if (fstat(fd, &st) == 0 && st.st_size == 0) {
+        AccessLogHeader header;
+        if (write(fd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header))) {
+            close(fd);
+            fd = -1;
+            return false;
+        }
+    }
+    buffer.resize(AccessLogBufferBytes);
+    return true;
+}
+
+void AccessLog::append(const AccessRecord& record) {
+    if (used + sizeof(record) > buffer.size()) flush();
+    memcpy(buffer.data() + used, &record, sizeof(record));
+    used += sizeof(record);
+    ++records;
+}
+
+/**
+ * a failed write drops what is left in buffer, counted so stats show the loss
+ */
+void AccessLog::flush() {
+    size_t written = 0;
+    while (written < used) {
+        ssize_t ret = write(fd, buffer.data() + written, used - written);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) {
+            ++writeFailures;
+            break;
+        }
+        written += ret;
+    }
+    used = 0;
+}
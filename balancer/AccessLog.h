@@ -0,0 +1,82 @@
+#ifndef NETUTILS_ACCESS_LOG_H
+#define NETUTILS_ACCESS_LOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class AccessEvent : uint8_t {
+    Open = 1,   // link got its upstream
+    Done = 2,   // l7 request answered
+    Leave = 3,  // link closed
+};
+
+enum class AccessCloseReason : uint8_t {
+    None,
+    Client,    // client closed or went away
+    Upstream,  // upstream closed or failed
+    Shed,      // no upstream could take request, answered 503
+    Timeout,   // request deadline exceeded, answered 504
+    Rejected,  // bad or rate limited request
+};
+
+/**
+ * one access log entry, written as is in host byte order, readers step over records by size
+ * so fields appended later do not break older decoders
+ */
+struct AccessRecord {
+    uint16_t size{sizeof(AccessRecord)};
+    uint8_t event{0};        // AccessEvent
+    char policy{0};          // open: upstream pick policy, LbPolicyXxx; done from cache: 'c'
+    uint8_t closeReason{0};  // leave: AccessCloseReason
+    uint8_t failovers{0};    // upstream switches of link so far
+    uint16_t status{0};      // done: response status
+    uint32_t clientIp{0};    // ipv4 in network order
+    uint32_t upstreamIp{0};  // 0 when none
+    uint16_t clientPort{0};
+    uint16_t upstreamPort{0};
+    uint32_t requests{0};    // leave: requests completed on link
+    int64_t timeNs{0};       // wall clock
+    int64_t durationNs{0};   // done: request latency, leave: link lifetime
+    uint64_t clientBytes{0};
+    uint64_t serverBytes{0};
+};
+static_assert(sizeof(AccessRecord) == 56, "access log record layout is part of file format");
+
+/**
+ * starts every access log file, appends to an existing file keep its header
+ */
+struct AccessLogHeader {
+    char magic[4]{'L', 'B', 'A', 'L'};
+    uint16_t version{1};
+    uint16_t recordSize{sizeof(AccessRecord)};
+};
+
+const char* const AccessEventNames[] = {"none", "open", "done", "leave"};
+const char* const AccessCloseReasonNames[] = {"none", "client", "upstream", "shed", "timeout", "rejected"};
+
+/**
+ * records copied into a buffer on event loop thread and written out when it fills or on stats tick
+ */
+struct AccessLog {
+    uint64_t records{0};
+    uint64_t writeFailures{0};
+
+    AccessLog() = default;
+    AccessLog(const AccessLog&) = delete;
+    AccessLog& operator=(const AccessLog&) = delete;
+    ~AccessLog();
+
+    bool open(const std::string& path);
+    bool enabled() const { return fd >= 0; }
+    void append(const AccessRecord& record);
+    void flush();
+
+private:
+    int fd{-1};
+    std::vector<char> buffer;
+    size_t used{0};
+};
+
+#endif
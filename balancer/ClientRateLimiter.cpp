@@ -0,0 +1,54 @@
+#include <algorithm>
+#include "ClientRateLimiter.h"
+#include "LbConstants.h"
+
+void ClientRateLimiter::init(double ratePerSecond, double burst_, int tableSizeLog2) {
+    buckets.clear();
+    if (ratePerSecond <= 0) return;
+
+    tableSizeLog2 = std::max(4, std::min(24, tableSizeLog2));
+    buckets.resize(1u << tableSizeLog2);
+    mask = (1u << tableSizeLog2) - 1;
+    shift = 32 - tableSizeLog2;
+    tokensPerNs = ratePerSecond / 1e9;
+    burst = static_cast<float>(std::max(1.0, burst_));
+}
+
+ClientRateLimiter::Bucket* ClientRateLimiter::find_or_evict(uint32_t ip, int64_t nowNs) {
+    uint32_t index = (ip * 2654435761u) >> shift;  // fibonacci hashing, top bits spread well for sequential ips
+    Bucket* victim = nullptr;
+    for (int i = 0; i < ClientRateProbeLength; ++i) {
+        Bucket& bucket = buckets[(index + i) & mask];
+        if (bucket.ip == ip) return &bucket;
+        if (bucket.ip == 0) {
+            victim = &bucket;
+            break;
+        }
+        if (victim == nullptr || bucket.lastNs < victim->lastNs) victim = &bucket;
+    }
+
+    if (victim->ip != 0) ++evicted;
+    victim->ip = ip;
+    victim->tokens = burst;  // new client starts with full bucket
+    victim->lastNs = nowNs;
+    return victim;
+}
+
+bool ClientRateLimiter::allow(uint32_t ip, int64_t nowNs) {
+    if (!enabled() || ip == 0) return true;
+
+    Bucket* bucket = find_or_evict(ip, nowNs);
+    if (nowNs > bucket->lastNs) {
+        double refill = (nowNs - bucket->lastNs) * tokensPerNs;
+        bucket->tokens = static_cast<float>(std::min<double>(burst, bucket->tokens + refill));
+        bucket->lastNs = nowNs;
+    }
+
+    if (bucket->tokens >= 1.0f) {
+        bucket->tokens -= 1.0f;
+        ++allowed;
+        return true;
+    }
+    ++limited;
+    return false;
+}
@@ -0,0 +1,46 @@
+#ifndef NETUTILS_CLIENT_RATE_LIMITER_H
+#define NETUTILS_CLIENT_RATE_LIMITER_H
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * per client ipv4 token bucket, fixed size open addressing table keyed on binary address
+ * buckets refill lazily on lookup, when probe window is full the least recently seen slot is evicted
+ */
+struct ClientRateLimiter {
+    struct Bucket {
+        uint32_t ip{0};  // network order, 0 means empty slot
+        float tokens{0};
+        int64_t lastNs{0};
+    };
+
+    std::vector<Bucket> buckets;
+    uint32_t mask{0};
+    int shift{32};
+    double tokensPerNs{0};
+    float burst{0};
+
+    uint64_t allowed{0};
+    uint64_t limited{0};
+    uint64_t evicted{0};
+
+    /**
+     * @param ratePerSecond 0 disables limiting
+     * @param tableSizeLog2 table holds 2^tableSizeLog2 clients
+     */
+    void init(double ratePerSecond, double burst_, int tableSizeLog2);
+
+    bool enabled() const { return !buckets.empty(); }
+
+    /**
+     * take one token from bucket of ip
+     * @return false if client exceeds its rate
+     */
+    bool allow(uint32_t ip, int64_t nowNs);
+
+private:
+    Bucket* find_or_evict(uint32_t ip, int64_t nowNs);
+};
+
+#endif
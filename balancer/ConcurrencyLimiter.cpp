@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <cmath>
+#include "ConcurrencyLimiter.h"
+
+void ConcurrencyLimiter::init(LimiterAlgorithm algorithm_, int initialLimit, int minLimit_, int maxLimit_) {
+    algorithm = algorithm_;
+    minLimit = std::max(1, minLimit_);
+    maxLimit = std::max(minLimit, maxLimit_);
+    limit = initialLimit;
+    set_limit(limit);
+}
+
+void ConcurrencyLimiter::update_min_rtt(int64_t rttNs, int64_t nowNs) {
+    if (windowStartNs == 0 || nowNs - windowStartNs > MinRttWindowNanos) {  // rotate window, forget stale minimum
+        prevWindowMinRttNs = windowMinRttNs;
+        windowMinRttNs = 0;
+        windowStartNs = nowNs;
+    }
+    if (windowMinRttNs == 0 || rttNs < windowMinRttNs) windowMinRttNs = rttNs;
+
+    minRttNs = windowMinRttNs;
+    if (prevWindowMinRttNs > 0 && prevWindowMinRttNs < minRttNs) minRttNs = prevWindowMinRttNs;
+}
+
+void ConcurrencyLimiter::on_sample(int64_t rttNs, int64_t nowNs) {
+    if (!enabled() || rttNs <= 0) return;
+    ++samples;
+    lastRttNs = rttNs;
+    update_min_rtt(rttNs, nowNs);
+
+    bool appLimited = inflight * 2 < limit;  // do not grow a limit we are not using
+    if (algorithm == LimiterAlgorithm::AIMD) {
+        if (rttNs > AimdRttTolerance * minRttNs) {
+            set_limit(limit * LimiterBackoffRatio);
+        } else if (!appLimited) {
+            set_limit(limit + 1.0);
+        }
+    } else {
+        double gradient = std::max(0.5, std::min(1.0, GradientRttTolerance * minRttNs / rttNs));
+        double newLimit = limit * gradient + std::sqrt(limit);
+        if (appLimited && newLimit > limit) newLimit = limit;
+        set_limit(limit * (1.0 - GradientSmoothing) + newLimit * GradientSmoothing);
+    }
+}
+
+void ConcurrencyLimiter::on_drop() {
+    if (!enabled()) return;
+    ++drops;
+    set_limit(limit * LimiterBackoffRatio);
+}
+
+void ConcurrencyLimiter::set_limit(double newLimit) {
+    limit = std::max(static_cast<double>(minLimit), std::min(static_cast<double>(maxLimit), newLimit));
+}
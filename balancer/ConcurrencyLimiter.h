@@ -0,0 +1,48 @@
+#ifndef NETUTILS_CONCURRENCY_LIMITER_H
+#define NETUTILS_CONCURRENCY_LIMITER_H
+
+#include <cstdint>
+#include "LbConstants.h"
+
+/**
+ * adaptive in-flight limit of one upstream, similar to netflix concurrency-limits
+ * AIMD: +1 per good sample when limit is used, multiplicative decrease when rtt exceeds tolerance * minRtt or drop
+ * GRADIENT: limit = limit * minRtt / rtt + sqrt(limit), smoothed, decrease on drop
+ */
+struct ConcurrencyLimiter {
+    LimiterAlgorithm algorithm{LimiterAlgorithm::NONE};
+    double limit{DefaultInitialConcurrencyLimit};
+    int minLimit{DefaultMinConcurrencyLimit};
+    int maxLimit{DefaultMaxConcurrencyLimit};
+    int inflight{0};
+
+    int64_t minRttNs{0};  // min of current and previous window
+    int64_t windowMinRttNs{0};
+    int64_t prevWindowMinRttNs{0};
+    int64_t windowStartNs{0};
+    int64_t lastRttNs{0};
+
+    uint64_t samples{0};
+    uint64_t drops{0};
+    uint64_t rejected{0};
+
+    void init(LimiterAlgorithm algorithm_, int initialLimit, int minLimit_, int maxLimit_);
+
+    bool enabled() const { return algorithm != LimiterAlgorithm::NONE; }
+    int current_limit() const { return static_cast<int>(limit); }
+    bool saturated() const { return enabled() && inflight >= current_limit(); }
+
+    void acquire() { ++inflight; }
+    void release() {
+        if (inflight > 0) --inflight;
+    }
+
+    void on_sample(int64_t rttNs, int64_t nowNs);
+    void on_drop();
+
+private:
+    void update_min_rtt(int64_t rttNs, int64_t nowNs);
+    void set_limit(double newLimit);
+};
+
+#endif
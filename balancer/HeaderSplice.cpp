@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include "HeaderSplice.h"
+
+void HeaderSplice::clear() {
+    insertAt = -1;
+    end = 0;
+    skips.clear();
+    headers.clear();
+    sent = 0;
+    pending = false;
+}
+
+void HeaderSplice::set_range(int insertAt_, int end_) {
+    insertAt = insertAt_;
+    end = end_;
+}
+
+bool HeaderSplice::add_skip(int begin, int end_) {
+    if (static_cast<int>(skips.size()) >= MaxSkips || begin < insertAt || end_ > end || begin >= end_) return false;
+    for (const auto& skip : skips) {
+        if (skip.first == begin) return true;  // same client line replaced twice
+    }
+    skips.emplace_back(begin, end_);
+    std::sort(skips.begin(), skips.end());
+    return true;
+}
+
+int HeaderSplice::total() const {
+    int length = end + static_cast<int>(headers.size());
+    for (const auto& skip : skips) length -= skip.second - skip.first;
+    return length;
+}
+
+int HeaderSplice::fill_iovec(const char* buf, struct iovec* iov) const {
+    int count = 0;
+    int toSkip = sent;
+    auto append = [&](const char* base, int length) {
+        if (length <= toSkip) {
+            toSkip -= length;
+            return;
+        }
+        iov[count].iov_base = const_cast<char*>(base + toSkip);
+        iov[count].iov_len = static_cast<size_t>(length - toSkip);
+        toSkip = 0;
+        ++count;
+    };
+
+    append(buf, insertAt);
+    append(headers.data(), static_cast<int>(headers.size()));
+    int pos = insertAt;
+    for (const auto& skip : skips) {
+        append(buf + pos, skip.first - pos);
+        pos = skip.second;
+    }
+    append(buf + pos, end - pos);
+    return count;
+}
+
+void HeaderSplice::append_to(const char* buf, std::string& out) const {
+    struct iovec iov[MaxIovecs];
+    int count = fill_iovec(buf, iov);
+    for (int i = 0; i < count; ++i) out.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+}
+
+std::string next_request_id() {
+    static const uint64_t bootId =
+        (static_cast<uint64_t>(std::random_device{}()) << 32) ^
+        static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    static std::atomic<uint32_t> threads{0};
+    thread_local uint32_t thread = threads++;
+    thread_local uint64_t counter = 0;
+
+    char id[48];
+    snprintf(id, sizeof(id), "%016llx-%x-%llx", static_cast<unsigned long long>(bootId), thread,
+             static_cast<unsigned long long>(++counter));
+    return id;
+}
@@ -0,0 +1,44 @@
+#ifndef NETUTILS_HEADER_SPLICE_H
+#define NETUTILS_HEADER_SPLICE_H
+
+#include <sys/uio.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * header lines inserted into request stream without touching client buffer
+ * logical stream: buf[0, insertAt) + headers + buf[insertAt, end) with skipped ranges (replaced client headers) left out
+ * sent by writev, iovecs rebuilt from sent offset so partial writes and failover replay just work
+ */
+struct HeaderSplice {
+    static constexpr int MaxSkips = 8;
+    static constexpr int MaxIovecs = MaxSkips + 3;
+
+    int insertAt{-1};  // right after request line
+    int end{0};        // end of buffered request bytes covered by splice
+    std::vector<std::pair<int, int>> skips;  // sorted [begin, end) client header lines dropped
+    std::string headers;                     // CRLF terminated lines
+    int sent{0};
+    bool pending{false};
+
+    void clear();
+    void set_range(int insertAt_, int end_);
+    bool add_skip(int begin, int end_);
+    void rearm() {
+        sent = 0;
+        pending = insertAt >= 0;
+    }
+
+    int total() const;
+    int fill_iovec(const char* buf, struct iovec* iov) const;  // from sent offset, return iovec count
+    void append_to(const char* buf, std::string& out) const;   // whole spliced stream, for a request kept aside
+};
+
+/**
+ * X-Request-Id value: random boot id of this process, index of calling thread and its own counter,
+ * unique across threads without any shared write
+ */
+std::string next_request_id();
+
+#endif
@@ -0,0 +1,188 @@
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "HeavyHitters.h"
+
+namespace {
+
+uint64_t mix64(uint64_t x) {  // splitmix64 finalizer, ips differ in few bits
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+}  // namespace
+
+/**
+ * lookup table at least 4 times capacity keeps probes short
+ */
+void SpaceSaving::init(size_t capacity_) {
+    capacity = capacity_;
+    if (capacity == 0) return;
+    size_t tableSize = 1;
+    while (tableSize < capacity * 4) tableSize <<= 1;
+    table.assign(tableSize, -1);
+    heap.reserve(capacity);
+}
+
+size_t SpaceSaving::slot_of(uint32_t key) const {
+    size_t mask = table.size() - 1;
+    size_t slot = mix64(key) & mask;
+    while (table[slot] >= 0 && heap[table[slot]].key != key) slot = (slot + 1) & mask;
+    return slot;
+}
+
+/**
+ * backward shift deletion, entries behind the hole move up unless they already sit at or past their home
+ */
+void SpaceSaving::erase_slot(size_t slot) {
+    size_t mask = table.size() - 1;
+    table[slot] = -1;
+    size_t next = (slot + 1) & mask;
+    while (table[next] >= 0) {
+        size_t home = mix64(heap[table[next]].key) & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            table[slot] = table[next];
+            heap[table[slot]].slot = static_cast<uint32_t>(slot);
+            table[next] = -1;
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+}
+
+void SpaceSaving::swap_nodes(size_t a, size_t b) {
+    std::swap(heap[a], heap[b]);
+    table[heap[a].slot] = static_cast<int32_t>(a);
+    table[heap[b].slot] = static_cast<int32_t>(b);
+}
+
+void SpaceSaving::sift_down(size_t index) {
+    while (true) {
+        size_t smallest = index;
+        size_t left = index * 2 + 1, right = left + 1;
+        if (left < heap.size() && heap[left].count < heap[smallest].count) smallest = left;
+        if (right < heap.size() && heap[right].count < heap[smallest].count) smallest = right;
+        if (smallest == index) return;
+        swap_nodes(index, smallest);
+        index = smallest;
+    }
+}
+
+void SpaceSaving::add(uint32_t key, uint64_t weight) {
+    totalWeight += weight;
+    size_t slot = slot_of(key);
+    if (table[slot] >= 0) {  // counts only grow, so a tracked key can only move down the min heap
+        size_t index = table[slot];
+        heap[index].count += weight;
+        sift_down(index);
+        return;
+    }
+
+    if (heap.size() < capacity) {
+        Counter counter;
+        counter.key = key;
+        counter.count = weight;
+        counter.slot = static_cast<uint32_t>(slot);
+        heap.push_back(counter);
+        table[slot] = static_cast<int32_t>(heap.size() - 1);
+        for (size_t index = heap.size() - 1; index > 0 && heap[(index - 1) / 2].count > heap[index].count;) {
+            swap_nodes(index, (index - 1) / 2);
+            index = (index - 1) / 2;
+        }
+        return;
+    }
+
+    // replace minimum, its count becomes error bound of new key
+    erase_slot(heap[0].slot);
+    slot = slot_of(key);  // deletion may have shifted the probe chain
+    heap[0].error = heap[0].count;
+    heap[0].count += weight;
+    heap[0].key = key;
+    heap[0].slot = static_cast<uint32_t>(slot);
+    table[slot] = 0;
+    sift_down(0);
+}
+
+void SpaceSaving::reset() {
+    std::fill(table.begin(), table.end(), -1);
+    heap.clear();
+    totalWeight = 0;
+}
+
+std::vector<SpaceSaving::Counter> SpaceSaving::top(size_t n) const {
+    std::vector<Counter> sorted(heap);
+    std::sort(sorted.begin(), sorted.end(), [](const Counter& a, const Counter& b) { return a.count > b.count; });
+    if (sorted.size() > n) sorted.resize(n);
+    return sorted;
+}
+
+void HyperLogLog::init(int precision_) {
+    precision = precision_;
+    registers.assign(static_cast<size_t>(1) << precision, 0);
+}
+
+void HyperLogLog::add(uint32_t key) {
+    uint64_t hash = mix64(key);
+    size_t index = hash >> (64 - precision);
+    uint64_t rest = hash << precision;
+    uint8_t rank = static_cast<uint8_t>(rest == 0 ? 64 - precision + 1 : __builtin_clzll(rest) + 1);
+    if (rank > registers[index]) registers[index] = rank;
+}
+
+void HyperLogLog::reset() { std::fill(registers.begin(), registers.end(), 0); }
+
+/**
+ * raw estimate with linear counting for small cardinalities, 32 bit keys never reach large range correction
+ */
+uint64_t HyperLogLog::estimate() const {
+    double m = static_cast<double>(registers.size());
+    double sum = 0;
+    int zeros = 0;
+    for (uint8_t value : registers) {
+        sum += std::ldexp(1.0, -value);
+        if (value == 0) ++zeros;
+    }
+    double alpha = 0.7213 / (1 + 1.079 / m);
+    double estimate = alpha * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) estimate = m * std::log(m / zeros);
+    return static_cast<uint64_t>(estimate + 0.5);
+}
+
+void HeavyHitters::init(size_t capacity, int precision) {
+    connections.init(capacity);
+    bytes.init(capacity);
+    distinct.init(precision);
+}
+
+void HeavyHitters::reset() {
+    connections.reset();
+    bytes.reset();
+    distinct.reset();
+}
+
+void HeavyHitters::format(std::string& out, size_t n) const {
+    char line[128];
+    snprintf(line, sizeof(line), "distinct clients %lu links %lu bytes %lu\n",
+             static_cast<unsigned long>(distinct.estimate()), static_cast<unsigned long>(connections.total()),
+             static_cast<unsigned long>(bytes.total()));
+    out += line;
+
+    const SpaceSaving* sketches[] = {&connections, &bytes};
+    const char* names[] = {"links", "bytes"};
+    for (int i = 0; i < 2; ++i) {
+        for (const SpaceSaving::Counter& counter : sketches[i]->top(n)) {
+            struct in_addr addr {};
+            addr.s_addr = counter.key;
+            char ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+            snprintf(line, sizeof(line), "top %s %s %lu error %lu\n", names[i], ip,
+                     static_cast<unsigned long>(counter.count), static_cast<unsigned long>(counter.error));
+            out += line;
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef NETUTILS_HEAVY_HITTERS_H
+#define NETUTILS_HEAVY_HITTERS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * SpaceSaving top-k: k counters kept in a min heap, a key not tracked takes over the smallest counter
+ * and inherits its count as error bound, so any key heavier than total / k is guaranteed to be in
+ * keys are found through a linear probing table sized at init, nothing allocates after that
+ * update is O(1) lookup plus a sift bounded by log k
+ */
+struct SpaceSaving {
+    struct Counter {
+        uint32_t key{0};
+        uint64_t count{0};
+        uint64_t error{0};  // count may overestimate true value by at most this
+        uint32_t slot{0};   // position in lookup table
+    };
+
+    void init(size_t capacity);
+    bool enabled() const { return !table.empty(); }
+    void add(uint32_t key, uint64_t weight);
+    void reset();
+    std::vector<Counter> top(size_t n) const;  // heaviest first
+    uint64_t total() const { return totalWeight; }
+
+private:
+    std::vector<Counter> heap;
+    std::vector<int32_t> table;  // heap index, -1 empty
+    size_t capacity{0};
+    uint64_t totalWeight{0};
+
+    size_t slot_of(uint32_t key) const;
+    void erase_slot(size_t slot);
+    void sift_down(size_t index);
+    void swap_nodes(size_t a, size_t b);
+};
+
+/**
+ * HyperLogLog distinct count with 2^precision one byte registers, standard error 1.04 / sqrt(2^precision)
+ */
+struct HyperLogLog {
+    void init(int precision);
+    void add(uint32_t key);
+    void reset();
+    uint64_t estimate() const;
+
+private:
+    std::vector<uint8_t> registers;
+    int precision{0};
+};
+
+/**
+ * hot clients of one interval: top by connections, top by bytes, distinct client count
+ */
+struct HeavyHitters {
+    SpaceSaving connections;
+    SpaceSaving bytes;
+    HyperLogLog distinct;
+
+    void init(size_t capacity, int precision);
+    bool enabled() const { return connections.enabled(); }
+    void on_link(uint32_t clientIp) {
+        connections.add(clientIp, 1);
+        distinct.add(clientIp);
+    }
+    void on_leave(uint32_t clientIp, uint64_t linkBytes) { bytes.add(clientIp, linkBytes); }
+    void reset();
+
+    /**
+     * one line per tracked client, heaviest first, count and error bound
+     */
+    void format(std::string& out, size_t n) const;
+};
+
+#endif
@@ -0,0 +1,398 @@
+#include <strings.h>
+#include <algorithm>
+#include <cstring>
+#include "HttpFramer.h"
+
+static inline char to_lower(char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c; }
+
+static inline int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = to_lower(c);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+/**
+ * next element of a comma separated header list, blanks around it trimmed, empty elements skipped
+ * @return false when list is exhausted
+ */
+static bool next_list_item(const char* value, int length, int& at, const char*& item, int& itemLength) {
+    while (at < length) {
+        int begin = at;
+        while (at < length && value[at] != ',') ++at;
+        int end = at;
+        if (at < length) ++at;  // past comma
+        while (begin < end && (value[begin] == ' ' || value[begin] == '\t')) ++begin;
+        while (end > begin && (value[end - 1] == ' ' || value[end - 1] == '\t')) --end;
+        if (end > begin) {
+            item = value + begin;
+            itemLength = end - begin;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool item_is(const char* item, int itemLength, const char* token) {
+    return static_cast<int>(strlen(token)) == itemLength && strncasecmp(item, token, itemLength) == 0;
+}
+
+/**
+ * list has token as a whole element, directive arguments after '=' ignored
+ */
+static bool list_has_token(const char* value, int length, const char* token) {
+    int at = 0;
+    const char* item = nullptr;
+    int itemLength = 0;
+    while (next_list_item(value, length, at, item, itemLength)) {
+        const char* equals = static_cast<const char*>(memchr(item, '=', itemLength));
+        if (item_is(item, equals ? static_cast<int>(equals - item) : itemLength, token)) return true;
+    }
+    return false;
+}
+
+/**
+ * seconds of directive argument, quoted or not, -1 if not a number
+ */
+static int directive_seconds(const char* argument, int length) {
+    if (length >= 2 && argument[0] == '"' && argument[length - 1] == '"') {
+        ++argument;
+        length -= 2;
+    }
+    if (length == 0) return -1;
+    int seconds = 0;
+    for (int i = 0; i < length; ++i) {
+        if (argument[i] < '0' || argument[i] > '9') return -1;
+        if (seconds < (1 << 24)) seconds = seconds * 10 + (argument[i] - '0');
+    }
+    return seconds;
+}
+
+void HttpFramer::reset(Direction direction_, bool noBody_) {
+    direction = direction_;
+    noBody = noBody_;
+    messageBytes = 0;
+    bodyBytes = 0;
+    start_head();
+}
+
+void HttpFramer::start_head() {
+    state = State::StartLine;
+    status = 0;
+    methodLength = 0;
+    startLineSpaces = 0;
+    lastChar = 0;
+    http10 = false;
+    keepAlive = true;
+    chunked = false;
+    trailer = false;
+    hasContentLength = false;
+    contentLength = 0;
+    bodyRemaining = 0;
+    chunkSize = 0;
+    chunkSizeDigits = 0;
+    nameLength = 0;
+    valueLength = 0;
+    valueTruncated = false;
+    maxAge = -1;
+    noStore = false;
+    setCookie = false;
+    varyLength = 0;
+}
+
+bool HttpFramer::is_method(const char* name_) const {
+    return static_cast<int>(strlen(name_)) == methodLength && strncmp(method, name_, methodLength) == 0;
+}
+
+/**
+ * request: METHOD SP target SP HTTP/1.x, response: HTTP/1.x SP status SP reason
+ */
+void HttpFramer::on_start_line_char(char c) {
+    if (c == ' ') {
+        ++startLineSpaces;
+    } else if (c == '\r') {
+        return;
+    } else if (direction == Direction::Request) {
+        if (startLineSpaces == 0 && methodLength < MaxMethodLength) method[methodLength++] = c;
+        if (startLineSpaces == 2 && lastChar == '.' && c == '0') http10 = true;
+    } else {
+        if (startLineSpaces == 0 && lastChar == '.' && c == '0') http10 = true;
+        if (startLineSpaces == 1 && c >= '0' && c <= '9' && status < 100) status = status * 10 + (c - '0');
+    }
+    lastChar = c;
+}
+
+void HttpFramer::on_header() {
+    if (trailer) {  // trailer fields do not change framing
+        nameLength = 0;
+        valueLength = 0;
+        return;
+    }
+    name[nameLength] = '\0';
+    if (strcmp(name, "content-length") == 0) {
+        on_content_length();
+    } else if (strcmp(name, "transfer-encoding") == 0) {
+        on_transfer_encoding();
+    } else if (strcmp(name, "connection") == 0) {
+        if (list_has_token(value, valueLength, "close")) keepAlive = false;
+        if (list_has_token(value, valueLength, "keep-alive")) keepAlive = true;
+    } else if (direction == Direction::Response) {
+        if (strcmp(name, "cache-control") == 0) {
+            on_cache_control();
+        } else if (strcmp(name, "set-cookie") == 0) {
+            setCookie = true;
+        } else if (strcmp(name, "vary") == 0) {
+            on_vary();
+        }
+    }
+    nameLength = 0;
+    valueLength = 0;
+    valueTruncated = false;
+}
+
+/**
+ * digits only, a repeated header must carry same value, anything else makes message length ambiguous
+ */
+void HttpFramer::on_content_length() {
+    int64_t length = 0;
+    bool valid = valueLength > 0 && !valueTruncated;
+    for (int i = 0; i < valueLength && valid; ++i) {
+        valid = value[i] >= '0' && value[i] <= '9' && length <= MaxChunkSize;
+        length = length * 10 + (value[i] - '0');
+    }
+    if (!valid || (hasContentLength && length != contentLength)) {
+        state = State::Bad;
+        return;
+    }
+    hasContentLength = true;
+    contentLength = length;
+}
+
+/**
+ * chunked is the only coding taken, exactly once over all header lines, other codings can not be framed here
+ */
+void HttpFramer::on_transfer_encoding() {
+    int at = 0;
+    const char* item = nullptr;
+    int itemLength = 0;
+    bool any = false;
+    while (next_list_item(value, valueLength, at, item, itemLength)) {
+        if (!item_is(item, itemLength, "chunked") || chunked) {
+            state = State::Bad;
+            return;
+        }
+        chunked = true;
+        any = true;
+    }
+    if (!any || valueTruncated) state = State::Bad;
+}
+
+/**
+ * directives matched as whole list elements, a value cut at MaxValueLength may hide one so it is never stored
+ */
+void HttpFramer::on_cache_control() {
+    if (valueTruncated) {
+        noStore = true;
+        return;
+    }
+    int at = 0;
+    const char* item = nullptr;
+    int itemLength = 0;
+    int shared = -1, plain = -1;
+    while (next_list_item(value, valueLength, at, item, itemLength)) {
+        const char* equals = static_cast<const char*>(memchr(item, '=', itemLength));
+        int directiveLength = equals ? static_cast<int>(equals - item) : itemLength;
+        const char* argument = equals ? equals + 1 : item + itemLength;
+        int argumentLength = static_cast<int>(item + itemLength - argument);
+        if (item_is(item, directiveLength, "no-store") || item_is(item, directiveLength, "no-cache") ||
+            item_is(item, directiveLength, "private")) {
+            noStore = true;
+        } else if (item_is(item, directiveLength, "s-maxage")) {
+            shared = directive_seconds(argument, argumentLength);
+            if (shared < 0) noStore = true;
+        } else if (item_is(item, directiveLength, "max-age")) {
+            plain = directive_seconds(argument, argumentLength);
+            if (plain < 0) noStore = true;
+        }
+    }
+    if (shared >= 0) {
+        maxAge = shared;
+    } else if (plain >= 0) {
+        maxAge = plain;
+    }
+}
+
+/**
+ * repeated Vary lines are joined, a list that does not fit can not make a complete cache key
+ */
+void HttpFramer::on_vary() {
+    int separator = varyLength > 0 ? 2 : 0;
+    if (valueTruncated || varyLength + separator + valueLength > MaxValueLength) {
+        noStore = true;
+        return;
+    }
+    if (separator) {
+        memcpy(vary + varyLength, ", ", 2);
+        varyLength += 2;
+    }
+    memcpy(vary + varyLength, value, valueLength);
+    varyLength += valueLength;
+}
+
+void HttpFramer::on_head_end() {
+    if (trailer) {
+        state = State::Done;
+        return;
+    }
+    if (direction == Direction::Response) {
+        if (status >= 100 && status < 200 && status != 101) {
+            start_head();  // interim response, final one follows
+            return;
+        }
+        if (status == 101) {
+            keepAlive = false;  // upgraded, bytes are no longer http
+            state = State::UntilClose;
+            return;
+        }
+        if (noBody || status == 204 || status == 304) {
+            state = State::Done;
+            return;
+        }
+    }
+
+    if (chunked && hasContentLength) {  // peers may disagree on which one frames message, never pass it on
+        state = State::Bad;
+    } else if (chunked) {
+        state = State::ChunkSize;
+    } else if (hasContentLength) {
+        bodyRemaining = contentLength;
+        state = bodyRemaining > 0 ? State::Body : State::Done;
+    } else if (direction == Direction::Request) {
+        state = State::Done;  // request without length has no body
+    } else {
+        keepAlive = false;
+        state = State::UntilClose;
+    }
+}
+
+void HttpFramer::on_chunk_size_end() {
+    if (chunkSizeDigits == 0) {
+        state = State::Bad;
+    } else if (chunkSize == 0) {
+        trailer = true;  // last chunk, trailer section ends message
+        state = State::HeaderName;
+    } else {
+        bodyRemaining = chunkSize;
+        state = State::ChunkData;
+    }
+}
+
+int HttpFramer::feed(const char* data, int len) {
+    int i = 0;
+    while (i < len && state != State::Done && state != State::Bad) {
+        if (state == State::Body || state == State::ChunkData) {
+            int64_t n = std::min<int64_t>(bodyRemaining, len - i);
+            bodyRemaining -= n;
+            bodyBytes += n;
+            i += static_cast<int>(n);
+            if (bodyRemaining == 0) state = state == State::Body ? State::Done : State::ChunkDataEnd;
+            continue;
+        }
+        if (state == State::UntilClose) {
+            bodyBytes += len - i;
+            i = len;
+            break;
+        }
+
+        char c = data[i++];
+        switch (state) {
+            case State::StartLine:
+                if (c == '\n') {
+                    bool valid = direction == Direction::Request ? (methodLength > 0 && startLineSpaces >= 2)
+                                                                 : status >= 100;
+                    if (!valid && startLineSpaces == 0 && lastChar == 0) break;  // empty line before message
+                    if (http10) keepAlive = false;
+                    state = valid ? State::HeaderName : State::Bad;
+                } else {
+                    on_start_line_char(c);
+                }
+                break;
+            case State::HeaderName:
+                if (c == '\n' && nameLength == 0) {
+                    on_head_end();
+                } else if (c == '\r' && nameLength == 0) {
+                    state = State::HeadEnd;
+                } else if (c == ':' && nameLength > 0) {
+                    state = State::HeaderValue;
+                } else if (c == ':' || c == '\n' || c == '\r' || c == ' ' || c == '\t') {
+                    // no colon, empty name, folded line or space before colon: parser and upstream may read it
+                    // differently, framing it any way opens a desync
+                    state = State::Bad;
+                } else if (nameLength < MaxNameLength - 1) {
+                    name[nameLength++] = to_lower(c);
+                }
+                break;
+            case State::HeaderValue:
+                if (c == '\n') {
+                    while (valueLength > 0 && (value[valueLength - 1] == '\r' || value[valueLength - 1] == ' ')) {
+                        --valueLength;
+                    }
+                    state = State::HeaderName;
+                    on_header();  // may find message bad
+                } else if ((c != ' ' && c != '\t') || valueLength > 0) {
+                    if (valueLength < MaxValueLength) {
+                        value[valueLength++] = c;
+                    } else if (c != '\r') {
+                        valueTruncated = true;
+                    }
+                }
+                break;
+            case State::HeadEnd:
+                if (c == '\n') {
+                    on_head_end();
+                } else {
+                    state = State::Bad;
+                }
+                break;
+            case State::ChunkSize: {
+                int digit = hex_value(c);
+                if (digit >= 0) {
+                    chunkSize = chunkSize * 16 + digit;
+                    if (++chunkSizeDigits > 15 || chunkSize > MaxChunkSize) state = State::Bad;
+                } else if (c == ';' || c == ' ' || c == '\t') {
+                    state = State::ChunkExtension;
+                } else if (c == '\r') {
+                    state = State::ChunkSizeEnd;
+                } else if (c == '\n') {
+                    on_chunk_size_end();
+                } else {
+                    state = State::Bad;
+                }
+                break;
+            }
+            case State::ChunkExtension:
+                if (c == '\n') on_chunk_size_end();
+                break;
+            case State::ChunkSizeEnd:
+                if (c == '\n') {
+                    on_chunk_size_end();
+                } else {
+                    state = State::Bad;
+                }
+                break;
+            case State::ChunkDataEnd:  // CRLF closing chunk data
+                if (c == '\n') {
+                    chunkSize = 0;
+                    chunkSizeDigits = 0;
+                    state = State::ChunkSize;
+                } else if (c != '\r') {
+                    state = State::Bad;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    messageBytes += i;
+    return i;
+}
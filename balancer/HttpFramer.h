@@ -0,0 +1,97 @@
+#ifndef NETUTILS_HTTP_FRAMER_H
+#define NETUTILS_HTTP_FRAMER_H
+
+#include <cstdint>
+
+/**
+ * streaming message framing, tells where a request or response ends while its bytes pass through
+ * head is scanned byte by byte so it may span any number of recvs, nothing is held or copied
+ * body is delimited by Content-Length or chunked transfer coding (trailers included), a response may also have
+ * no body (HEAD, 1xx, 204, 304) or end with its connection; interim 1xx responses are framed through
+ * a message whose length is ambiguous (both headers, malformed or conflicting Content-Length, coding other than
+ * chunked) is bad, so a request is refused and an upstream connection is never reused after it
+ * so is a header line without colon or with whitespace in its name, which other parsers may read differently
+ * response cache directives are picked up on the way, for deciding whether it may be stored
+ */
+struct HttpFramer {
+    enum Direction { Request, Response };
+    enum State {
+        StartLine,
+        HeaderName,
+        HeaderValue,
+        HeadEnd,
+        Body,
+        ChunkSize,
+        ChunkExtension,
+        ChunkSizeEnd,
+        ChunkData,
+        ChunkDataEnd,
+        UntilClose,
+        Done,
+        Bad
+    };
+
+    static constexpr int MaxNameLength = 24;
+    static constexpr int MaxValueLength = 64;
+    static constexpr int MaxMethodLength = 8;
+    static constexpr int64_t MaxChunkSize = 1LL << 40;
+
+    Direction direction{Direction::Response};
+    State state{State::StartLine};
+    bool noBody{false};  // response to HEAD request
+    int status{0};
+    char method[MaxMethodLength];  // request method, truncated
+    int methodLength{0};
+    int startLineSpaces{0};
+    char lastChar{0};
+    bool http10{false};
+    bool keepAlive{true};
+    bool chunked{false};
+    bool trailer{false};  // header lines after last chunk
+    bool hasContentLength{false};
+    int64_t contentLength{0};
+    int64_t bodyRemaining{0};  // of whole body, or of current chunk
+    int64_t chunkSize{0};
+    int chunkSizeDigits{0};
+    int64_t messageBytes{0};  // bytes of current message consumed, head included
+    int64_t bodyBytes{0};     // payload bytes, chunk framing excluded
+    int maxAge{-1};           // response freshness from Cache-Control, s-maxage preferred, -1 if absent
+    bool noStore{false};      // Cache-Control no-store, no-cache or private, or directives too long to read whole
+    bool setCookie{false};
+    char vary[MaxValueLength];
+    int varyLength{0};
+
+    char name[MaxNameLength];
+    int nameLength{0};
+    char value[MaxValueLength];
+    int valueLength{0};
+    bool valueTruncated{false};  // header value longer than MaxValueLength, rest was not kept
+
+    void reset(Direction direction_, bool noBody_ = false);
+    void restart() { reset(direction, noBody); }
+
+    /**
+     * @return bytes that belong to current message, less than len when message completes inside data
+     */
+    int feed(const char* data, int len);
+
+    bool complete() const { return state == State::Done; }
+    bool bad() const { return state == State::Bad; }
+    bool until_close() const { return state == State::UntilClose; }
+    bool head_done() const { return state > State::HeadEnd; }
+    bool reusable() const { return complete() && keepAlive; }
+    bool is_method(const char* name_) const;
+
+private:
+    void start_head();
+    void on_start_line_char(char c);
+    void on_header();
+    void on_content_length();
+    void on_transfer_encoding();
+    void on_cache_control();
+    void on_vary();
+    void on_head_end();
+    void on_chunk_size_end();
+};
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef NETUTILS_HTTP_HEADER_TABLE_H
+#define NETUTILS_HTTP_HEADER_TABLE_H
+
+#include <strings.h>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * header names the balancer looks at, each parsed request keeps them in a fixed slot per id
+ */
+enum class HttpHeaderId : int8_t {
+    Host,
+    UserAgent,
+    ContentLength,
+    TransferEncoding,
+    Connection,
+    Upgrade,
+    Expect,
+    Authorization,
+    CacheControl,
+    Pragma,
+    AcceptEncoding,
+    XForwardedFor,
+    XRequestId,
+    XRequestTimeoutMs,
+    Count
+};
+
+constexpr int KnownHeaderCount = static_cast<int>(HttpHeaderId::Count);
+constexpr const char* const KnownHeaderNames[KnownHeaderCount] = {"Host",
+                                                                  "User-Agent",
+                                                                  "Content-Length",
+                                                                  "Transfer-Encoding",
+                                                                  "Connection",
+                                                                  "Upgrade",
+                                                                  "Expect",
+                                                                  "Authorization",
+                                                                  "Cache-Control",
+                                                                  "Pragma",
+                                                                  "Accept-Encoding",
+                                                                  "X-Forwarded-For",
+                                                                  "X-Request-Id",
+                                                                  "X-Request-Timeout-Ms"};  // by HttpHeaderId
+static_assert(KnownHeaderCount <= 32, "presence of known headers is a 32 bit mask");
+
+/**
+ * perfect hash over known names: case folded FNV-1a whose seed is searched at compile time until every known name
+ * lands in a slot of its own, so a lookup is one hash, one slot read and one compare against the only candidate
+ */
+constexpr int HeaderSlotCount = 64;  // power of 2
+
+constexpr uint32_t header_name_hash(const char* name, size_t length, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ static_cast<uint8_t>(name[i] | 0x20)) * 16777619u;  // letters folded to lower case
+    }
+    return hash;
+}
+
+constexpr size_t const_length(const char* s) {
+    size_t length = 0;
+    while (s[length] != '\0') ++length;
+    return length;
+}
+
+constexpr bool is_perfect_seed(uint32_t seed) {
+    bool used[HeaderSlotCount] = {};
+    for (int i = 0; i < KnownHeaderCount; ++i) {
+        const char* name = KnownHeaderNames[i];
+        uint32_t slot = header_name_hash(name, const_length(name), seed) & (HeaderSlotCount - 1);
+        if (used[slot]) return false;
+        used[slot] = true;
+    }
+    return true;
+}
+
+constexpr uint32_t find_perfect_seed() {
+    uint32_t seed = 0;
+    while (!is_perfect_seed(seed)) ++seed;
+    return seed;
+}
+
+constexpr uint32_t HeaderHashSeed = find_perfect_seed();
+
+struct HeaderSlots {
+    int8_t ids[HeaderSlotCount];
+    uint8_t lengths[KnownHeaderCount];
+};
+
+constexpr HeaderSlots build_header_slots() {
+    HeaderSlots slots{};
+    for (int slot = 0; slot < HeaderSlotCount; ++slot) slots.ids[slot] = -1;
+    for (int i = 0; i < KnownHeaderCount; ++i) {
+        size_t length = const_length(KnownHeaderNames[i]);
+        slots.ids[header_name_hash(KnownHeaderNames[i], length, HeaderHashSeed) & (HeaderSlotCount - 1)] =
+            static_cast<int8_t>(i);
+        slots.lengths[i] = static_cast<uint8_t>(length);
+    }
+    return slots;
+}
+
+constexpr HeaderSlots KnownHeaderSlots = build_header_slots();
+
+/**
+ * @return id of known header name in any letter case, HttpHeaderId::Count if not known
+ */
+inline HttpHeaderId intern_header_name(const char* name, size_t length) {
+    int id = KnownHeaderSlots.ids[header_name_hash(name, length, HeaderHashSeed) & (HeaderSlotCount - 1)];
+    if (id < 0 || KnownHeaderSlots.lengths[id] != length || strncasecmp(name, KnownHeaderNames[id], length) != 0) {
+        return HttpHeaderId::Count;
+    }
+    return static_cast<HttpHeaderId>(id);
+}
+
+#endif
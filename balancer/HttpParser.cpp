@@ -1,23 +1,27 @@
+#include <strings.h>
+#include <iostream>
 #include "HttpParser.h"
+#include "HttpScanner.h"
 
 using namespace std;
 
-HttpParser::HttpParser(char* const msg_, int len_) : msg(msg_), len(len_) {
-    if (len) {
-        endChar = msg + len;
-    }
-}
+HttpParser::HttpParser(const char* msg_, int len_) { init(msg_, len_); }
 
-void HttpParser::init(char* const msg_, int len_) {
+void HttpParser::init(const char* msg_, int len_) {
     msg = msg_;
     len = len_;
-    if (len) {
-        endChar = msg + len;
-    }
-    methodEndPos = -1;
-    headerEndPos = -1;
+    pos = 0;
+    state = State::RequestLine;
+    requestLineEnd = -1;
+    headerEnd = -1;
+    method = queryPath = version = boost::string_view();
+    knownHeaderMask = 0;
+    repeatedHeaderMask = 0;
+    headerCount = 0;
+    droppedHeaderCount = 0;
     completeBody = false;
-    keyValues.clear();
+    bodyPos = -1;
+    body.reset();
 }
 
 bool HttpParser::update_length(int newLen) {
@@ -28,90 +32,183 @@ bool HttpParser::update_length(int newLen) {
     return false;
 }
 
-void HttpParser::parse_method() {
-    if (len > 0) {
-        char* itr = strchr(msg, '\n');
-        if (itr != nullptr) {
-            methodEndPos = static_cast<int>(itr - msg);
+void HttpParser::parse() {
+    while (pos < len && (state == State::RequestLine || state == State::Headers)) {
+        HttpLineScan scan;
+        http_scan_line(msg + pos, msg + len, scan);
+        if (scan.invalid >= 0) {
+            state = State::Bad;  // control character in request line or header
+            return;
+        }
+        if (scan.lineEnd < 0) return;  // wait for rest of line, only this line is scanned again
+        int lineEnd = pos + scan.lineEnd + 1;
+
+        if (state == State::RequestLine) {
+            if (!parse_request_line(lineEnd)) {
+                state = State::Bad;
+                return;
+            }
+            requestLineEnd = lineEnd;
+            state = State::Headers;
+        } else if (lineEnd - pos <= 2 && (lineEnd - pos == 1 || msg[pos] == '\r')) {
+            headerEnd = lineEnd;  // empty line
+            state = State::Complete;
+        } else {
+            parse_header_line(pos, lineEnd, scan.colon < 0 ? -1 : pos + scan.colon);
         }
+        pos = lineEnd;
     }
 }
 
-string HttpParser::get_method_line() {
-    if (methodEndPos >= 0) {
-        return string(msg, methodEndPos);
+/**
+ * METHOD SP target SP version CRLF
+ */
+bool HttpParser::parse_request_line(int lineEnd) {
+    const char* begin = msg + pos;
+    const char* end = msg + lineEnd - 1;
+    if (end > begin && *(end - 1) == '\r') --end;
+
+    auto sp1 = static_cast<const char*>(memchr(begin, ' ', end - begin));
+    if (sp1 == nullptr || sp1 == begin) return false;
+    auto sp2 = static_cast<const char*>(memchr(sp1 + 1, ' ', end - sp1 - 1));
+    if (sp2 == nullptr || sp2 == sp1 + 1) return false;
+
+    method = boost::string_view(begin, sp1 - begin);
+    queryPath = boost::string_view(sp1 + 1, sp2 - sp1 - 1);
+    version = boost::string_view(sp2 + 1, end - sp2 - 1);
+    return true;
+}
+
+void HttpParser::parse_header_line(int lineBegin, int lineEnd, int colonPos) {
+    const char* begin = msg + lineBegin;
+    const char* end = msg + lineEnd - 1;
+    if (end > begin && *(end - 1) == '\r') --end;
+
+    if (colonPos <= lineBegin) return;  // not a header, skip
+    const char* colon = msg + colonPos;
+    HttpHeaderId id = intern_header_name(begin, colon - begin);
+    HttpHeader* header = nullptr;
+    if (id != HttpHeaderId::Count) {
+        if (has_header(id)) {  // repeated, first one counts
+            repeatedHeaderMask |= 1u << static_cast<int>(id);
+            return;
+        }
+        knownHeaderMask |= 1u << static_cast<int>(id);
+        header = &knownHeaders[static_cast<int>(id)];
+    } else if (headerCount < MaxHttpHeaders) {
+        header = &headers[headerCount++];
+    } else {
+        ++droppedHeaderCount;
+        return;
     }
-    return "";
+
+    const char* valueBegin = colon + 1;
+    while (valueBegin < end && (*valueBegin == ' ' || *valueBegin == '\t')) ++valueBegin;
+    const char* valueEnd = end;
+    while (valueEnd > valueBegin && (*(valueEnd - 1) == ' ' || *(valueEnd - 1) == '\t')) --valueEnd;
+
+    header->name = boost::string_view(begin, colon - begin);
+    header->value = boost::string_view(valueBegin, valueEnd - valueBegin);
+    header->lineBegin = lineBegin;
+    header->lineEnd = lineEnd;
 }
 
-string HttpParser::get_query_path() {
-    if (methodEndPos > 0) {
-        char* itr1 = strchr(msg, ' ');
-        if (itr1 == nullptr || (itr1 - msg) > methodEndPos) return "";
-        char* itr2 = strchr(itr1 + 1, ' ');
-        if (itr2 == nullptr || (itr2 - msg) > methodEndPos) return "";
-        return string(itr1 + 1, itr2 - itr1 - 1);
+boost::string_view HttpParser::get_method_line() {
+    if (requestLineEnd > 0) {
+        return boost::string_view(msg, requestLineEnd);
     }
-    return "";
+    return boost::string_view();
 }
 
-void HttpParser::parse_header() {
-    if (methodEndPos >= 0 and methodEndPos + 1 < len) {
-        char* itr = msg + methodEndPos + 1;
-        char* prevItr = itr;
-        while (itr < endChar) {
-            itr = strchr(itr, '\n');
-            if (itr == nullptr) break;
-            int pos = static_cast<int>(itr - msg);
-
-            string header(prevItr, (itr - prevItr) - 1);
-            size_t posColon = header.find_first_of(':', 0);
-            if (posColon != string::npos) {
-                if (posColon + 2 < header.size()) keyValues[header.substr(0, posColon)] = header.substr(posColon + 2);
-            }
-            ++itr;
-            prevItr = itr;
-            if ((itr + 1) < endChar && *itr == '\r' && *(itr + 1) == '\n') {
-                headerEndPos = pos + 2;
-                break;
-            }
+boost::string_view HttpParser::get_header(boost::string_view key) {
+    const HttpHeader* header = find_header(key);
+    return header ? header->value : boost::string_view();
+}
+
+/**
+ * known name goes straight to its slot, only other names are compared one by one
+ */
+const HttpHeader* HttpParser::find_header(boost::string_view key) {
+    HttpHeaderId id = intern_header_name(key.data(), key.size());
+    if (id != HttpHeaderId::Count) return find_header(id);
+    for (int i = 0; i < headerCount; ++i) {
+        if (headers[i].name.size() == key.size() && strncasecmp(headers[i].name.data(), key.data(), key.size()) == 0) {
+            return &headers[i];
         }
     }
+    return nullptr;
 }
 
-string HttpParser::get_header(const string& key) {
-    auto itr = keyValues.find(key);
-    if (itr != keyValues.end()) {
-        return itr->second;
+/**
+ * true when a single kept line does not stand for every line of that name
+ */
+bool HttpParser::header_repeated(boost::string_view key) {
+    HttpHeaderId id = intern_header_name(key.data(), key.size());
+    if (id != HttpHeaderId::Count) return repeatedHeaderMask & (1u << static_cast<int>(id));
+    if (droppedHeaderCount > 0) return true;
+    int count = 0;
+    for (int i = 0; i < headerCount; ++i) {
+        if (headers[i].name.size() == key.size() && strncasecmp(headers[i].name.data(), key.data(), key.size()) == 0) {
+            ++count;
+        }
     }
-    return "";
+    return count > 1;
+}
+
+string HttpParser::get_body_value(const string& key) {
+    const string* value = body.get(key);
+    return value ? *value : "";
 }
 
 void HttpParser::print_all_headers() {
-    for (auto itr : keyValues) {
-        cout << "__" << itr.first << "__ __" << itr.second << "__" << endl;
+    for (int i = 0; i < KnownHeaderCount; ++i) {
+        if (!has_header(static_cast<HttpHeaderId>(i))) continue;
+        cout << "__" << knownHeaders[i].name << "__ __" << knownHeaders[i].value << "__" << endl;
+    }
+    for (int i = 0; i < headerCount; ++i) {
+        cout << "__" << headers[i].name << "__ __" << headers[i].value << "__" << endl;
     }
 }
 
 void HttpParser::parse_body() {
-    if (headerEndPos > 0) {
-        char* itr = msg + headerEndPos + 1;
-        if (itr < endChar) {
-            picojson::value v;
-            std::string err;
-            picojson::parse(v, itr, endChar, &err);
-            if (!err.empty()) {
-                return;
-            }
+    if (headerEnd < 0 || completeBody) return;
+
+    int from = bodyPos > headerEnd ? bodyPos : headerEnd;
+    if (from < len) {
+        body.feed(msg + from, len - from);
+        bodyPos = len;
+    }
+    completeBody = body.done();
+}
 
-            completeBody = true;
-            if (v.is<picojson::object>()) {
-                // obtain a const reference to the map, and print the contents
-                const picojson::value::object& obj = v.get<picojson::object>();
-                for (auto i = obj.begin(); i != obj.end(); ++i) {
-                    keyValues[i->first] = i->second.to_str();
-                }
+void HttpStatusParser::reset() {
+    state = State::Version;
+    versionPos = 0;
+    codeDigits = 0;
+    status = 0;
+}
+
+bool HttpStatusParser::feed(const char* data, int len) {
+    static const char prefix[] = "HTTP/";
+    for (int i = 0; i < len && !done(); ++i) {
+        char c = data[i];
+        if (state == State::Version) {
+            if (versionPos < 5) {
+                state = (c == prefix[versionPos]) ? State::Version : State::Bad;
+            } else if (c == ' ') {
+                state = State::Code;
+            } else if (!((c >= '0' && c <= '9') || c == '.') || versionPos > 8) {
+                state = State::Bad;
+            }
+            ++versionPos;
+        } else if (state == State::Code) {
+            if (c < '0' || c > '9') {
+                state = State::Bad;
+            } else {
+                status = status * 10 + (c - '0');
+                if (++codeDigits == 3) state = State::Done;
             }
         }
     }
+    return done();
 }
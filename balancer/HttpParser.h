@@ -1,36 +1,103 @@
 #ifndef NETUTILS_HTTP_PARSER_H
 #define NETUTILS_HTTP_PARSER_H
 
-#include <picojson.h>
+#include <boost/utility/string_view.hpp>
 #include <cstring>
 #include <string>
-#include <unordered_map>
+#include "HttpHeaderTable.h"
+#include "JsonFieldExtractor.h"
 
+constexpr int MaxHttpHeaders = 32;  // other headers beyond this are parsed over but not kept
+
+struct HttpHeader {
+    boost::string_view name;
+    boost::string_view value;  // without surrounding whitespace
+    int lineBegin{0};          // [lineBegin, lineEnd) offsets of whole line in message, line end included
+    int lineEnd{0};
+};
+
+/**
+ * resumable request parser over a buffer owned by caller, which only grows by appending between calls
+ * parse() continues from last complete line, so each byte is scanned once across recvs
+ * every slice points into caller buffer, bounded by len instead of NUL, nothing allocated for request line and headers
+ */
 struct HttpParser {
-    char* msg{nullptr};
-    char* endChar{nullptr};
+    enum State { RequestLine, Headers, Complete, Bad };
+
+    const char* msg{nullptr};
     int len{0};
-    int methodEndPos{-1};
-    int headerEndPos{-1};
+    int pos{0};  // everything before pos is parsed
+    State state{State::RequestLine};
+
+    int requestLineEnd{-1};  // offset after request line
+    int headerEnd{-1};       // offset after empty line, i.e. body start
+    boost::string_view method;
+    boost::string_view queryPath;
+    boost::string_view version;
+    HttpHeader knownHeaders[KnownHeaderCount];  // by HttpHeaderId, first occurrence kept
+    uint32_t knownHeaderMask{0};                // bit per id present
+    uint32_t repeatedHeaderMask{0};             // bit per id seen more than once
+    HttpHeader headers[MaxHttpHeaders];         // headers not known, kept for names only configured at runtime
+    int headerCount{0};
+    int droppedHeaderCount{0};
+
     bool completeBody{false};
-    std::unordered_map<std::string, std::string> keyValues;
+    int bodyPos{-1};          // body bytes before this offset already fed to extractor
+    JsonFieldExtractor body;  // wanted top level keys of json body
 
-    HttpParser(char* const msg_, int len_);
+    HttpParser() = default;
+    HttpParser(const char* msg_, int len_);
 
-    void init(char* const msg_, int len_);
+    void init(const char* msg_, int len_);
     bool update_length(int newLen);
-    bool has_complete_method() { return methodEndPos > 0; }
-    bool has_complete_header() { return headerEndPos > 0; }
+    bool has_complete_method() { return requestLineEnd > 0; }
+    bool has_complete_header() { return headerEnd > 0; }
     bool has_complete_body() { return completeBody; }
+    bool is_bad() { return state == State::Bad; }
 
-    void parse_method();
-    void parse_header();
-    void parse_body();
+    void parse();  // request line and headers, as far as current length allows
+    void parse_body();  // feed body bytes received since last call to extractor
 
-    std::string get_method_line();
-    std::string get_query_path();
-    std::string get_header(const std::string& key);
+    boost::string_view get_method_line();
+    boost::string_view get_query_path() { return queryPath; }
+    boost::string_view get_header(HttpHeaderId id) {
+        return has_header(id) ? knownHeaders[static_cast<int>(id)].value : boost::string_view();
+    }
+    const HttpHeader* find_header(HttpHeaderId id) {
+        return has_header(id) ? &knownHeaders[static_cast<int>(id)] : nullptr;
+    }
+    bool has_header(HttpHeaderId id) const { return knownHeaderMask & (1u << static_cast<int>(id)); }
+    boost::string_view get_header(boost::string_view key);   // case insensitive name
+    const HttpHeader* find_header(boost::string_view key);   // case insensitive name
+    bool header_repeated(boost::string_view key);             // more than one line, or maybe among dropped ones
+    std::string get_body_value(const std::string& key);
     void print_all_headers();
+
+private:
+    bool parse_request_line(int lineEnd);
+    void parse_header_line(int lineBegin, int lineEnd, int colonPos);
+};
+
+/**
+ * incremental parser of response status line "HTTP/1.1 503 ...", fed with bytes as they arrive
+ * only looks at data in place, never copies it
+ */
+struct HttpStatusParser {
+    enum State { Version, Code, Done, Bad };
+
+    State state{State::Version};
+    int versionPos{0};
+    int codeDigits{0};
+    int status{0};
+
+    void reset();
+    bool done() const { return state == State::Done || state == State::Bad; }
+    bool valid() const { return state == State::Done; }
+
+    /**
+     * @return true when status code is known or response is not http
+     */
+    bool feed(const char* data, int len);
 };
 
 #endif
@@ -0,0 +1,118 @@
+#include "HttpScanner.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static inline bool is_invalid_byte(unsigned char c) { return (c < 0x20 && c != '\t' && c != '\r') || c == 0x7f; }
+
+/**
+ * scalar from offset i, shared by all implementations for the tail shorter than one vector
+ */
+static inline void scan_tail(const char* begin, const char* end, int i, HttpLineScan& scan) {
+    int length = static_cast<int>(end - begin);
+    for (; i < length; ++i) {
+        unsigned char c = static_cast<unsigned char>(begin[i]);
+        if (c == '\n') {
+            scan.lineEnd = i;
+            return;
+        }
+        if (c == ':' && scan.colon < 0) scan.colon = i;
+        if (scan.invalid < 0 && is_invalid_byte(c)) scan.invalid = i;
+    }
+}
+
+/**
+ * masks of one vector, bits after first LF dropped
+ * @return true when LF found
+ */
+static inline bool apply_masks(unsigned lfMask, unsigned colonMask, unsigned badMask, int base, HttpLineScan& scan) {
+    if (lfMask) {
+        unsigned below = (lfMask & (0u - lfMask)) - 1;  // bits before lowest LF
+        colonMask &= below;
+        badMask &= below;
+    }
+    if (colonMask && scan.colon < 0) scan.colon = base + __builtin_ctz(colonMask);
+    if (badMask && scan.invalid < 0) scan.invalid = base + __builtin_ctz(badMask);
+    if (lfMask) {
+        scan.lineEnd = base + __builtin_ctz(lfMask);
+        return true;
+    }
+    return false;
+}
+
+void http_scan_line_scalar(const char* begin, const char* end, HttpLineScan& scan) {
+    scan = HttpLineScan();
+    scan_tail(begin, end, 0, scan);
+}
+
+#if defined(__x86_64__)
+void http_scan_line_sse2(const char* begin, const char* end, HttpLineScan& scan) {
+    scan = HttpLineScan();
+    int length = static_cast<int>(end - begin);
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i del = _mm_set1_epi8(0x7f);
+    const __m128i ctlMax = _mm_set1_epi8(0x1f);
+
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin + i));
+        __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(v, ctlMax), v);  // unsigned v <= 0x1f
+        __m128i allowed = _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, cr));
+        __m128i bad = _mm_or_si128(_mm_andnot_si128(allowed, ctl), _mm_cmpeq_epi8(v, del));
+
+        unsigned lfMask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, lf)));
+        unsigned colonMask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, colon)));
+        unsigned badMask = static_cast<unsigned>(_mm_movemask_epi8(bad)) & ~lfMask;
+        if (apply_masks(lfMask, colonMask, badMask, i, scan)) return;
+    }
+    scan_tail(begin, end, i, scan);
+}
+
+__attribute__((target("avx2"))) void http_scan_line_avx2(const char* begin, const char* end, HttpLineScan& scan) {
+    scan = HttpLineScan();
+    int length = static_cast<int>(end - begin);
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    const __m256i ctlMax = _mm256_set1_epi8(0x1f);
+
+    int i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin + i));
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctlMax), v);
+        __m256i allowed = _mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(v, cr));
+        __m256i bad = _mm256_or_si256(_mm256_andnot_si256(allowed, ctl), _mm256_cmpeq_epi8(v, del));
+
+        unsigned lfMask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf)));
+        unsigned colonMask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, colon)));
+        unsigned badMask = static_cast<unsigned>(_mm256_movemask_epi8(bad)) & ~lfMask;
+        if (apply_masks(lfMask, colonMask, badMask, i, scan)) return;
+    }
+    scan_tail(begin, end, i, scan);
+}
+#endif
+
+static HttpScanLineFn resolve_scan_line() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return http_scan_line_avx2;
+    return http_scan_line_sse2;  // baseline of x86_64
+#else
+    return http_scan_line_scalar;
+#endif
+}
+
+const HttpScanLineFn http_scan_line_impl = resolve_scan_line();
+
+const char* http_scanner_name() {
+#if defined(__x86_64__)
+    if (http_scan_line_impl == http_scan_line_avx2) return "avx2";
+    if (http_scan_line_impl == http_scan_line_sse2) return "sse2";
+#endif
+    return "scalar";
+}
@@ -0,0 +1,33 @@
+#ifndef NETUTILS_HTTP_SCANNER_H
+#define NETUTILS_HTTP_SCANNER_H
+
+/**
+ * one pass over a header line: position of LF, first colon and first invalid byte before it
+ * invalid means control character other than HTAB and CR, or DEL
+ * vectorized 16 (SSE2) or 32 (AVX2) bytes per step, picked once at startup by cpu dispatch, scalar elsewhere
+ */
+struct HttpLineScan {
+    int lineEnd{-1};  // offset of LF, -1 if not in range
+    int colon{-1};    // first ':' before LF
+    int invalid{-1};  // first invalid byte before LF
+};
+
+typedef void (*HttpScanLineFn)(const char* begin, const char* end, HttpLineScan& scan);
+
+void http_scan_line_scalar(const char* begin, const char* end, HttpLineScan& scan);
+#if defined(__x86_64__)
+void http_scan_line_sse2(const char* begin, const char* end, HttpLineScan& scan);
+void http_scan_line_avx2(const char* begin, const char* end, HttpLineScan& scan);
+#endif
+
+extern const HttpScanLineFn http_scan_line_impl;
+const char* http_scanner_name();
+
+/**
+ * offsets in scan are relative to begin
+ */
+inline void http_scan_line(const char* begin, const char* end, HttpLineScan& scan) {
+    http_scan_line_impl(begin, end, scan);
+}
+
+#endif
@@ -0,0 +1,165 @@
+#include "JsonFieldExtractor.h"
+#include "LbConstants.h"
+
+static inline bool is_json_space(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+int JsonFieldExtractor::add_key(const std::string& name, bool stopKey) {
+    keys.push_back(name);
+    values.emplace_back();
+    values.back().reserve(MaxJsonValueLength);
+    found.push_back(false);
+    if (name.size() > maxKeyLength) maxKeyLength = name.size();
+    int index = static_cast<int>(keys.size()) - 1;
+    if (stopKey) stopKeyIndex = index;
+    return index;
+}
+
+void JsonFieldExtractor::reset() {
+    for (size_t i = 0; i < keys.size(); ++i) {
+        values[i].clear();
+        found[i] = false;
+    }
+    state = State::BeforeObject;
+    escape = false;
+    nestedInString = false;
+    nestedDepth = 0;
+    currentKey = -1;
+    key.clear();
+}
+
+const std::string* JsonFieldExtractor::get(const std::string& name) const {
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (found[i] && keys[i] == name) return &values[i];
+    }
+    return nullptr;
+}
+
+void JsonFieldExtractor::on_key_complete() {
+    currentKey = -1;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (!found[i] && keys[i] == key) {
+            currentKey = static_cast<int>(i);
+            values[i].clear();
+            break;
+        }
+    }
+    key.clear();
+    state = State::ExpectColon;
+}
+
+void JsonFieldExtractor::on_value_complete() {
+    if (currentKey >= 0) found[currentKey] = true;
+    currentKey = -1;
+    state = State::AfterValue;
+}
+
+bool JsonFieldExtractor::feed(const char* data, int len) {
+    for (int i = 0; i < len && !done(); ++i) {
+        char c = data[i];
+        switch (state) {
+            case State::BeforeObject:
+                if (c == '{') {
+                    state = State::ExpectKey;
+                } else if (!is_json_space(c)) {
+                    state = State::Bad;
+                }
+                break;
+            case State::ExpectKey:
+                if (c == '"') {
+                    state = State::InKey;
+                } else if (c == '}') {
+                    state = State::Done;
+                } else if (!is_json_space(c)) {
+                    state = State::Bad;
+                }
+                break;
+            case State::InKey:
+                if (escape) {
+                    escape = false;
+                    if (key.size() <= maxKeyLength) key.push_back(c);
+                } else if (c == '\\') {
+                    escape = true;
+                } else if (c == '"') {
+                    on_key_complete();
+                } else if (key.size() <= maxKeyLength) {  // longer key can not be wanted, stop growing it
+                    key.push_back(c);
+                }
+                break;
+            case State::ExpectColon:
+                if (c == ':') {
+                    state = State::ExpectValue;
+                } else if (!is_json_space(c)) {
+                    state = State::Bad;
+                }
+                break;
+            case State::ExpectValue:
+                if (c == '"') {
+                    state = State::InString;
+                } else if (c == '{' || c == '[') {
+                    currentKey = -1;  // nested value is skipped
+                    nestedDepth = 1;
+                    state = State::InNested;
+                } else if (!is_json_space(c)) {
+                    if (currentKey >= 0) values[currentKey].push_back(c);
+                    state = State::InScalar;
+                }
+                break;
+            case State::InString:
+                if (escape) {
+                    escape = false;
+                    if (currentKey >= 0 && values[currentKey].size() < MaxJsonValueLength) {
+                        values[currentKey].push_back(c == 'n' ? '\n' : c == 't' ? '\t' : c == 'r' ? '\r' : c);
+                    }
+                } else if (c == '\\') {
+                    escape = true;
+                } else if (c == '"') {
+                    on_value_complete();
+                } else if (currentKey >= 0 && values[currentKey].size() < MaxJsonValueLength) {
+                    values[currentKey].push_back(c);
+                }
+                break;
+            case State::InScalar:
+                if (c == ',' || c == '}' || is_json_space(c)) {
+                    on_value_complete();
+                    if (c == ',') {
+                        state = State::ExpectKey;
+                    } else if (c == '}') {
+                        state = State::Done;
+                    }
+                } else if (currentKey >= 0 && values[currentKey].size() < MaxJsonValueLength) {
+                    values[currentKey].push_back(c);
+                }
+                break;
+            case State::AfterValue:
+                if (c == ',') {
+                    state = State::ExpectKey;
+                } else if (c == '}') {
+                    state = State::Done;
+                } else if (!is_json_space(c)) {
+                    state = State::Bad;
+                }
+                break;
+            case State::InNested:
+                if (nestedInString) {
+                    if (escape) {
+                        escape = false;
+                    } else if (c == '\\') {
+                        escape = true;
+                    } else if (c == '"') {
+                        nestedInString = false;
+                    }
+                } else if (c == '"') {
+                    nestedInString = true;
+                } else if (c == '{' || c == '[') {
+                    ++nestedDepth;
+                } else if ((c == '}' || c == ']') && --nestedDepth == 0) {
+                    on_value_complete();
+                }
+                break;
+            case State::Done:
+            case State::Bad:
+                break;
+        }
+    }
+    return done();
+}
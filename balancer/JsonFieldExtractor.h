@@ -0,0 +1,58 @@
+#ifndef NETUTILS_JSON_FIELD_EXTRACTOR_H
+#define NETUTILS_JSON_FIELD_EXTRACTOR_H
+
+#include <string>
+#include <vector>
+
+/**
+ * streaming scan of a json object for a few top level keys, no DOM is built
+ * fed with body bytes as they arrive, state kept between calls, each byte looked at once
+ * string and scalar values of wanted keys are captured, nested values are skipped
+ * stops as soon as the stop key has its value, so routing does not wait for the rest of body
+ */
+struct JsonFieldExtractor {
+    enum State {
+        BeforeObject,
+        ExpectKey,
+        InKey,
+        ExpectColon,
+        ExpectValue,
+        InString,
+        InScalar,
+        AfterValue,
+        InNested,
+        Done,
+        Bad
+    };
+
+    std::vector<std::string> keys;
+    std::vector<std::string> values;
+    std::vector<bool> found;
+    int stopKeyIndex{-1};
+
+    State state{State::BeforeObject};
+    bool escape{false};
+    bool nestedInString{false};
+    int nestedDepth{0};
+    int currentKey{-1};  // index of wanted key whose value is being read, -1 if value is not wanted
+    std::string key;     // current key, bounded by longest wanted key
+
+    int add_key(const std::string& name, bool stopKey = false);
+    void reset();
+
+    /**
+     * @return true when finished, stop key found, object closed or input is not a json object
+     */
+    bool feed(const char* data, int len);
+
+    bool done() const { return state == State::Done || state == State::Bad || stop_key_found(); }
+    bool stop_key_found() const { return stopKeyIndex >= 0 && found[stopKeyIndex]; }
+    const std::string* get(const std::string& name) const;
+
+private:
+    size_t maxKeyLength{0};
+    void on_key_complete();
+    void on_value_complete();
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef NETUTILS_LB_CONFIG_H
+#define NETUTILS_LB_CONFIG_H
+
+#include <bitset>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+#include "LbConstants.h"
+#include "Utils.h"
+
+/**
+ * runtime options of balancer, filled from command line in main
+ */
+struct LbConfig {
+    uint16_t listenPort{8081};
+    std::string upstreamHosts{"localhost:8080"};
+
+    LimiterAlgorithm limiterAlgorithm{LimiterAlgorithm::NONE};
+    int initialConcurrencyLimit{DefaultInitialConcurrencyLimit};
+    int minConcurrencyLimit{DefaultMinConcurrencyLimit};
+    int maxConcurrencyLimit{DefaultMaxConcurrencyLimit};
+
+    double clientRatePerSecond{0};  // 0 disables per client rate limit
+    double clientRateBurst{0};      // 0 means same as rate
+    int clientRateTableSizeLog2{DefaultClientRateTableSizeLog2};
+
+    double retryBudgetRatio{DefaultRetryBudgetRatio};
+    double retryBudgetFloorPerSecond{DefaultRetryBudgetFloorPerSecond};
+    double retryBudgetMaxTokens{DefaultRetryBudgetMaxTokens};
+
+    std::bitset<MaxHttpStatus> failoverStatuses;  // empty disables response status peek
+
+    int requestTimeoutMs{0};  // 0 disables request deadline, client header can only shorten it, l7 mode only
+    std::string deadlineHeader{DefaultDeadlineHeader};  // empty disables, always empty outside l7 mode
+
+    bool forwardedFor{false};  // append client address to X-Forwarded-For, header injection is l7 mode only
+    bool requestId{false};     // add X-Request-Id unless client sent one
+    std::vector<std::pair<std::string, std::string>> setHeaders;  // added to every request, replacing client ones
+
+    std::vector<std::string> pools;   // "name policy host:port,..." upstream pools routes point to
+    std::vector<std::string> routes;  // "/path[*] [Header~value] -> pool" checked before default upstreams
+
+    bool injects_headers() const { return forwardedFor || requestId || !setHeaders.empty(); }
+
+    bool l7Mode{false};  // pick upstream per request instead of per connection
+    int maxIdlePerUpstream{DefaultMaxIdlePerUpstream};
+    size_t cacheBytes{0};  // 0 disables response cache
+    std::string cacheVaryHeaders{DefaultCacheVaryHeaders};
+    uint16_t adminPort{0};  // prometheus metrics served on this port, 0 disables
+    std::string statsShmName;  // posix shared memory segment for lbtop, empty disables
+    double loopBusyWarnRatio{DefaultLoopBusyWarnRatio};  // 0 disables warning
+    size_t heavyHitters{DefaultHeavyHitters};  // 0 disables top client tracking
+    size_t traceRingSize{DefaultTraceRingSize};  // 0 disables trace ring
+    int traceSlowMs{0};  // links with a request slower than this log their whole trace, 0 disables
+    bool avoidDegraded{false};  // skip upstreams whose tcp path looks degraded while a healthy one is left
+    std::string capturePath;  // sampled client requests written here for replay, empty disables
+    double captureSample{1};  // share of requests captured
+    size_t captureRingBytes{DefaultCaptureRingBytes};
+    std::string accessLogPath;  // binary access records replace per link text lines when set
+
+    void add_set_header(const std::string& line) {
+        auto colon = line.find(':');
+        if (colon == std::string::npos || colon == 0) return;
+        auto valueBegin = line.find_first_not_of(' ', colon + 1);
+        setHeaders.emplace_back(line.substr(0, colon), valueBegin == std::string::npos ? "" : line.substr(valueBegin));
+    }
+
+    void set_failover_statuses(const std::string& statuses) {
+        failoverStatuses.reset();
+        for (const auto& item : split(statuses, ',')) {
+            int status = std::atoi(item.c_str());
+            if (status > 0 && status < MaxHttpStatus) failoverStatuses.set(status);
+        }
+    }
+};
+
+#endif
@@ -9,19 +9,100 @@
 constexpr int MaxServerRetZeroRetryTimes = 3;
 constexpr int MaxServerOnLinkRetryCount = 3;
 constexpr int MaxRandomPickCount = 3;
+constexpr int MaxFailoverAttempts = 5;
 constexpr uint32_t HeartbeatMilliseconds = 1000 * 60;
+constexpr uint32_t StatsMilliseconds = 1000 * 5;
 constexpr char LbPolicyIpHashed = 'h';
 constexpr char LbPolicyRandom = 'r';
 constexpr char LbPolicyRandomTicket = 't';
+constexpr char LbPolicyPipelined = 'p';
 const char *const AsyncCallQueryPath = "ticket";
+const char *const AsyncCallHostKey = "host";  // top level key in json body of async call, picks the upstream
+constexpr size_t MaxJsonValueLength = 256;
+const char *const DefaultFailoverStatuses = "502,503";  // upstream answers with these are retried elsewhere
+constexpr int MaxHttpStatus = 600;
+const char *const DefaultDeadlineHeader = "X-Request-Timeout-Ms";  // read from client and forwarded with remaining budget
+constexpr uint32_t DeadlineTickMilliseconds = 10;
 
 /**
  * within this threshold, we won't retry the server which identified bad last time
  */
 constexpr int64_t FirstUpstreamBadRetryTimeThreshold = 10;  // second
 
+/**
+ * adaptive concurrency limit per upstream, latency measured as time from request sent to first response byte
+ */
+constexpr int DefaultInitialConcurrencyLimit = 20;
+constexpr int DefaultMinConcurrencyLimit = 1;
+constexpr int DefaultMaxConcurrencyLimit = 1000;
+constexpr int64_t MinRttWindowNanos = 30LL * 1000 * 1000 * 1000;  // rolling min rtt kept over two such windows
+constexpr double LimiterBackoffRatio = 0.9;                        // multiplicative decrease on drop or queueing
+constexpr double AimdRttTolerance = 2.0;                            // sample above tolerance * minRtt means queueing
+constexpr double GradientRttTolerance = 1.5;
+constexpr double GradientSmoothing = 0.2;
+
+/**
+ * per client ip token bucket, checked on accept
+ */
+constexpr int DefaultClientRateTableSizeLog2 = 16;
+constexpr int ClientRateProbeLength = 8;  // slots probed before evicting the least recently seen client
+
+/**
+ * retry budget, retries allowed = ratio of successful requests plus a floor per second, capped by max tokens
+ */
+constexpr double DefaultRetryBudgetRatio = 0.2;
+constexpr double DefaultRetryBudgetFloorPerSecond = 10;
+constexpr double DefaultRetryBudgetMaxTokens = 100;
+
+/**
+ * l7 mode, upstream picked per request on keep-alive client connections
+ */
+constexpr int DefaultMaxIdlePerUpstream = 32;  // idle upstream connections pooled for reuse
+constexpr int MaxPipelinedRequests = 8;        // requests dispatched ahead of the one in flight, per link
+constexpr size_t MaxPipelineBufferedBytes = 64 * 1024;  // responses waiting for their turn, per link
+
+/**
+ * response cache of l7 mode, stored responses live in fixed size blocks of one pool bounded by cache budget
+ */
+constexpr size_t CacheBlockSize = 16 * 1024;
+constexpr size_t MaxCacheEntryBytes = 1024 * 1024;  // larger responses pass through uncached
+constexpr int MaxCacheIovecs = 64;                  // blocks handed to one sendmsg
+const char *const DefaultCacheVaryHeaders = "Accept-Encoding";  // request headers taken into cache key
+
+constexpr size_t AccessLogBufferBytes = 64 * 1024;  // binary access records buffered before one write
+constexpr char LbPolicyCache = 'c';                 // request answered from response cache
+
+constexpr double DefaultLoopBusyWarnRatio = 0.8;  // reactor busy share of a stats interval that gets logged as warning
+constexpr size_t DefaultHeavyHitters = 64;                   // client ips tracked by each top-k sketch
+constexpr int HeavyHitterPrecision = 12;                      // distinct client sketch of 4096 registers
+constexpr uint32_t HeavyHitterIntervalMilliseconds = 60 * 1000;  // top clients logged and sketches reset
+constexpr size_t HeavyHitterLogTop = 10;
+constexpr size_t DefaultTraceRingSize = 1024;  // finished link traces kept for dump on SIGUSR1 or GET /traces
+
+constexpr uint32_t StatsPublishMilliseconds = 100;          // shared memory stats refresh, lbtop draws at same rate
+constexpr uint32_t StatsQuantileWindowMilliseconds = 1000;  // latency quantiles cover last one to two windows
+
+/**
+ * kernel TCP_INFO of upstream sockets, one getsockopt per upstream per interval at most
+ */
+constexpr uint32_t TcpInfoSampleMilliseconds = 100;
+constexpr double TcpDegradedRttFactor = 4;       // smoothed rtt this many times baseline marks path degraded
+constexpr double TcpDegradedRttFloorUs = 2000;   // and at least this far above it, loopback rtt is all noise
+constexpr double TcpDegradedRetransmits = 1;     // or sampled sockets retransmitted more than this between samples
+constexpr size_t TcpInfoTrackedSockets = 4096;   // retransmit totals remembered per upstream, forgotten all at once
+
+/**
+ * traffic capture for replay, request bytes are what sits in link buffer when request is dispatched,
+ * body of a longer request is left out and padded back by replay
+ */
+constexpr size_t MaxCaptureRequestBytes = PACKET_BUFFER_SIZE;
+constexpr size_t DefaultCaptureRingBytes = 4 * 1024 * 1024;
+constexpr int CaptureWriterIdleMicros = 1000;
+
 enum LbPolicy { IP_HASHED, RANDOMED };
 
+enum class LimiterAlgorithm { NONE, AIMD, GRADIENT };
+
 enum LbClientSource { Unknown, PythonClient, CSharpClient };
 
 #endif
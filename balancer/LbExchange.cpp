@@ -0,0 +1,80 @@
+#include <CachedClock.h>
+#include <Utils.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include "LbConstants.h"
+#include "LbExchange.h"
+#include "Metrics.h"
+#include "Upstream.h"
+
+int LbExchange::on_server_send() {
+    while (requestSent < request.size()) {
+        ssize_t ret = send(serverFd, request.data() + requestSent, request.size() - requestSent, MSG_NOSIGNAL);
+        if (ret < 0) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+        if (requestSentNs == 0) requestSentNs = thread_clock().mono_ns();
+        requestSent += ret;
+    }
+    if (requestCompleteNs == 0) requestCompleteNs = thread_clock().mono_ns();
+    return 1;
+}
+
+/**
+ * received bytes are appended behind the buffered ones, anything past end of response is dropped
+ */
+int LbExchange::on_server_recv() {
+    if (responseSent == response.size()) {
+        response.clear();
+        responseSent = 0;
+    }
+    size_t old = response.size();
+    response.resize(old + PACKET_BUFFER_SIZE);
+    ssize_t ret = recv(serverFd, &response[old], PACKET_BUFFER_SIZE, 0);
+    if (ret <= 0) {
+        response.resize(old);
+        return (ret < 0 && errno == EAGAIN) ? 0 : -1;
+    }
+
+    int consumed = framer.feed(&response[old], static_cast<int>(ret));
+    if (consumed < ret) framer.keepAlive = false;  // upstream sent more than one response, do not reuse it
+    response.resize(old + consumed);
+
+    if (firstResponseNs == 0) {
+        firstResponseNs = thread_clock().mono_ns();
+        if (requestSentNs > 0) {
+            pUpstream->limiter.on_sample(firstResponseNs - requestSentNs, firstResponseNs);
+            pUpstream->metrics->firstByteNs.record(firstResponseNs - requestSentNs);
+        }
+        if (pUpstream->path.due(firstResponseNs)) pUpstream->path.sample(serverFd, firstResponseNs);
+    }
+    pUpstream->metrics->responseBytes.add(ret);
+    serverTotalBytes += consumed;
+    return framer.bad() ? -1 : static_cast<int>(ret);  // response can not be framed, handled like a cut one
+}
+
+int LbExchange::on_client_send(int clientFd) {
+    while (responseSent < response.size()) {
+        ssize_t ret = send(clientFd, response.data() + responseSent, response.size() - responseSent, MSG_NOSIGNAL);
+        if (ret < 0) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+        responseSent += ret;
+    }
+    return 1;
+}
+
+void LbExchange::reset_for_retry(Upstream* upstream, int serverFd_) {
+    pUpstream = upstream;
+    serverFd = serverFd_;
+    serverEvents = 0;
+    retried = true;
+    requestSent = 0;
+    response.clear();
+    responseSent = 0;
+    serverTotalBytes = 0;
+    requestSentNs = 0;
+    requestCompleteNs = 0;
+    firstResponseNs = 0;
+    framer.restart();
+}
@@ -0,0 +1,49 @@
+#ifndef NETUTILS_LB_EXCHANGE_H
+#define NETUTILS_LB_EXCHANGE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include "HttpFramer.h"
+
+struct Upstream;
+
+/**
+ * pipelined request dispatched ahead of the one in flight on its link, to its own upstream connection
+ * response is buffered until all earlier responses of the link are written to client
+ */
+struct LbExchange {
+    Upstream* pUpstream{nullptr};
+    int serverFd{-1};  // -1 once response complete and connection released
+    uint32_t serverEvents{0};
+    bool randomed{false};       // picked at random instead of by client ip
+    int pool{-1};               // routed pool, -1 for default upstreams
+    bool retried{false};        // one retry elsewhere when upstream closes without response
+    bool closeDelimited{false};  // response ended by upstream close, client connection must end after it
+    bool hasDeadline{false};     // waiting for first response byte, survives a retry
+    std::multimap<int64_t, LbExchange*>::iterator deadlineIt;
+
+    std::string request;  // whole request, kept until response starts for retry
+    size_t requestSent{0};
+    std::string response;  // bytes waiting for their turn to client
+    size_t responseSent{0};
+    size_t serverTotalBytes{0};
+    int64_t requestSentNs{0};
+    int64_t requestCompleteNs{0};
+    int64_t firstResponseNs{0};
+    HttpFramer framer;
+
+    bool has_request_to_send() const { return serverFd >= 0 && requestSent < request.size(); }
+    size_t buffered() const { return response.size() - responseSent; }
+
+    // > 0: request sent; 0: not finished; < 0: error
+    int on_server_send();
+    // > 0: bytes received; 0: nothing yet; < 0: closed or error
+    int on_server_recv();
+    // > 0: buffered response drained; 0: not finished; < 0: error
+    int on_client_send(int clientFd);
+
+    void reset_for_retry(Upstream* upstream, int serverFd_);
+};
+
+#endif
@@ -1,31 +1,51 @@
+#include <CachedClock.h>
 #include <Utils.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <cstring>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/predicate.hpp>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include "LbLink.h"
+#include "Metrics.h"
 #include "Upstream.h"
 
 using namespace std;
 
-LbLink::LbLink(int clientFd_, const std::string& clientEndpoint_)
-    : clientFd(clientFd_), clientEndpoint(clientEndpoint_) {}
+static int to_int(boost::string_view digits) {
+    int value = 0;
+    for (char c : digits) {
+        if (c < '0' || c > '9') break;
+        value = value * 10 + (c - '0');
+    }
+    return value;
+}
+
+LbLink::LbLink(int clientFd_, const std::string& clientEndpoint_, const LbConfig* config_)
+    : clientFd(clientFd_), config(config_), clientEndpoint(clientEndpoint_) {
+    parser.init(clientSendBuffer, 0);
+    parser.body.add_key(AsyncCallHostKey, true);
+}
 
 void LbLink::print_leave_info(int leaver, std::ostream& os) {
+    const string& upstream = pUpstream ? pUpstream->endpoint : string("none");
+    size_t clientBytes = doneClientBytes + clientTotalBytes;
+    size_t serverBytes = doneServerBytes + serverTotalBytes;
     if (leaver == clientFd) {
-        os << "leave " << clientEndpoint << " " << clientTotalBytes << " -> " << pUpstream->endpoint << " "
-           << serverTotalBytes << endl;
+        os << "leave " << clientEndpoint << " " << clientBytes << " -> " << upstream << " " << serverBytes;
     } else {
-        os << "leave " << pUpstream->endpoint << " " << serverTotalBytes << " -> " << clientEndpoint << " "
-           << clientTotalBytes << endl;
-        print_client_request(os);
+        os << "leave " << upstream << " " << serverBytes << " -> " << clientEndpoint << " " << clientBytes;
     }
+    if (l7) os << " requests " << requestCount;
+    os << endl;
+    if (leaver != clientFd) print_client_request(os);
 }
 
 void LbLink::print_client_request(std::ostream& os) {
@@ -35,21 +55,41 @@ void LbLink::print_client_request(std::ostream& os) {
     }
 }
 
+/**
+ * fields every event shares, callers fill in event specific ones
+ */
+AccessRecord LbLink::access_record(AccessEvent event, const Upstream* upstream) const {
+    AccessRecord record;
+    record.event = static_cast<uint8_t>(event);
+    record.failovers = failovers;
+    record.clientIp = clientIp;
+    record.clientPort = clientPort;
+    if (upstream) {
+        record.upstreamIp = upstream->serverAddr.sin_addr.s_addr;
+        record.upstreamPort = ntohs(upstream->serverAddr.sin_port);
+    }
+    record.timeNs = thread_clock().wall_ns();
+    return record;
+}
+
 void LbLink::print_on_link_info(char lbPolicy, std::ostream& os) {
-    os << time_t2string(startTimestamp) << " open " << lbPolicy << " " << clientEndpoint << " <--> "
+    os << thread_clock().now_string() << " open " << lbPolicy << " " << clientEndpoint << " <--> "
        << pUpstream->endpoint << endl;
 }
 
+/**
+ * request bytes are appended while they can still be replayed on failover, i.e. no response yet and buffer not full
+ */
 int LbLink::on_client_recv() {
-    int ret;
-
-    if (clearClientBuffer) {
+    int end = sendBufferOffset + sendBufferLength;
+    if (clearClientBuffer && (serverTotalBytes > 0 || end >= PACKET_BUFFER_SIZE)) {
         sendBufferOffset = 0;
         sendBufferLength = 0;
-        ret = recv(clientFd, clientSendBuffer, PACKET_BUFFER_SIZE, 0);
-    } else {
-        ret = recv(clientFd, clientSendBuffer + sendBufferLength, PACKET_BUFFER_SIZE - sendBufferLength, 0);
+        end = 0;
     }
+    if (end >= PACKET_BUFFER_SIZE) return -1;  // wait for complete content but buffer already full
+
+    int ret = recv(clientFd, clientSendBuffer + end, PACKET_BUFFER_SIZE - end, 0);
 
     if (ret < 0) {
         if (errno == EAGAIN) {
@@ -61,20 +101,20 @@ int LbLink::on_client_recv() {
         return -1;
     }
 
-    if (clearClientBuffer)
-        sendBufferLength = ret;
-    else
-        sendBufferLength += ret;
-
-    clientTotalBytes += sendBufferLength;
+    sendBufferLength += ret;
+    clientTotalBytes += ret;
     return ret;
 }
 
+/**
+ * while peeking status, bytes are appended and held, then released in one go unless the status is retryable
+ */
 int LbLink::on_server_recv() {
-    recvBufferOffset = 0;
-    recvBufferLength = 0;
+    bool peeking = is_peeking_status();
+    if (!peeking) recvBufferLength = 0;
+    if (recvBufferLength == 0) recvBufferOffset = 0;  // l7 link peeks again on each request
 
-    int ret = recv(serverFd, clientRecvBuffer, PACKET_BUFFER_SIZE, 0);
+    int ret = recv(serverFd, clientRecvBuffer + recvBufferLength, PACKET_BUFFER_SIZE - recvBufferLength, 0);
     if (ret < 0) {
         if (errno == EAGAIN) {
             return 0;
@@ -93,8 +133,30 @@ int LbLink::on_server_recv() {
         return -1;
     }
 
-    recvBufferLength = ret;
-    serverTotalBytes += recvBufferLength;
+    if (firstResponseNs == 0) {
+        firstResponseNs = thread_clock().mono_ns();
+        trace.record(TraceEvent::FirstResponse, thread_clock().mono_ns());
+        if (requestSentNs > 0) {
+            pUpstream->limiter.on_sample(firstResponseNs - requestSentNs, firstResponseNs);
+            pUpstream->metrics->firstByteNs.record(firstResponseNs - requestSentNs);
+        }
+        if (pUpstream->path.due(firstResponseNs)) pUpstream->path.sample(serverFd, firstResponseNs);
+    }
+    pUpstream->metrics->responseBytes.add(ret);
+
+    recvBufferLength += ret;
+    if (peeking) {
+        if (!statusParser.feed(clientRecvBuffer + recvBufferLength - ret, ret)) {
+            return 0;  // status line not complete yet
+        }
+        if (statusParser.valid() && config->failoverStatuses.test(statusParser.status) &&
+            !client_do_not_support_failover()) {
+            hasFirstUpstreamTriedAgain = true;  // no point to ask same upstream again
+            return -1;                          // response held, failover decides to drop or release it
+        }
+        ret = recvBufferLength;
+    }
+    serverTotalBytes += ret;
     return ret;
 }
 
@@ -130,12 +192,23 @@ int LbLink::on_client_send() {
             totalSent += ret;
         }
     }
+    if (totalSent > 0) trace.lastByteNs = thread_clock().mono_ns();
     return totalSent;
 }
+/**
+ * in l7 mode bytes past current request stay in buffer, they are next request and go to its own upstream
+ */
 int LbLink::on_server_send() {
     int totalSent = 0;
-    while (sendBufferLength > 0) {
-        int ret = send(serverFd, clientSendBuffer + sendBufferOffset, sendBufferLength, 0);
+    if (splice.pending) {
+        totalSent = send_spliced();
+        if (totalSent <= 0) return totalSent;
+    }
+
+    while (sendBufferLength > 0 && requestRemaining != 0) {
+        int length = sendBufferLength;
+        if (requestRemaining > 0 && requestRemaining < length) length = static_cast<int>(requestRemaining);
+        int ret = send(serverFd, clientSendBuffer + sendBufferOffset, length, MSG_NOSIGNAL);
         if (ret < 0) {
             if (errno == EAGAIN) {
                 return 0;
@@ -143,14 +216,52 @@ int LbLink::on_server_send() {
                 return -1;
             }
         } else {
+            if (requestSentNs == 0) {
+                requestSentNs = thread_clock().mono_ns();
+                trace.record(TraceEvent::RequestSent, thread_clock().mono_ns());
+            }
             sendBufferLength -= ret;
             sendBufferOffset += ret;
             totalSent += ret;
+            if (requestRemaining > 0) requestRemaining -= ret;
         }
     }
     return totalSent;
 }
 
+/**
+ * send buf[sendBufferOffset, splice.end) with spliced headers, then continue with plain buffer
+ */
+int LbLink::send_spliced() {
+    int total = splice.total();
+    int totalSent = 0;
+    while (splice.sent < total) {
+        struct iovec iov[HeaderSplice::MaxIovecs];
+        int count = splice.fill_iovec(clientSendBuffer, iov);
+        ssize_t ret = writev(serverFd, iov, count);
+        if (ret < 0) {
+            if (errno == EAGAIN) {
+                return 0;
+            } else {
+                return -1;
+            }
+        }
+        if (requestSentNs == 0) {
+            requestSentNs = thread_clock().mono_ns();
+            trace.record(TraceEvent::RequestSent, thread_clock().mono_ns());
+        }
+        splice.sent += static_cast<int>(ret);
+        totalSent += static_cast<int>(ret);
+    }
+
+    splice.pending = false;
+    int consumed = splice.end - sendBufferOffset;
+    sendBufferLength -= consumed;
+    sendBufferOffset = splice.end;
+    if (requestRemaining > 0) requestRemaining -= consumed;
+    return totalSent > 0 ? totalSent : 1;
+}
+
 void LbLink::on_leave() {
     // socket
     close(clientFd);
@@ -167,26 +278,31 @@ int LbLink::parse_client_content() {
     if (clientHeaderParsed) return 1;
     if (clientTotalBytes > PACKET_BUFFER_SIZE) return -1;
 
-    clientSendBuffer[clientTotalBytes] = '\0';
-    HttpParser parser(clientSendBuffer, clientTotalBytes);
+    parser.update_length(static_cast<int>(clientTotalBytes));  // resume from where last recv stopped
+    parser.parse();
+    if (parser.is_bad()) return -1;
 
-    parser.parse_method();
     if (parser.has_complete_method()) {
-        if (boost::algorithm::ends_with(parser.get_query_path(), AsyncCallQueryPath)) {
+        if (parser.get_query_path().ends_with(AsyncCallQueryPath)) {
             isAsyncCall = true;
         }
 
-        parser.parse_header();
         if (parser.has_complete_header()) {
-            string agent = parser.get_header("User-Agent");
-            if (!agent.empty() && agent.find("python") != string::npos) {
+            requestLineEnd = parser.requestLineEnd;
+            requestHeaderEnd = parser.headerEnd;
+            const HttpHeader* deadline = find_deadline(parser, *config, requestTimeoutMs);
+            if (deadline) {
+                deadlineLineBegin = deadline->lineBegin;
+                deadlineLineEnd = deadline->lineEnd;
+            }
+            if (parser.get_header(HttpHeaderId::UserAgent).find("python") != boost::string_view::npos) {
                 source = LbClientSource::PythonClient;
             }
 
             if (isAsyncCall && source == LbClientSource::PythonClient) {
                 parser.parse_body();
                 if (parser.has_complete_body()) {
-                    asyncHost = parser.get_header("host");
+                    asyncHost = parser.get_body_value(AsyncCallHostKey);
                     clientHeaderParsed = true;
                     return 1;
                 } else {
@@ -204,12 +320,254 @@ int LbLink::parse_client_content() {
     }
 }
 
+/**
+ * client deadline header of request, its value in timeoutMs, left as is without one
+ */
+const HttpHeader* LbLink::find_deadline(HttpParser& request, const LbConfig& config, int& timeoutMs) {
+    const HttpHeader* deadline = config.deadlineHeader.empty() ? nullptr : request.find_header(config.deadlineHeader);
+    if (deadline) timeoutMs = to_int(deadline->value);
+    return deadline;
+}
+
+/**
+ * configured headers of current request, built once so a failover replay carries the same request id
+ * @return false if client repeated a header they replace
+ */
+bool LbLink::prepare_inject_headers() {
+    injectSkips.clear();
+    injectHeaders.clear();
+    return forward_headers(parser, *config, clientAddress, injectHeaders, injectSkips);
+}
+
+/**
+ * splice configured headers and remaining budget in deadline header into request, replacing lines client sent
+ * @return false if a client line to replace could not be left out, it must not go out next to its replacement
+ */
+bool LbLink::prepare_headers(int64_t nowNs) {
+    const string& name = config->deadlineHeader;
+    bool withDeadline = deadlineNs > 0 && !name.empty();
+    if (requestLineEnd < 0 || requestHeaderEnd > sendBufferOffset + sendBufferLength) return true;
+    if (!withDeadline && injectHeaders.empty()) return true;
+
+    int64_t end = sendBufferOffset + sendBufferLength;
+    if (requestRemaining >= 0) end = std::min<int64_t>(end, sendBufferOffset + requestRemaining);
+    splice.clear();
+    splice.set_range(requestLineEnd, static_cast<int>(end));
+    bool fitted = true;
+    for (const auto& skip : injectSkips) fitted = splice.add_skip(skip.first, skip.second) && fitted;
+    splice.headers = injectHeaders;
+    if (withDeadline) {
+        if (deadlineLineBegin >= 0 && parser.header_repeated(name)) fitted = false;
+        if (deadlineLineBegin >= 0) fitted = splice.add_skip(deadlineLineBegin, deadlineLineEnd) && fitted;
+        int64_t remainingMs = std::max<int64_t>(1, (deadlineNs - nowNs) / 1000000);
+        splice.headers += name + ": " + std::to_string(remainingMs) + "\r\n";
+    }
+    if (!fitted) {
+        splice.clear();
+        return false;
+    }
+    splice.rearm();
+    return true;
+}
+
+/**
+ * header lines to add to request: X-Forwarded-For keeps what client sent and appends its address,
+ * X-Request-Id is generated unless client sent one, configured headers replace client ones of same name
+ * @param replaced line ranges of client headers to leave out, offsets into request buffer
+ * @return false if client repeated a header to replace, only first line is known so the others would go out too
+ */
+bool LbLink::forward_headers(HttpParser& request, const LbConfig& config, const std::string& clientAddress,
+                             std::string& lines, std::vector<std::pair<int, int>>& replaced) {
+    if (config.forwardedFor) {
+        if (request.header_repeated(KnownHeaderNames[static_cast<int>(HttpHeaderId::XForwardedFor)])) return false;
+        const HttpHeader* forwarded = request.find_header(HttpHeaderId::XForwardedFor);
+        lines += "X-Forwarded-For: ";
+        if (forwarded) {
+            lines.append(forwarded->value.data(), forwarded->value.size()).append(", ");
+            replaced.emplace_back(forwarded->lineBegin, forwarded->lineEnd);
+        }
+        lines += clientAddress + "\r\n";
+    }
+    if (config.requestId && !request.has_header(HttpHeaderId::XRequestId)) {
+        lines += "X-Request-Id: " + next_request_id() + "\r\n";
+    }
+    for (const auto& header : config.setHeaders) {
+        const HttpHeader* sent = request.find_header(header.first);
+        if (sent && request.header_repeated(header.first)) return false;
+        if (sent) replaced.emplace_back(sent->lineBegin, sent->lineEnd);
+        lines += header.first + ": " + header.second + "\r\n";
+    }
+    return true;
+}
+
 void LbLink::reset_server_side_for_failover(Upstream* newOne, int newServerFd_) {
     sendBufferOffset = 0;
     sendBufferLength = clientTotalBytes;
     pUpstream = newOne;
+    lastUpstream = newOne;
+    if (failovers < UINT8_MAX) ++failovers;
     serverRetZeroRetryTimes = 0;
+    requestSentNs = 0;
+    firstResponseNs = 0;
+    recvBufferOffset = 0;
+    recvBufferLength = 0;
+    statusParser.reset();
     serverFd = newServerFd_;
+    if (l7 && !l7Tunnel) {
+        requestRemaining = requestLength;
+        requestCompleteNs = 0;
+        responseFramer.restart();
+    }
+    if (splice.insertAt >= 0) prepare_headers(thread_clock().mono_ns());  // same lines that fitted first time
+}
+
+/**
+ * length of current request from its head, chunked or upgraded requests and those asking to close are
+ * piped as a tunnel to the upstream they land on, like a non l7 link
+ * @return false if request turned link into tunnel
+ */
+bool LbLink::frame_request() {
+    responseFramer.reset(HttpFramer::Response, parser.method == "HEAD");
+    requestFramer.reset(HttpFramer::Request);
+    if (needs_tunnel(parser)) {
+        l7Tunnel = true;
+        requestLength = -1;
+        requestRemaining = -1;
+        return false;
+    }
+    requestLength = 0;
+    requestRemaining = 0;
+    frame_request_bytes();
+    return true;
+}
+
+/**
+ * extend current request over bytes received behind its framed part, framed bytes can be forwarded right away
+ */
+void LbLink::frame_request_bytes() {
+    if (requestRemaining < 0 || requestFramer.complete() || requestFramer.bad()) return;
+    int begin = sendBufferOffset + static_cast<int>(requestRemaining);
+    int end = sendBufferOffset + sendBufferLength;
+    if (begin >= end) return;
+
+    int consumed = requestFramer.feed(clientSendBuffer + begin, end - begin);
+    requestRemaining += consumed;
+    requestLength += consumed;
+}
+
+/**
+ * requests asking to end connection or leave http, they are piped to their upstream like a non l7 link
+ */
+bool LbLink::needs_tunnel(HttpParser& request) {
+    const HttpHeader* connection = request.find_header(HttpHeaderId::Connection);
+    return request.version != "HTTP/1.1" || (connection && boost::algorithm::icontains(connection->value, "close")) ||
+           request.find_header(HttpHeaderId::Upgrade) != nullptr || request.method == "CONNECT";
+}
+
+/**
+ * one line per l7 request, latency from last request byte forwarded to last response byte received
+ */
+void LbLink::print_request_done(const std::string& upstream, int status, size_t bytes, int64_t latencyNs,
+                                std::ostream& os) {
+    os << thread_clock().now_string() << " done " << clientEndpoint << " <--> " << upstream << " " << status << " "
+       << bytes << " " << latencyNs / 1000 << "us" << endl;
+}
+
+/**
+ * stored response written straight from cache blocks, iovecs rebuilt from sent offset after partial writes
+ * @return > 0 all written; 0 client busy; < 0 error
+ */
+int LbLink::send_cache_hit() {
+    while (cacheHitSent < cacheHit->size) {
+        struct iovec iov[MaxCacheIovecs];
+        struct msghdr msg {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = cacheHit->to_iovec(cacheHitSent, iov, MaxCacheIovecs);
+        ssize_t ret = sendmsg(clientFd, &msg, MSG_NOSIGNAL);  // writev that can not raise SIGPIPE
+        if (ret < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        cacheHitSent += ret;
+        trace.lastByteNs = thread_clock().mono_ns();
+    }
+    return 1;
+}
+
+LbExchange* LbLink::find_exchange(int fd) {
+    for (LbExchange* exchange : pipeline) {
+        if (exchange->serverFd == fd) return exchange;
+    }
+    return nullptr;
+}
+
+size_t LbLink::pipeline_buffered() {
+    size_t total = 0;
+    for (LbExchange* exchange : pipeline) total += exchange->buffered();
+    return total;
+}
+
+/**
+ * take a request dispatched ahead out of client buffer, bytes behind it move up
+ */
+void LbLink::remove_client_bytes(int begin, int length) {
+    int end = sendBufferOffset + sendBufferLength;
+    memmove(clientSendBuffer + begin, clientSendBuffer + begin + length, end - begin - length);
+    sendBufferLength -= length;
+    clientTotalBytes -= length;
+    doneClientBytes += length;
+}
+
+/**
+ * current exchange done and its upstream detached, bytes already received past the request are next request,
+ * moved to buffer start so offsets of parser and splice stay relative to 0
+ */
+void LbLink::reset_request() {
+    int leftover = sendBufferLength;
+    if (leftover > 0 && sendBufferOffset > 0) memmove(clientSendBuffer, clientSendBuffer + sendBufferOffset, leftover);
+    doneClientBytes += clientTotalBytes - leftover;
+    doneServerBytes += serverTotalBytes;
+    ++requestCount;
+
+    sendBufferOffset = 0;
+    sendBufferLength = leftover;
+    clientTotalBytes = leftover;
+    serverTotalBytes = 0;
+    serverFd = -1;
+    serverEvents = 0;
+    pUpstream = nullptr;
+    requestSentNs = 0;
+    firstResponseNs = 0;
+    serverRetZeroRetryTimes = 0;
+    onLinkRetryServerCount = 0;
+    randomRetryServerCount = 0;
+    currentUpstreamIndex = -1;
+    hasFirstUpstreamTriedAgain = false;
+    pool = -1;
+    poolAttempts = 0;
+
+    requestTimeoutMs = 0;
+    requestLineEnd = -1;
+    requestHeaderEnd = -1;
+    deadlineLineBegin = -1;
+    deadlineLineEnd = -1;
+    requestPrepared = false;
+    deadlineNs = 0;
+    splice.clear();
+    injectHeaders.clear();
+    injectSkips.clear();
+    requestLength = -1;
+    requestRemaining = -1;
+    requestCompleteNs = 0;
+    cacheKey.clear();
+    cacheFill = false;
+    cacheWaiting = false;
+    cacheFillEntry.reset();
+
+    clientHeaderParsed = false;
+    isAsyncCall = false;
+    asyncHost.clear();
+    source = LbClientSource::Unknown;
+    clearClientBuffer = true;
+    parser.init(clientSendBuffer, 0);
+    statusParser.reset();
 }
 
 bool LbLink::check_on_link_retry_count_exceed() {
@@ -1,10 +1,23 @@
 #ifndef BEAUTY_LINK_H
 #define BEAUTY_LINK_H
 
+#include <deque>
+#include <map>
 #include <ostream>
 #include <string>
+#include <utility>
+#include <vector>
+#include "AccessLog.h"
+#include "CachedClock.h"
+#include "HeaderSplice.h"
+#include "HttpFramer.h"
 #include "HttpParser.h"
+#include "LbConfig.h"
 #include "LbConstants.h"
+#include "LbExchange.h"
+#include "LinkTrace.h"
+#include "ResponseCache.h"
+#include "Utils.h"
 
 /**
  * client                      proxy                        server
@@ -18,10 +31,56 @@ struct Upstream;
 
 struct LbLink {
     int clientFd{-1};  // accept as client fd
+    uint32_t clientIp{0};  // binary ipv4 in network order
+    uint16_t clientPort{0};
     int serverFd{-1};  // upstream server fd
     int onLinkRetryServerCount{0};
     int randomRetryServerCount{0};
-    time_t startTimestamp{time(nullptr)};
+    time_t startTimestamp{thread_clock().now()};
+    int64_t startNs{thread_clock().wall_ns()};
+    uint8_t failovers{0};    // upstream switches after first pick
+    uint8_t closeReason{0};  // AccessCloseReason decided before leave, else by side that left
+    Upstream* lastUpstream{nullptr};  // kept after l7 exchange releases pUpstream, link metrics go there
+    LinkTrace trace;
+    int64_t requestSentNs{0};     // first byte forwarded to current upstream, for limiter latency sample
+    int64_t firstResponseNs{0};  // first byte received from current upstream
+    const LbConfig* config{nullptr};
+
+    int requestTimeoutMs{0};  // from client deadline header
+    int requestLineEnd{-1};   // offset after request line of first request in clientSendBuffer
+    int requestHeaderEnd{-1};
+    int deadlineLineBegin{-1};  // client deadline header line, replaced when forwarding
+    int deadlineLineEnd{-1};
+    bool requestPrepared{false};
+    bool captured{false};  // first bytes of non l7 link went to traffic capture
+    bool hasDeadline{false};
+    int64_t deadlineNs{0};
+    std::multimap<int64_t, LbLink*>::iterator deadlineIt;
+    HeaderSplice splice;  // headers inserted into first request, replayed on failover
+    std::string injectHeaders;  // configured header lines of current request, same ones on every replay
+    std::vector<std::pair<int, int>> injectSkips;  // client header lines they replace
+
+    bool l7{false};                 // upstream picked per request, current request always starts at buffer offset 0
+    bool l7Tunnel{false};           // request can not be framed, rest of connection piped to current upstream
+    int64_t requestLength{-1};      // bytes of current request framed so far, from buffer start
+    int64_t requestRemaining{-1};   // framed bytes of current request not forwarded yet, -1 unbounded
+    int64_t requestCompleteNs{0};   // last byte of current request forwarded
+    uint32_t clientEvents{0};       // epoll interest registered, l7 only
+    uint32_t serverEvents{0};
+    int requestCount{0};            // requests completed on this link
+    size_t doneClientBytes{0};      // bytes of completed requests
+    size_t doneServerBytes{0};
+    HttpFramer requestFramer;       // finds end of current request, bytes behind it belong to next one
+    HttpFramer responseFramer;      // finds end of current response so upstream connection can be reused
+    std::deque<LbExchange*> pipeline;  // pipelined requests behind current one, responses queued in request order
+    HttpParser pipelineParser;         // next buffered request, checked for being complete and framable
+    bool rateLimited{false};           // next buffered request already refused by client rate limit, answered in turn
+    std::string cacheKey;              // current request may be answered from cache or fill it
+    bool cacheFill{false};             // response of current request captured into cacheFillEntry
+    bool cacheWaiting{false};          // parked until link fetching same key is done
+    std::shared_ptr<CacheEntry> cacheFillEntry;
+    std::shared_ptr<CacheEntry> cacheHit;  // stored response written to client in place of upstream one
+    size_t cacheHitSent{0};
 
     size_t clientTotalBytes{0};
     int sendBufferLength{0};
@@ -34,9 +93,13 @@ struct LbLink {
     char clientRecvBuffer[PACKET_BUFFER_SIZE];
 
     std::string clientEndpoint;
+    std::string clientAddress;  // ip part of clientEndpoint
     Upstream* pUpstream{nullptr};
 
     int firstUpstreamIndex{-1};  // the first time index picked, it should be calculated by ip hashed value
+    int pool{-1};                // routed pool of current request, -1 for default upstreams
+    int poolStart{0};            // member picked first by pool policy
+    int poolAttempts{0};         // members tried for current request, next pick goes on from there
     int currentUpstreamIndex{-1};
     int serverRetZeroRetryTimes{0};
 
@@ -47,8 +110,10 @@ struct LbLink {
     bool clearClientBuffer{true};
     std::string asyncHost;
     LbClientSource source{LbClientSource::Unknown};
+    HttpParser parser;              // first request in clientSendBuffer, resumed on each recv
+    HttpStatusParser statusParser;  // first response held in clientRecvBuffer until its status is known
 
-    LbLink(int clientFd_, const std::string& clientEndpoint_);
+    LbLink(int clientFd_, const std::string& clientEndpoint_, const LbConfig* config_);
     ~LbLink() = default;
 
     bool client_do_not_support_failover() {  // if bytes exceed current buffer size, means some byte cannot re-send
@@ -59,6 +124,7 @@ struct LbLink {
     bool check_random_retry_count_exceed();
     void print_leave_info(int leaver, std::ostream& os);
     void print_on_link_info(char lbPolicy, std::ostream& os);
+    AccessRecord access_record(AccessEvent event, const Upstream* upstream) const;
     void print_client_request(std::ostream& os);
 
     bool is_client_side(int fd) { return fd == clientFd; }
@@ -68,11 +134,21 @@ struct LbLink {
         if (is_client_side(fd))
             return sendBufferLength == 0 || !clearClientBuffer;
         else
-            return recvBufferLength == 0;
+            return recvBufferLength == 0 || is_peeking_status();
     }
 
+    // first response of link not forwarded until status line tells whether it should be retried elsewhere
+    bool is_peeking_status() { return config->failoverStatuses.any() && serverTotalBytes == 0 && !statusParser.done(); }
+    bool has_held_response() { return serverTotalBytes == 0 && recvBufferLength > 0; }
+    void release_held_response() { serverTotalBytes += recvBufferLength; }
+
     bool is_buffer_not_empty(int fd) { return !is_buffer_empty(fd); }
 
+    bool has_request_to_send() {
+        return serverFd >= 0 && clearClientBuffer && requestRemaining != 0 && (splice.pending || sendBufferLength > 0);
+    }
+    bool has_response_to_send() { return !is_buffer_empty(serverFd); }
+
     void on_leave();
 
     // handle EPOLLIN event
@@ -88,8 +164,26 @@ struct LbLink {
     int on_server_send();
 
     int parse_client_content();
+    static const HttpHeader* find_deadline(HttpParser& request, const LbConfig& config, int& timeoutMs);
+    bool prepare_inject_headers();
+    bool prepare_headers(int64_t nowNs);
+    static bool forward_headers(HttpParser& request, const LbConfig& config, const std::string& clientAddress,
+                                std::string& lines, std::vector<std::pair<int, int>>& replaced);
+    int send_spliced();
 
     void reset_server_side_for_failover(Upstream* newOne, int newServerFd_);
+
+    bool frame_request();
+    void frame_request_bytes();
+    bool request_forwarded() { return requestFramer.complete() && requestRemaining == 0; }
+    void reset_request();
+    int send_cache_hit();
+    void print_request_done(const std::string& upstream, int status, size_t bytes, int64_t latencyNs, std::ostream& os);
+    static bool needs_tunnel(HttpParser& request);
+
+    LbExchange* find_exchange(int fd);
+    size_t pipeline_buffered();
+    void remove_client_bytes(int begin, int length);
 };
 
 #endif
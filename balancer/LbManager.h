@@ -5,22 +5,45 @@
 #include <pthread.h>
 #include <sys/epoll.h>
 #include <unistd.h>
+#include <atomic>
 #include <iostream>
+#include <map>
 #include <random>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
+#include "CachedClock.h"
+#include "ClientRateLimiter.h"
+#include "HeavyHitters.h"
+#include "LbConfig.h"
 #include "LbConstants.h"
 #include "LbLink.h"
+#include "LoopProfiler.h"
+#include "Metrics.h"
+#include "RetryBudget.h"
+#include "RouteTable.h"
 #include "RawSocket.h"
 #include "RollingLog.h"
+#include "StatsSegment.h"
+#include "TrafficCapture.h"
 #include "Upstream.h"
 #include "Utils.h"
 
 using namespace std;
 
+/**
+ * connection on admin port, request read up to its blank line, then response written out and closed
+ */
+struct AdminConn {
+    std::string request;
+    std::string response;
+    size_t sent{0};
+};
+
 struct ILbManager {
     int pipeFd[2];  // for signal coming from manager
     pthread_t thread;
+    std::atomic<bool> traceDumpRequested{false};  // set from signal handler, reactor dumps trace ring to log
 
     ILbManager() = default;
     virtual ~ILbManager() = default;
@@ -35,20 +58,49 @@ struct LbManager : public ILbManager {
     std::uniform_int_distribution<int> uid;
     int sockListenFd;  // listen fd
     int fdHeartbeatTimer{-1};
+    int fdStatsTimer{-1};
+    int fdDeadlineTimer{-1};
+    int fdPublishTimer{-1};
     int epollFd;  // EPOLL_CTL_ADD sockListenFd and pipeFd[0]
     uint16_t listenPort;
     struct sockaddr_in clientAddr;
+    LbConfig config;
 
     std::unordered_map<int, LbLink*> links;
+    std::multimap<int64_t, LbLink*> deadlines;  // links waiting for first response byte, by deadline
+    std::multimap<int64_t, LbExchange*> exchangeDeadlines;  // same for pipelined exchanges
     std::vector<Upstream*> upstreams;
     int upstreamSize{0};
+    ClientRateLimiter rateLimiter;
+    RetryBudget retryBudget;
+    ResponseCache cache;
+    RouteTable routeTable;
+    AccessLog accessLog;
+    Metrics metrics;
+    MetricsShard* shard{nullptr};  // of this reactor
+    int adminListenFd{-1};
+    std::unordered_map<int, AdminConn> adminConns;  // scrapes in progress on admin port
+    StatsSegment statsSegment;
+    std::vector<HistogramWindow> latencyWindows;  // first byte quantiles published to stats segment, per upstream
+    TraceRing traceRing;
+    HeavyHitters heavyHitters;  // clients of current interval
+    TrafficCapture capture;
+    int64_t heavyHittersSinceNs{0};
+    uint64_t lastDistinctClients{0};  // of last complete interval
+    LoopProfiler loopProfiler;
+    uint64_t listenOverflowsAtStart{0};  // host wide counters when serving began
+    uint64_t listenDropsAtStart{0};
+    bool hasListenOverflows{false};
+    int64_t pickNs{0};  // when last upstream fd was asked for, stamped as pick of link that gets it
+    int64_t connectedNs{0};  // when that fd was ready, read after a blocking connect since loop clock is stale then
     RollingLog& logger;
     ostream* os{nullptr};
+    CachedClock* loopClock{&thread_clock()};  // of thread running serve, read for every stamp of this reactor
 
     /**
      * listen on localhost:listenPort, when client arrives, then direct connect to serverHost:serverPort for client
      */
-    LbManager(uint16_t listenPort, const string& upstreamHosts, RollingLog& logger_);
+    LbManager(const LbConfig& config_, RollingLog& logger_);
     virtual ~LbManager();
 
     bool startup();
@@ -65,27 +117,98 @@ struct LbManager : public ILbManager {
     int do_tcp_listen(struct sockaddr_in* _addr);
     int do_tcp_connect(struct sockaddr_in* _addr);
 
-    int ip_hashed_index(const std::string& clientIp_);
+    int ip_hashed_index(const std::string& clientIp_, int size);
     Upstream* pick_upstream_on_link(LbLink* link);
     Upstream* pick_upstream_failover(int& currentIndex, int firstIndex);
     int random_on_first_client_data_in(LbLink* link);
     bool randomed_pick_upstream(LbLink* link);
     bool ip_hashed_pick_upstream(LbLink* link);
+    int routed_pick_upstream(LbLink* link);
+    Upstream* pick_in_pool(LbLink* link);
+    int route_first_request(LbLink* link);
+    void init_routes();
     void client_on_leave(LbLink* link);
     void response_client_with_server_error(int clientFd_, const string& errorMsg);
+    void shed_client(LbLink* link);
+    void response_client_rate_limited(int clientFd_);
     bool failover(LbLink* link);
+    Upstream* pick_upstream_for_failover(LbLink* link);
     Upstream* get_upstream_by_host(const string& host);
     int check_upstream_connectivity(Upstream* upstream);
+    int acquire_upstream_fd(Upstream* upstream);
     void update_link_server_side(LbLink* link, Upstream* upstream, int serverFd_, char lbPolicy);
+    bool is_upstream_available(LbLink* link, Upstream* upstream);
+    int prepare_first_request(LbLink* link);
+    bool prepare_request(LbLink* link);
+    int request_timeout_ms(int clientTimeoutMs) const;
+    void arm_deadline(LbLink* link);
+    void clear_deadline(LbLink* link);
+    void arm_exchange_deadline(LbExchange* exchange, int64_t deadlineNs);
+    void clear_exchange_deadline(LbExchange* exchange);
+    void expire_deadlines();
+    void print_stats();
+    void log_open(LbLink* link, char lbPolicy);
+    void log_request_done(LbLink* link, Upstream* upstream, int status, size_t bytes, int64_t latencyNs);
+    void log_leave(LbLink* link, AccessCloseReason reason);
+    void count_leave(LbLink* link, AccessCloseReason reason);
+    void capture_request(LbLink* link);
+    void trace_upstream(LbLink* link, TraceEvent event, Upstream* upstream, int64_t ns);
+    void dump_traces();
+    void publish_stats();
+    void profile_loop();
+    void roll_heavy_hitters();
+    void check_upstream_paths();
+
+    // admin port, prometheus scrape of GET /metrics, trace ring by GET /traces, top clients by GET /clients
+    void on_admin_link();
+    void on_admin_event(int fd, uint32_t events);
+    void close_admin(int fd);
+    void render_metrics(std::string& out);
+
+    // l7 mode, one upstream per request on a keep-alive client connection
+    int l7_dispatch_request(LbLink* link);
+    int l7_route_request(LbLink* link, bool mayWait);
+    void l7_forward_request(LbLink* link);
+    void l7_on_data_in(LbLink* link, int recvFd);
+    void l7_on_data_out(LbLink* link, int sendFd);
+    void l7_on_client_data(LbLink* link);
+    void l7_on_response_data(LbLink* link);
+    void on_request_complete(LbLink* link);
+    void on_response_complete(LbLink* link);
+    void update_events(LbLink* link);
+    void reject_request(LbLink* link, const string& header);
+
+    // response cache, l7 only
+    int l7_cache_request(LbLink* link, bool mayWait);
+    int serve_cached(LbLink* link, shared_ptr<CacheEntry> entry);
+    bool write_cached(LbLink* link);
+    void cache_capture(LbLink* link);
+    void cache_fill_done(const string& key);
+    void release_cache(LbLink* link);
+
+    // pipelined requests dispatched ahead of the one in flight, responses written back in request order
+    bool dispatch_pipelined(LbLink* link);
+    Upstream* pick_upstream_for_pipelined(LbLink* link, bool randomed, int pool, int& serverFd_, bool retryPaid);
+    void attach_exchange(LbLink* link, LbExchange* exchange, Upstream* upstream, int serverFd_);
+    void detach_exchange(LbLink* link, LbExchange* exchange, bool reuse);
+    bool retry_exchange(LbLink* link, LbExchange* exchange);
+    bool exchange_can_recv(LbLink* link, LbExchange* exchange);
+    void l7_on_exchange_in(LbLink* link, LbExchange* exchange);
+    void l7_on_exchange_out(LbLink* link, LbExchange* exchange);
+    bool flush_pipeline(LbLink* link);
+    void drop_pipeline(LbLink* link);
 };
 
 template <LbPolicy policy>
-LbManager<policy>::LbManager(uint16_t listenPort_, const string& upstreamHosts, RollingLog& logger_)
-    : listenPort(listenPort_), logger(logger_), os(logger_.ofs) {
-    vector<string> result = split(upstreamHosts, ',');
+LbManager<policy>::LbManager(const LbConfig& config_, RollingLog& logger_)
+    : listenPort(config_.listenPort), config(config_), logger(logger_), os(logger_.update()) {
+    vector<string> result = split(config.upstreamHosts, ',');
     for (const auto& server : result) {
         auto pUpstream = new Upstream(server);
         if (pUpstream->check()) {
+            pUpstream->limiter.init(config.limiterAlgorithm, config.initialConcurrencyLimit,
+                                    config.minConcurrencyLimit, config.maxConcurrencyLimit);
+            pUpstream->maxIdle = config.l7Mode ? config.maxIdlePerUpstream : 0;
             upstreams.push_back(pUpstream);
             ++upstreamSize;
         } else {
@@ -93,6 +216,64 @@ LbManager<policy>::LbManager(uint16_t listenPort_, const string& upstreamHosts,
             delete pUpstream;
         }
     }
+
+    double burst = config.clientRateBurst > 0 ? config.clientRateBurst : config.clientRatePerSecond;
+    rateLimiter.init(config.clientRatePerSecond, burst, config.clientRateTableSizeLog2);
+    retryBudget.init(config.retryBudgetRatio, config.retryBudgetFloorPerSecond, config.retryBudgetMaxTokens);
+    if (config.l7Mode) cache.init(config.cacheBytes, config.cacheVaryHeaders);
+    traceRing.init(config.traceRingSize);
+    if (config.heavyHitters > 0) heavyHitters.init(config.heavyHitters, HeavyHitterPrecision);
+    init_routes();
+    for (Upstream* upstream : upstreams) metrics.upstreamNames.push_back(upstream->endpoint);
+    shard = metrics.add_shard();
+    loopProfiler.metrics = &shard->loop;
+    for (size_t i = 0; i < upstreams.size(); ++i) upstreams[i]->metrics = &shard->upstreams[i];
+    if (!config.accessLogPath.empty() && !accessLog.open(config.accessLogPath)) {
+        *os << "open access log " << config.accessLogPath << " failed " << strerror(errno) << endl;
+    }
+    if (!config.capturePath.empty() &&
+        !capture.open(config.capturePath, config.captureRingBytes, config.captureSample, steady_nanos())) {
+        *os << "open capture " << config.capturePath << " failed " << strerror(errno) << endl;
+    }
+}
+
+/**
+ * pools share Upstream of same endpoint with default upstreams, ones only in pools are appended after them
+ * so default picks keep using first upstreamSize entries
+ */
+template <LbPolicy policy>
+void LbManager<policy>::init_routes() {
+    for (const auto& spec : config.pools) {
+        if (!routeTable.add_pool(spec)) *os << "pool " << spec << " ignored" << endl;
+    }
+    for (const auto& spec : config.routes) {
+        if (!routeTable.add_route(spec)) *os << "route " << spec << " ignored" << endl;
+    }
+    for (UpstreamPool& pool : routeTable.pools) {
+        for (const auto& endpoint : pool.endpoints) {
+            auto found = std::find_if(upstreams.begin(), upstreams.end(),
+                                      [&endpoint](Upstream* upstream) { return upstream->endpoint == endpoint; });
+            if (found != upstreams.end()) {
+                pool.members.push_back(*found);
+                continue;
+            }
+            auto pUpstream = new Upstream(endpoint);
+            if (!pUpstream->check()) {
+                *os << "init upstream " << endpoint << " of pool " << pool.name << " failed." << endl;
+                delete pUpstream;
+                continue;
+            }
+            pUpstream->limiter.init(config.limiterAlgorithm, config.initialConcurrencyLimit,
+                                    config.minConcurrencyLimit, config.maxConcurrencyLimit);
+            pUpstream->maxIdle = config.l7Mode ? config.maxIdlePerUpstream : 0;
+            upstreams.push_back(pUpstream);
+            pool.members.push_back(pUpstream);
+        }
+    }
+    routeTable.compile();
+    if (!routeTable.empty()) {
+        *os << "routes " << routeTable.routes.size() << " pools " << routeTable.pools.size() << endl;
+    }
 }
 
 template <LbPolicy policy>
@@ -134,20 +315,59 @@ bool LbManager<policy>::startup() {
     if (create_timer(HeartbeatMilliseconds, &fdHeartbeatTimer)) {
         epoll_add(epollFd, fdHeartbeatTimer);
     }
+    if (create_timer(StatsMilliseconds, &fdStatsTimer)) {
+        epoll_add(epollFd, fdStatsTimer);
+    }
+    if (config.requestTimeoutMs > 0 && create_timer(DeadlineTickMilliseconds, &fdDeadlineTimer)) {
+        epoll_add(epollFd, fdDeadlineTimer);
+    }
+
+    hasListenOverflows = listen_overflows(listenOverflowsAtStart, listenDropsAtStart);
 
     // epoll <--> listen, pipe
     epoll_add(epollFd, sockListenFd);
     epoll_add(epollFd, pipeFd[0]);
+
+    if (config.adminPort > 0) {
+        struct sockaddr_in adminAddr {};
+        adminAddr.sin_family = AF_INET;
+        adminAddr.sin_port = htons(config.adminPort);
+        adminAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+        adminListenFd = do_tcp_listen(&adminAddr);
+        if (adminListenFd < 0) {
+            *os << "admin listen on " << config.adminPort << " failed " << errno << " " << strerror(errno) << endl;
+            return false;
+        }
+        epoll_add(epollFd, adminListenFd);
+    }
+
+    if (!config.statsShmName.empty()) {
+        string error = statsSegment.create(config.statsShmName, static_cast<int>(upstreams.size()), wall_nanos());
+        if (!error.empty()) {
+            *os << error << endl;
+            return false;
+        }
+        latencyWindows.resize(upstreams.size());
+        if (create_timer(StatsPublishMilliseconds, &fdPublishTimer)) {
+            epoll_add(epollFd, fdPublishTimer);
+        }
+    }
     return true;
 }
 
 template <LbPolicy policy>
 void LbManager<policy>::serve() {
     struct epoll_event events[EPOLL_BUFFER_SIZE];
+    os = logger.update();  // stream and clock of this thread, constructor ran on main thread
+    loopClock = &thread_clock();
 
     uint64_t dummy;
     while (true) {
+        loopProfiler.before_wait();
         int count = epoll_wait(epollFd, events, EPOLL_BUFFER_SIZE, -1);
+        loopClock->update();
+        loopProfiler.on_wake(loopClock->mono_ns(), count, EPOLL_BUFFER_SIZE);
+        if (traceDumpRequested.load(std::memory_order_relaxed)) dump_traces();
         if (count < 0) {
             if (errno == EINTR) {
                 continue;
@@ -167,6 +387,25 @@ void LbManager<policy>::serve() {
             if (fdReady == fdHeartbeatTimer) {
                 read(fdReady, &dummy, sizeof(dummy));
                 os = logger.update();
+            } else if (fdReady == fdStatsTimer) {
+                read(fdReady, &dummy, sizeof(dummy));
+                profile_loop();
+                roll_heavy_hitters();
+                print_stats();
+                check_upstream_paths();
+                if (accessLog.enabled()) accessLog.flush();
+            } else if (fdReady == fdDeadlineTimer) {
+                read(fdReady, &dummy, sizeof(dummy));
+                expire_deadlines();
+            } else if (fdReady == fdPublishTimer) {
+                read(fdReady, &dummy, sizeof(dummy));
+                publish_stats();
+            } else if (fdReady == adminListenFd) {
+                on_admin_link();
+            } else if (adminConns.count(fdReady)) {
+                on_admin_event(fdReady, events[i].events);
+            } else if ((events[i].events & (EPOLLERR | EPOLLHUP)) && !(events[i].events & (EPOLLIN | EPOLLOUT))) {
+                on_leave(fdReady);  // l7 link paused interest on this fd, peer is gone anyway
             } else {
                 if (events[i].events & EPOLLOUT) {
                     on_data_out(events[i].data.fd);
@@ -175,6 +414,7 @@ void LbManager<policy>::serve() {
                     on_data_in(events[i].data.fd);
                 }
             }
+            loopProfiler.on_handled(fdReady);
         }
     }
 }
@@ -185,14 +425,33 @@ void LbManager<policy>::shutdown() {
     close(epollFd);
     close(pipeFd[0]);
     close(pipeFd[1]);
-
+    if (fdStatsTimer >= 0) destroy_timer(&fdStatsTimer);
+    if (fdDeadlineTimer >= 0) destroy_timer(&fdDeadlineTimer);
+    if (fdPublishTimer >= 0) destroy_timer(&fdPublishTimer);
+    if (adminListenFd >= 0) close(adminListenFd);
+    for (const auto& item : adminConns) close(item.first);
+    adminConns.clear();
+
+    std::unordered_set<LbLink*> linkSet;  // each link is registered under both its fds
     for (auto it = links.begin(); it != links.end(); it++) {
-        LbLink* link = it->second;
+        linkSet.insert(it->second);
+    }
+    for (LbLink* link : linkSet) {
         close(link->clientFd);
         close(link->serverFd);
+        for (LbExchange* exchange : link->pipeline) {
+            close(exchange->serverFd);
+            delete exchange;
+        }
         delete link;
     }
-    links.empty();
+    links.clear();
+    for (Upstream* upstream : upstreams) {
+        upstream->close_idle();
+    }
+    if (accessLog.enabled()) accessLog.flush();
+    capture.close();
+    os->flush();  // publish last lines of this thread to log writer
 }
 
 /**
@@ -219,7 +478,7 @@ Upstream* LbManager<policy>::pick_upstream_on_link(LbLink* link) {
         link->currentUpstreamIndex = currentIndex;
         return upstreams[currentIndex];
     }
-    *os << now_string() << "no server available now" << endl;
+    *os << loopClock->now_string() << "no server available now" << endl;
     return nullptr;
 }
 
@@ -233,7 +492,7 @@ template <LbPolicy policy>
 Upstream* LbManager<policy>::pick_upstream_failover(int& currentIndex, int firstIndex) {
     // fail over to other server
     for (int i = (currentIndex + 1) % upstreamSize; i != firstIndex;) {
-        if (upstreams[i]->good) {
+        if (upstreams[i]->good && !upstreams[i]->limiter.saturated()) {
             currentIndex = i;
             return upstreams[currentIndex];
         }
@@ -254,15 +513,34 @@ void LbManager<policy>::response_client_with_server_error(int clientFd_, const s
     }
 }
 
+/**
+ * no upstream can take the request of a registered link, answer 503 instead of a bare close
+ */
+template <LbPolicy policy>
+void LbManager<policy>::shed_client(LbLink* link) {
+    static const string header{"HTTP/1.1 503 Service Unavailable\r\n\r\n"};
+    send(link->clientFd, header.c_str(), header.size(), MSG_NOSIGNAL);
+    shard->linksShed.add();
+    link->closeReason = static_cast<uint8_t>(AccessCloseReason::Shed);
+    client_on_leave(link);
+}
+
 template <LbPolicy policy>
-int LbManager<policy>::ip_hashed_index(const std::string& clientIp_) {
+void LbManager<policy>::response_client_rate_limited(int clientFd_) {
+    static const string header{"HTTP/1.1 429 Too Many Requests\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"};
+    send(clientFd_, header.c_str(), header.size(), MSG_NOSIGNAL);
+    close(clientFd_);
+}
+
+template <LbPolicy policy>
+int LbManager<policy>::ip_hashed_index(const std::string& clientIp_, int size) {
     int index = 0;
     for (char c : clientIp_) {
         if (c != '.') {
             index += c - '0';
         }
     }
-    return index % upstreamSize;
+    return index % size;
 }
 
 /**
@@ -274,25 +552,34 @@ template <LbPolicy policy>
 int LbManager<policy>::random_on_first_client_data_in(LbLink* link) {
     int ret = link->parse_client_content();
     if (ret == 1) {
+        if (!link->isAsyncCall || link->source != LbClientSource::PythonClient) {
+            int routed = routed_pick_upstream(link);
+            if (routed != 0) return routed;
+        }
         if (link->source == LbClientSource::PythonClient) {
             if (link->isAsyncCall) {
                 Upstream* upstream = get_upstream_by_host(link->asyncHost);
                 if (upstream) {
-                    int serverFd = check_upstream_connectivity(upstream);
+                    if (upstream->limiter.saturated()) {  // ticket is bound to this host, shed instead of redirect
+                        ++upstream->limiter.rejected;
+                        return -1;
+                    }
+                    int serverFd = acquire_upstream_fd(upstream);
                     if (serverFd > 0) {
                         update_link_server_side(link, upstream, serverFd, LbPolicyRandomTicket);
                         return 1;
                     }
                     return -1;
                 } else {
-                    *os << now_string() << " can not find target async host " << link->asyncHost << endl;
+                    *os << loopClock->now_string() << " can not find target async host " << link->asyncHost << endl;
                     return -1;
                 }
             } else {  // randomly pick one
                 return randomed_pick_upstream(link) ? 1 : -1;
             }
         }
-    } else if (link->isAsyncCall && ret <= -2) {  // no complete content
+    } else if (((link->isAsyncCall && ret <= -2) || (!routeTable.empty() && (ret == -3 || ret == -4))) &&
+               link->clientTotalBytes < PACKET_BUFFER_SIZE) {  // no complete content
         // *os << "parse_client_content failed " << ret << " " << link->source << endl;
         return 0;
     }
@@ -303,20 +590,26 @@ template <LbPolicy policy>
 bool LbManager<policy>::ip_hashed_pick_upstream(LbLink* link) {
     Upstream* upstream = nullptr;
     int serverFd_ = -1;
+    bool retry = false;
     while (true) {
         upstream = pick_upstream_on_link(link);
         if (upstream == nullptr) {
             return false;
         }
         ++link->onLinkRetryServerCount; // add count here so that it won't trap in infinite loop
-        if (!upstream->good && (link->startTimestamp - upstream->badTimestamp) < FirstUpstreamBadRetryTimeThreshold) {
+        if (!is_upstream_available(link, upstream)) {
             continue;
         }
+        if (retry && !retryBudget.try_withdraw(loopClock->mono_ns())) {
+            *os << loopClock->now_string() << " retry budget exhausted, stop pick " << link->clientEndpoint << endl;
+            return false;
+        }
 
-        serverFd_ = check_upstream_connectivity(upstream);  // fd to server
+        serverFd_ = acquire_upstream_fd(upstream);  // fd to server
         if (serverFd_ > 0) {
             break;
         }
+        retry = true;
     }
 
     update_link_server_side(link, upstream, serverFd_, LbPolicyIpHashed);
@@ -327,26 +620,101 @@ template <LbPolicy policy>
 bool LbManager<policy>::randomed_pick_upstream(LbLink* link) {
     Upstream* upstream = nullptr;
     int serverFd_ = -1;
+    bool retry = false;
     while (true) {
         if (link->check_random_retry_count_exceed()) {
             return false;
         }
         ++link->randomRetryServerCount; // add count here so that it won't trap in infinite loop
         upstream = upstreams[uid(generator)];
-        if (!upstream->good && (link->startTimestamp - upstream->badTimestamp) < FirstUpstreamBadRetryTimeThreshold) {
+        if (!is_upstream_available(link, upstream)) {
             continue;
         }
+        if (retry && !retryBudget.try_withdraw(loopClock->mono_ns())) {
+            *os << loopClock->now_string() << " retry budget exhausted, stop pick " << link->clientEndpoint << endl;
+            return false;
+        }
 
-        serverFd_ = check_upstream_connectivity(upstream);  // fd to server
+        serverFd_ = acquire_upstream_fd(upstream);  // fd to server
         if (serverFd_ > 0) {
             break;
         }
+        retry = true;
     }
 
     update_link_server_side(link, upstream, serverFd_, LbPolicyRandom);
     return true;
 }
 
+/**
+ * pick from pool of route matching parsed request head, members tried from pool policy start on
+ * @return 1 picked, 0 no route so default upstreams decide, -1 routed but no member available
+ */
+template <LbPolicy policy>
+int LbManager<policy>::routed_pick_upstream(LbLink* link) {
+    const Route* route = routeTable.match(link->parser);
+    if (route == nullptr) return 0;
+
+    const UpstreamPool& pool = routeTable.pools[route->pool];
+    int size = static_cast<int>(pool.members.size());
+    if (size == 0) return -1;
+    link->pool = route->pool;
+    link->poolAttempts = 0;
+    link->poolStart = pool.policy == LbPolicyRandom ? static_cast<int>(generator() % size)
+                                                    : ip_hashed_index(link->clientAddress, size);
+    Upstream* upstream = nullptr;
+    int serverFd_ = -1;
+    bool retry = false;
+    while (true) {
+        upstream = pick_in_pool(link);
+        if (upstream == nullptr) {
+            return -1;
+        }
+        if (retry && !retryBudget.try_withdraw(loopClock->mono_ns())) {
+            *os << loopClock->now_string() << " retry budget exhausted, stop pick " << link->clientEndpoint << endl;
+            return -1;
+        }
+
+        serverFd_ = acquire_upstream_fd(upstream);  // fd to server
+        if (serverFd_ > 0) {
+            break;
+        }
+        retry = true;
+    }
+
+    update_link_server_side(link, upstream, serverFd_, pool.policy);
+    return 1;
+}
+
+/**
+ * next available member of routed pool, each member is tried at most once per request
+ */
+template <LbPolicy policy>
+Upstream* LbManager<policy>::pick_in_pool(LbLink* link) {
+    const vector<Upstream*>& members = routeTable.pools[link->pool].members;
+    int size = static_cast<int>(members.size());
+    while (link->poolAttempts < size) {
+        Upstream* upstream = members[(link->poolStart + link->poolAttempts++) % size];
+        if (is_upstream_available(link, upstream)) return upstream;
+    }
+    return nullptr;
+}
+
+/**
+ * ip hashed link with routes picks its upstream once first request head is known
+ * @return 0 wait for complete header, 1 go ahead, -1 no upstream, -2 request can not be forwarded as configured
+ */
+template <LbPolicy policy>
+int LbManager<policy>::route_first_request(LbLink* link) {
+    int ret = link->parse_client_content();
+    if ((ret == -3 || ret == -4) && link->clientTotalBytes < PACKET_BUFFER_SIZE) {
+        return 0;
+    }
+    int routed = ret == 1 ? routed_pick_upstream(link) : 0;
+    if (routed < 0 || (routed == 0 && !ip_hashed_pick_upstream(link))) return -1;
+    return prepare_request(link) ? 1 : -2;
+}
+
 template <LbPolicy policy>
 void LbManager<policy>::on_link() {
     struct sockaddr_in clientAddr;
@@ -356,23 +724,37 @@ void LbManager<policy>::on_link() {
         *os << "accept from client error " << errno << " " << strerror(errno);
         return;
     }
+    if (heavyHitters.enabled()) heavyHitters.on_link(clientAddr.sin_addr.s_addr);  // refused ones count too
+    if (!rateLimiter.allow(clientAddr.sin_addr.s_addr, loopClock->mono_ns())) {
+        response_client_rate_limited(clientFd_);
+        shard->linksRateLimited.add();
+        return;
+    }
     string clientIp = inet_ntoa(clientAddr.sin_addr);
     string clientEndpoint_ = clientIp;
     clientEndpoint_ += ':';
     clientEndpoint_ += std::to_string(ntohs(clientAddr.sin_port));
-    LbLink* link = new LbLink(clientFd_, clientEndpoint_);
-    link->firstUpstreamIndex = ip_hashed_index(clientIp);
+    LbLink* link = new LbLink(clientFd_, clientEndpoint_, &config);
+    link->clientIp = clientAddr.sin_addr.s_addr;
+    link->clientAddress = clientIp;
+    link->clientPort = ntohs(clientAddr.sin_port);
+    link->trace.clientIp = link->clientIp;
+    link->trace.clientPort = link->clientPort;
+    link->trace.record(TraceEvent::Accept, loopClock->mono_ns());
+    link->l7 = config.l7Mode;
+    link->firstUpstreamIndex = ip_hashed_index(clientIp, upstreamSize);
     if (link->firstUpstreamIndex < 0) {
         delete link;
-        *os << now_string() << "no server available now" << endl;
+        *os << loopClock->now_string() << "no server available now" << endl;
         return;
     }
 
-    if (policy == LbPolicy::IP_HASHED) {
+    if (policy == LbPolicy::IP_HASHED && !link->l7 && routeTable.empty()) {
         if (ip_hashed_pick_upstream(link)) {
             // success
         } else {
             response_client_with_server_error(clientFd_, "no server available now");
+            shard->linksShed.add();
             delete link;
             return;
         }
@@ -381,6 +763,8 @@ void LbManager<policy>::on_link() {
     set_nonblock(clientFd_);
     links[clientFd_] = link;
     epoll_add(epollFd, clientFd_);  // register event
+    shard->linksAccepted.add();
+    link->clientEvents = EPOLLIN;
 }
 
 template <LbPolicy policy>
@@ -403,7 +787,16 @@ void LbManager<policy>::on_leave(LbLink* link, int leaverFd) {
     // unregister event
     epoll_delete(epollFd, link->clientFd);
     epoll_delete(epollFd, link->serverFd);
-    link->print_leave_info(leaverFd, *os);
+    if (accessLog.enabled()) {
+        log_leave(link, leaverFd == link->clientFd ? AccessCloseReason::Client : AccessCloseReason::Upstream);
+    } else {
+        link->print_leave_info(leaverFd, *os);
+    }
+    count_leave(link, leaverFd == link->clientFd ? AccessCloseReason::Client : AccessCloseReason::Upstream);
+    clear_deadline(link);
+    if (link->pUpstream) link->pUpstream->limiter.release();
+    drop_pipeline(link);
+    release_cache(link);
     delete link;
 }
 
@@ -412,7 +805,15 @@ void LbManager<policy>::client_on_leave(LbLink* link) {
     close(link->clientFd);
     links.erase(link->clientFd);
     epoll_delete(epollFd, link->clientFd);
-    *os << "client_on_leave " << link->clientEndpoint << " " << link->clientTotalBytes << endl;
+    if (accessLog.enabled()) {
+        log_leave(link, AccessCloseReason::Client);
+    } else {
+        *os << "client_on_leave " << link->clientEndpoint << " " << link->clientTotalBytes << endl;
+    }
+    count_leave(link, AccessCloseReason::Client);
+    clear_deadline(link);
+    drop_pipeline(link);
+    release_cache(link);
     delete link;
 }
 
@@ -428,6 +829,7 @@ LbLink* LbManager<policy>::fetch_link(int fd) {
 
 /**
  * failover only enabled for those servers who can connect to but didn't respond any data back
+ * every reconnect is charged to the retry budget, attempts are bounded by MaxFailoverAttempts
  * @param link
  * @return
  */
@@ -436,84 +838,137 @@ bool LbManager<policy>::failover(LbLink* link) {
     if (link->client_do_not_support_failover()) return false;
     if (link->serverTotalBytes != 0) return false;  // server normal leave, no need failover
 
-    Upstream* upstream = nullptr;
-    if (policy == LbPolicy::IP_HASHED) {
-        if (!link->hasFirstUpstreamTriedAgain) {  // retry this upstream again
-            upstream = link->pUpstream;
-            link->hasFirstUpstreamTriedAgain = true;
-        } else {
-            upstream = pick_upstream_failover(link->currentUpstreamIndex, link->firstUpstreamIndex);
+    for (int attempt = 0; attempt < MaxFailoverAttempts; ++attempt) {
+        Upstream* upstream = pick_upstream_for_failover(link);
+        if (upstream == nullptr) return false;
+        if (upstream != link->pUpstream && upstream->limiter.saturated()) {
+            ++upstream->limiter.rejected;
+            continue;
         }
-    } else {
-        if (link->check_random_retry_count_exceed()) {
+
+        if (!retryBudget.try_withdraw(loopClock->mono_ns())) {
+            *os << loopClock->now_string() << " retry budget exhausted, no failover " << link->clientEndpoint << endl;
             return false;
         }
 
-        if (link->isAsyncCall && link->source == LbClientSource::PythonClient) {
-            upstream = get_upstream_by_host(link->asyncHost);
-        } else {
-            upstream = upstreams[uid(generator)];
+        int64_t connectStartNs = steady_nanos();
+        int serverFd_ = do_tcp_connect(&upstream->serverAddr);  // fd to server
+        if (serverFd_ <= 0) {
+            *os << "can not connect to server " << errno << " " << strerror(errno);
+            upstream->metrics->connectErrors.add();
+            upstream->set_status(false);
+            continue;  // failover again
+        }
+        int64_t connectEndNs = steady_nanos();
+        upstream->metrics->connectNs.record(connectEndNs - connectStartNs);
+        trace_upstream(link, TraceEvent::Failover, upstream, connectStartNs);
+        link->trace.record(TraceEvent::Connected, connectEndNs);
+
+        // old server leave, closing without response counts as a drop for its limiter
+        link->pUpstream->metrics->failovers.add();
+        link->pUpstream->limiter.on_drop();
+        link->pUpstream->limiter.release();
+        upstream->limiter.acquire();
+        int oldServerFd = link->serverFd;
+        epoll_delete(epollFd, oldServerFd);
+        close(oldServerFd);
+        links.erase(oldServerFd);
+
+        // new server setup
+        links[serverFd_] = link;
+        set_nonblock(serverFd_);
+        epoll_add(epollFd, serverFd_);
+        link->serverEvents = EPOLLIN;
+
+        *os << loopClock->now_string() << " failover " << link->clientEndpoint << " <--> " << upstream->endpoint
+            << endl;
+        link->reset_server_side_for_failover(upstream, serverFd_);
+        int ret = link->on_server_send();
+        if (ret >= 0) {
+            if (ret == 0 && !link->l7) epoll_mod2both(epollFd, serverFd_);  // rest of request goes out on EPOLLOUT
+            return true;
         }
-        ++link->randomRetryServerCount;
     }
+    return false;
+}
 
-    if (upstream == nullptr) return false;
-
-    int serverFd_ = do_tcp_connect(&upstream->serverAddr);  // fd to server
-    if (serverFd_ <= 0) {
-        *os << "can not connect to server " << errno << " " << strerror(errno);
-        upstream->set_status(false);
-        return failover(link);  // failover again
+template <LbPolicy policy>
+Upstream* LbManager<policy>::pick_upstream_for_failover(LbLink* link) {
+    if (link->pool >= 0) return pick_in_pool(link);
+    if (policy == LbPolicy::IP_HASHED) {
+        if (!link->hasFirstUpstreamTriedAgain) {  // retry this upstream again
+            link->hasFirstUpstreamTriedAgain = true;
+            return link->pUpstream;
+        }
+        return pick_upstream_failover(link->currentUpstreamIndex, link->firstUpstreamIndex);
     }
 
-    // old server leave
-    int oldServerFd = link->serverFd;
-    epoll_delete(epollFd, oldServerFd);
-    close(oldServerFd);
-    links.erase(oldServerFd);
-
-    // new server setup
-    links[serverFd_] = link;
-    set_nonblock(serverFd_);
-    epoll_add(epollFd, serverFd_);
-
-    *os << now_string() << " failover " << link->clientEndpoint << " <--> " << upstream->endpoint << endl;
-    link->reset_server_side_for_failover(upstream, serverFd_);
-    if (link->on_server_send() < 0) {
-        return failover(link);
+    if (link->check_random_retry_count_exceed()) {
+        return nullptr;
     }
-    return true;
+    ++link->randomRetryServerCount;
+    if (link->isAsyncCall && link->source == LbClientSource::PythonClient) {
+        return get_upstream_by_host(link->asyncHost);
+    }
+    return upstreams[uid(generator)];
 }
 
 template <LbPolicy policy>
 void LbManager<policy>::on_data_in(int recvFd) {
+    static const string badRequest{"HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"};
     LbLink* link = fetch_link(recvFd);
     if (link == nullptr) {
         return;
     }
 
+    if (link->l7) {
+        l7_on_data_in(link, recvFd);
+        return;
+    }
+
     if (link->is_buffer_not_empty(recvFd)) {  // wait buffer to be empty
         return;
     }
 
     // recv
+    bool responded = link->serverTotalBytes > 0;
     int ret = link->on_recv(recvFd);
     // *os << "on_data_in do_tcp_recv " << recvFd << " " << ret << endl;
     if (ret == 0) {
         return;
     } else if (ret < 0) {
         if (link->is_server_side(recvFd) && failover(link)) {
-            // do nothing
+            return;
+        } else if (link->is_server_side(recvFd) && link->has_held_response()) {
+            link->release_held_response();  // can not retry, forward the held error response as is
         } else {
             on_leave(recvFd);
+            return;
         }
-        return;
     } else {
+        if (!responded && link->is_server_side(recvFd)) {
+            retryBudget.on_success();  // first response byte, request served
+            clear_deadline(link);
+        }
+        if (policy == LbPolicy::IP_HASHED && link->is_client_side(recvFd) && !link->requestPrepared) {
+            ret = routeTable.empty() ? prepare_first_request(link) : route_first_request(link);
+            if (ret == -2) {
+                reject_request(link, badRequest);
+                return;
+            } else if (ret < 0) {
+                shed_client(link);
+                return;
+            } else if (ret == 0) {
+                link->clearClientBuffer = false;
+                return;  // wait for complete request header
+            }
+            link->clearClientBuffer = true;
+        }
         if (policy == LbPolicy::RANDOMED) {
             if (link->is_client_side(recvFd) && link->pUpstream == nullptr) {
                 ret = random_on_first_client_data_in(link);
                 if (ret < 0) {
-                    client_on_leave(link);
+                    shed_client(link);
                     return;
                 } else if (ret == 0) {
                     //                    *os << "wait for complete client data: " << endl;
@@ -522,10 +977,16 @@ void LbManager<policy>::on_data_in(int recvFd) {
                     return;  // wait for complete client data
                 }
                 link->clearClientBuffer = true;  // now we can send whole to server
+                if (!prepare_request(link)) {
+                    reject_request(link, badRequest);
+                    return;
+                }
             }
         }
     }
 
+    if (capture.enabled() && !link->captured && link->is_client_side(recvFd)) capture_request(link);
+
     // send
     int otherSideFd = link->other_side_fd(recvFd);
     ret = link->on_send(otherSideFd);
@@ -546,6 +1007,10 @@ void LbManager<policy>::on_data_out(int sendFd) {
     if (link == nullptr) {
         return;
     }
+    if (link->l7) {
+        l7_on_data_out(link, sendFd);
+        return;
+    }
 
     int ret = link->on_send(sendFd);
     if (ret == 0) {        // keep watch EPOLLOUT
@@ -599,12 +1064,16 @@ Upstream* LbManager<policy>::get_upstream_by_host(const string& host) {
 
 template <LbPolicy policy>
 int LbManager<policy>::check_upstream_connectivity(Upstream* upstream) {
+    int64_t connectStartNs = steady_nanos();  // blocking connect spans the iteration, loop clock is stale
     int serverFd_ = do_tcp_connect(&upstream->serverAddr);  // fd to server
     if (serverFd_ <= 0) {
         *os << "can not connect to server " << upstream->endpoint << " " << errno << " " << strerror(errno);
+        upstream->metrics->connectErrors.add();
         upstream->set_status(false);
         return -1;
     } else {
+        connectedNs = steady_nanos();
+        upstream->metrics->connectNs.record(connectedNs - connectStartNs);
         upstream->set_status(true);
         return serverFd_;
     }
@@ -614,11 +1083,1254 @@ template <LbPolicy policy>
 void LbManager<policy>::update_link_server_side(LbLink* link, Upstream* upstream, int serverFd_, char lbPolicy) {
     link->serverFd = serverFd_;
     link->pUpstream = upstream;
+    link->lastUpstream = upstream;
+    upstream->limiter.acquire();
+    upstream->metrics->picks.add();
+    trace_upstream(link, TraceEvent::Pick, upstream, pickNs);
+    link->trace.record(TraceEvent::Connected, connectedNs);
 
     set_nonblock(serverFd_);
     links[serverFd_] = link;
     epoll_add(epollFd, serverFd_);
-    link->print_on_link_info(lbPolicy, *os);
+    link->serverEvents = EPOLLIN;
+    log_open(link, lbPolicy);
+}
+
+/**
+ * idle pooled connection first, only l7 mode parks connections there
+ */
+template <LbPolicy policy>
+int LbManager<policy>::acquire_upstream_fd(Upstream* upstream) {
+    pickNs = loopClock->mono_ns();
+    connectedNs = pickNs;
+    int serverFd_ = upstream->take_idle();
+    if (serverFd_ > 0) return serverFd_;
+    return check_upstream_connectivity(upstream);
+}
+
+/**
+ * skip upstream recently marked bad, or whose adaptive concurrency limit is reached so the link goes elsewhere,
+ * or with avoid degraded whose tcp path looks degraded while some other upstream does not
+ */
+template <LbPolicy policy>
+bool LbManager<policy>::is_upstream_available(LbLink* link, Upstream* upstream) {
+    if (!upstream->good && (link->startTimestamp - upstream->badTimestamp) < FirstUpstreamBadRetryTimeThreshold) {
+        return false;
+    }
+    if (upstream->limiter.saturated()) {
+        ++upstream->limiter.rejected;
+        return false;
+    }
+    if (config.avoidDegraded && upstream->path.degraded) {
+        for (Upstream* other : upstreams) {
+            if (!other->path.degraded) return false;
+        }
+    }
+    return true;
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::print_stats() {
+    if (rateLimiter.enabled()) {
+        *os << loopClock->now_string() << " client rate allowed " << rateLimiter.allowed << " limited "
+            << rateLimiter.limited << " evicted " << rateLimiter.evicted << endl;
+    }
+    *os << loopClock->now_string() << " retry budget remaining " << retryBudget.remaining() << " allowed "
+        << retryBudget.retriesAllowed << " denied " << retryBudget.retriesDenied << endl;
+    if (config.l7Mode) {
+        for (Upstream* upstream : upstreams) {
+            *os << loopClock->now_string() << " upstream " << upstream->endpoint << " idle " << upstream->idleFds.size()
+                << " reused " << upstream->reused << endl;
+        }
+    }
+    if (cache.enabled()) {
+        *os << loopClock->now_string() << " cache entries " << cache.entries() << " bytes " << cache.used_bytes()
+            << " hits " << cache.hits << " misses " << cache.misses << " collapsed " << cache.collapsed << " stored "
+            << cache.stored << " evicted " << cache.evicted << endl;
+    }
+    if (accessLog.enabled()) {
+        *os << loopClock->now_string() << " access log records " << accessLog.records << " write failures "
+            << accessLog.writeFailures << endl;
+    }
+    if (capture.enabled()) {
+        *os << loopClock->now_string() << " capture records " << capture.captured << " dropped " << capture.dropped
+            << " write failures " << capture.writeFailures.load(std::memory_order_relaxed) << " lost "
+            << capture.lost.load(std::memory_order_relaxed) << (capture.stopped() ? " stopped" : "") << endl;
+    }
+    if (config.limiterAlgorithm == LimiterAlgorithm::NONE) return;
+
+    for (Upstream* upstream : upstreams) {
+        const ConcurrencyLimiter& limiter = upstream->limiter;
+        *os << loopClock->now_string() << " upstream " << upstream->endpoint << " good " << upstream->good
+            << " inflight " << limiter.inflight << " limit " << limiter.current_limit() << " min_rtt_us "
+            << limiter.minRttNs / 1000 << " last_rtt_us " << limiter.lastRttNs / 1000 << " samples " << limiter.samples
+            << " drops " << limiter.drops << " rejected " << limiter.rejected << endl;
+    }
+}
+
+/**
+ * log upstreams whose tcp path turned degraded or recovered since last stats interval
+ */
+template <LbPolicy policy>
+void LbManager<policy>::check_upstream_paths() {
+    for (Upstream* upstream : upstreams) {
+        TcpPathStats& path = upstream->path;
+        if (path.samples > 0) {
+            *os << loopClock->now_string() << " upstream " << upstream->endpoint << " tcp srtt_us "
+                << static_cast<int64_t>(path.srttUs) << " rttvar_us " << static_cast<int64_t>(path.rttVarUs)
+                << " base_rtt_us " << static_cast<int64_t>(path.baseRttUs) << " cwnd " << static_cast<int>(path.cwnd)
+                << " retrans " << path.retransmits << " samples " << path.samples << endl;
+        }
+        if (path.degraded == path.reportedDegraded) continue;
+        *os << loopClock->now_string() << (path.degraded ? " warn upstream " : " upstream ") << upstream->endpoint
+            << " tcp path " << (path.degraded ? "degraded" : "recovered") << endl;
+        path.reportedDegraded = path.degraded;
+    }
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::on_admin_link() {
+    int fd = accept(adminListenFd, nullptr, nullptr);
+    if (fd < 0) return;
+    set_nonblock(fd);
+    adminConns[fd];
+    epoll_add(epollFd, fd);
+}
+
+/**
+ * scrape is rare and small, answered in place on this reactor between link events
+ */
+template <LbPolicy policy>
+void LbManager<policy>::on_admin_event(int fd, uint32_t events) {
+    static const string notFound{"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"};
+    AdminConn& conn = adminConns[fd];
+    if (conn.response.empty()) {
+        char buffer[1024];
+        ssize_t ret;
+        while ((ret = recv(fd, buffer, sizeof(buffer), 0)) > 0) conn.request.append(buffer, ret);
+        if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) || conn.request.size() > 8192) {
+            close_admin(fd);
+            return;
+        }
+        if (conn.request.find("\r\n\r\n") == string::npos) return;
+
+        if (conn.request.compare(0, 13, "GET /metrics ") == 0) {
+            string body;
+            render_metrics(body);
+            conn.response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                            std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        } else if (conn.request.compare(0, 13, "GET /clients ") == 0) {
+            string body;
+            if (heavyHitters.enabled()) heavyHitters.format(body, config.heavyHitters);
+            conn.response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " +
+                            std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        } else if (conn.request.compare(0, 12, "GET /traces ") == 0) {
+            string body;
+            traceRing.dump(body);
+            conn.response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " +
+                            std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        } else {
+            conn.response = notFound;
+        }
+    } else if (!(events & EPOLLOUT)) {
+        close_admin(fd);  // peer sent more or hung up while response is pending
+        return;
+    }
+
+    while (conn.sent < conn.response.size()) {
+        ssize_t ret = send(fd, conn.response.data() + conn.sent, conn.response.size() - conn.sent, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                epoll_mod(epollFd, fd, EPOLLOUT);
+                return;
+            }
+            break;
+        }
+        conn.sent += ret;
+    }
+    close_admin(fd);
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::close_admin(int fd) {
+    epoll_delete(epollFd, fd);
+    close(fd);
+    adminConns.erase(fd);
+}
+
+/**
+ * counters and histograms of the shards, then gauges this reactor owns
+ */
+template <LbPolicy policy>
+void LbManager<policy>::render_metrics(std::string& out) {
+    metrics.render(out);
+
+    append_metric_header(out, "lb_links_active", "gauge", "client links open now");
+    append_metric(out, "lb_links_active", "", shard->linksAccepted.get() - shard->linksClosed.get());
+    append_metric_header(out, "lb_upstream_inflight", "gauge", "requests in flight counted by concurrency limiter");
+    for (Upstream* upstream : upstreams) {
+        append_metric(out, "lb_upstream_inflight", "upstream=\"" + upstream->endpoint + "\"",
+                      static_cast<uint64_t>(upstream->limiter.inflight));
+    }
+    append_metric_header(out, "lb_upstream_up", "gauge", "1 unless last connect to upstream failed");
+    for (Upstream* upstream : upstreams) {
+        append_metric(out, "lb_upstream_up", "upstream=\"" + upstream->endpoint + "\"",
+                      static_cast<uint64_t>(upstream->good ? 1 : 0));
+    }
+    append_metric_header(out, "lb_upstream_tcp_srtt_seconds", "gauge", "smoothed rtt from sampled upstream TCP_INFO");
+    for (Upstream* upstream : upstreams) {
+        append_metric(out, "lb_upstream_tcp_srtt_seconds", "upstream=\"" + upstream->endpoint + "\"",
+                      upstream->path.srttUs / 1e6);
+    }
+    append_metric_header(out, "lb_upstream_tcp_rttvar_seconds", "gauge", "rtt variance from sampled TCP_INFO");
+    for (Upstream* upstream : upstreams) {
+        append_metric(out, "lb_upstream_tcp_rttvar_seconds", "upstream=\"" + upstream->endpoint + "\"",
+                      upstream->path.rttVarUs / 1e6);
+    }
+    append_metric_header(out, "lb_upstream_tcp_cwnd", "gauge", "congestion window in segments from sampled TCP_INFO");
+    for (Upstream* upstream : upstreams) {
+        append_metric(out, "lb_upstream_tcp_cwnd", "upstream=\"" + upstream->endpoint + "\"", upstream->path.cwnd);
+    }
+    append_metric_header(out, "lb_upstream_tcp_retransmits", "gauge",
+                         "smoothed retransmits of a sampled socket since its previous sample");
+    for (Upstream* upstream : upstreams) {
+        append_metric(out, "lb_upstream_tcp_retransmits", "upstream=\"" + upstream->endpoint + "\"",
+                      upstream->path.retransmits);
+    }
+    append_metric_header(out, "lb_upstream_tcp_degraded", "gauge", "1 when sampled rtt or retransmits show bad path");
+    for (Upstream* upstream : upstreams) {
+        append_metric(out, "lb_upstream_tcp_degraded", "upstream=\"" + upstream->endpoint + "\"",
+                      static_cast<uint64_t>(upstream->path.degraded ? 1 : 0));
+    }
+    if (heavyHitters.enabled()) {
+        append_metric_header(out, "lb_clients_distinct", "gauge", "distinct client ips over last heavy hitter interval");
+        append_metric(out, "lb_clients_distinct", "", lastDistinctClients);
+    }
+    append_metric_header(out, "lb_retry_budget_remaining", "gauge", "retry tokens left");
+    append_metric(out, "lb_retry_budget_remaining", "", static_cast<double>(retryBudget.remaining()));
+    if (cache.enabled()) {
+        append_metric_header(out, "lb_cache_bytes", "gauge", "bytes held by response cache");
+        append_metric(out, "lb_cache_bytes", "", static_cast<uint64_t>(cache.used_bytes()));
+        append_metric_header(out, "lb_cache_hits_total", "counter", "requests answered from cache");
+        append_metric(out, "lb_cache_hits_total", "", static_cast<uint64_t>(cache.hits));
+        append_metric_header(out, "lb_cache_misses_total", "counter", "cacheable requests sent to upstream");
+        append_metric(out, "lb_cache_misses_total", "", static_cast<uint64_t>(cache.misses));
+    }
+}
+
+/**
+ * binary record when access log is on, text line otherwise
+ */
+template <LbPolicy policy>
+void LbManager<policy>::log_open(LbLink* link, char lbPolicy) {
+    if (!accessLog.enabled()) {
+        link->print_on_link_info(lbPolicy, *os);
+        return;
+    }
+    AccessRecord record = link->access_record(AccessEvent::Open, link->pUpstream);
+    record.policy = lbPolicy;
+    accessLog.append(record);
+}
+
+/**
+ * @param upstream nullptr when answered from cache
+ */
+template <LbPolicy policy>
+void LbManager<policy>::log_request_done(LbLink* link, Upstream* upstream, int status, size_t bytes,
+                                         int64_t latencyNs) {
+    if (upstream) upstream->metrics->on_status(status);
+    link->trace.on_request_done(latencyNs);
+    if (!accessLog.enabled()) {
+        link->print_request_done(upstream ? upstream->endpoint : "cache", status, bytes, latencyNs, *os);
+        return;
+    }
+    AccessRecord record = link->access_record(AccessEvent::Done, upstream);
+    if (upstream == nullptr) record.policy = LbPolicyCache;
+    record.status = static_cast<uint16_t>(status);
+    record.durationNs = latencyNs;
+    record.serverBytes = bytes;
+    accessLog.append(record);
+}
+
+/**
+ * @param reason side that left, unless link was closed on purpose before
+ */
+template <LbPolicy policy>
+void LbManager<policy>::log_leave(LbLink* link, AccessCloseReason reason) {
+    AccessRecord record = link->access_record(AccessEvent::Leave, link->pUpstream);
+    record.closeReason = link->closeReason ? link->closeReason : static_cast<uint8_t>(reason);
+    record.requests = static_cast<uint32_t>(link->requestCount);
+    record.durationNs = record.timeNs - link->startNs;
+    record.clientBytes = link->doneClientBytes + link->clientTotalBytes;
+    record.serverBytes = link->doneServerBytes + link->serverTotalBytes;
+    accessLog.append(record);
+}
+
+/**
+ * link lifetime and bytes go to upstream it used last, links that never had one to the none slot
+ * finished trace goes to ring, and to log in full when a request of link was slow
+ */
+template <LbPolicy policy>
+void LbManager<policy>::count_leave(LbLink* link, AccessCloseReason reason) {
+    shard->linksClosed.add();
+    UpstreamMetrics& slot = link->lastUpstream ? *link->lastUpstream->metrics : shard->none();
+    slot.linkLifetimeNs.record(static_cast<uint64_t>(std::max<int64_t>(loopClock->wall_ns() - link->startNs, 0)));
+    uint64_t linkBytes = link->doneClientBytes + link->clientTotalBytes + link->doneServerBytes + link->serverTotalBytes;
+    slot.linkBytes.record(linkBytes);
+    if (heavyHitters.enabled()) heavyHitters.on_leave(link->clientIp, linkBytes);
+
+    LinkTrace& trace = link->trace;
+    trace.finish(loopClock->mono_ns(), link->closeReason ? link->closeReason : static_cast<uint8_t>(reason),
+                 static_cast<uint32_t>(link->requestCount));
+    if (traceRing.enabled()) traceRing.push(trace);
+    if (config.traceSlowMs > 0 && trace.slowestNs >= config.traceSlowMs * 1000000LL) {
+        string line;
+        trace.format(line);
+        *os << loopClock->now_string() << " slow " << line;
+    }
+}
+
+/**
+ * l7 request as framed from buffer start, rest of a body longer than buffer is left out;
+ * other links give their first received bytes once
+ */
+template <LbPolicy policy>
+void LbManager<policy>::capture_request(LbLink* link) {
+    size_t length = link->sendBufferLength;
+    uint8_t flags = CaptureFirstChunk;
+    if (link->l7 && !link->l7Tunnel) {
+        length = std::min<size_t>(length, static_cast<size_t>(link->requestLength));
+        flags = 0;
+    }
+    link->captured = true;
+    if (capture.sample()) {
+        capture.append(link->clientIp, flags, link->clientSendBuffer + link->sendBufferOffset, length,
+                       loopClock->mono_ns());
+    }
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::trace_upstream(LbLink* link, TraceEvent event, Upstream* upstream, int64_t ns) {
+    link->trace.record(event, ns, upstream->serverAddr.sin_addr.s_addr, ntohs(upstream->serverAddr.sin_port));
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::dump_traces() {
+    traceDumpRequested.store(false, std::memory_order_relaxed);
+    string out;
+    traceRing.dump(out);
+    *os << loopClock->now_string() << " trace dump of " << std::min<uint64_t>(traceRing.pushed, config.traceRingSize)
+        << " links\n"
+        << out;
+    os->flush();
+}
+
+/**
+ * loop profile of last stats interval to log and gauges, warn when reactor got close to saturated
+ */
+template <LbPolicy policy>
+void LbManager<policy>::profile_loop() {
+    LoopProfiler::Interval interval = loopProfiler.roll();
+    LoopMetrics& loop = shard->loop;
+    uint32_t queued = 0, backlog = 0;
+    if (listen_queue(sockListenFd, queued, backlog)) {
+        loop.listenQueue.set(queued);
+        loop.listenBacklog.set(backlog);
+    }
+    uint64_t overflows = 0, drops = 0;
+    if (hasListenOverflows && listen_overflows(overflows, drops)) {
+        overflows -= listenOverflowsAtStart;
+        drops -= listenDropsAtStart;
+        if (overflows > loop.listenOverflows.get()) {
+            *os << loopClock->now_string() << " listen queue overflowed " << overflows - loop.listenOverflows.get()
+                << " times, host wide, backlog " << backlog << endl;
+        }
+        loop.listenOverflows.set(overflows);
+        loop.listenDrops.set(drops);
+    }
+
+    *os << loopClock->now_string() << " loop busy " << static_cast<int>(interval.busyRatio * 100) << "% wakeups "
+        << interval.wakeups << " events " << interval.events << " full " << interval.fullWakeups << " slowest_us "
+        << interval.slowestNs / 1000 << " fd " << interval.slowestFd << " listen queue " << queued << "/" << backlog
+        << endl;
+    if (config.loopBusyWarnRatio > 0 && interval.busyRatio >= config.loopBusyWarnRatio) {
+        *os << loopClock->now_string() << " warn reactor busy " << static_cast<int>(interval.busyRatio * 100)
+            << "% of last interval, over " << static_cast<int>(config.loopBusyWarnRatio * 100) << "%" << endl;
+    }
+}
+
+/**
+ * top clients of interval to log, then sketches start over so a client that stopped drops out
+ */
+template <LbPolicy policy>
+void LbManager<policy>::roll_heavy_hitters() {
+    if (!heavyHitters.enabled()) return;
+    int64_t nowNs = loopClock->mono_ns();
+    if (heavyHittersSinceNs == 0) heavyHittersSinceNs = nowNs;
+    if (nowNs - heavyHittersSinceNs < HeavyHitterIntervalMilliseconds * 1000000LL) return;
+
+    string summary;
+    heavyHitters.format(summary, HeavyHitterLogTop);
+    size_t begin = 0;
+    while (begin < summary.size()) {
+        size_t end = summary.find('\n', begin);
+        *os << loopClock->now_string() << " clients " << summary.substr(begin, end - begin) << endl;
+        begin = end + 1;
+    }
+    lastDistinctClients = heavyHitters.distinct.estimate();
+    heavyHitters.reset();
+    heavyHittersSinceNs = nowNs;
+}
+
+/**
+ * snapshot of counters the reactor keeps anyway, copied into seqlock slots so lbtop never touches this process
+ */
+template <LbPolicy policy>
+void LbManager<policy>::publish_stats() {
+    StatsGlobal global;
+    global.publishedNs = loopClock->wall_ns();
+    global.linksAccepted = shard->linksAccepted.get();
+    global.linksClosed = shard->linksClosed.get();
+    global.linksRateLimited = shard->linksRateLimited.get();
+    global.linksShed = shard->linksShed.get();
+    global.requestsRejected = shard->requestsRejected.get();
+    global.retryBudgetRemaining = retryBudget.remaining();
+    stats_publish(statsSegment.global(), global);
+
+    int64_t nowNs = loopClock->mono_ns();
+    for (size_t i = 0; i < upstreams.size(); ++i) {
+        const Upstream* upstream = upstreams[i];
+        const UpstreamMetrics& metrics = *upstream->metrics;
+        HistogramWindow& window = latencyWindows[i];
+        window.roll(metrics.firstByteNs, nowNs, StatsQuantileWindowMilliseconds * 1000000LL);
+
+        StatsUpstream stats;
+        strncpy(stats.endpoint, upstream->endpoint.c_str(), sizeof(stats.endpoint) - 1);
+        stats.good = upstream->good ? 1 : 0;
+        stats.inflight = upstream->limiter.inflight;
+        stats.limit = upstream->limiter.enabled() ? upstream->limiter.current_limit() : 0;
+        stats.picks = metrics.picks.get();
+        stats.failovers = metrics.failovers.get();
+        stats.connectErrors = metrics.connectErrors.get();
+        stats.timeouts = metrics.timeouts.get();
+        for (int c = 0; c < static_cast<int>(StatusClass::Count); ++c) stats.responses[c] = metrics.responses[c].get();
+        stats.responseBytes = metrics.responseBytes.get();
+        stats.windowSamples = window.samples(metrics.firstByteNs);
+        stats.p50Ns = window.quantile(metrics.firstByteNs, 0.5);
+        stats.p90Ns = window.quantile(metrics.firstByteNs, 0.9);
+        stats.p99Ns = window.quantile(metrics.firstByteNs, 0.99);
+        stats_publish(statsSegment.upstream(static_cast<int>(i)), stats);
+    }
+}
+
+/**
+ * ip hashed link already has its upstream, only parse first request when something depends on its header
+ * @return 0 wait for complete header, 1 go ahead, -2 request can not be forwarded as configured
+ */
+template <LbPolicy policy>
+int LbManager<policy>::prepare_first_request(LbLink* link) {
+    if (config.requestTimeoutMs <= 0 && !config.injects_headers()) {
+        link->requestPrepared = true;
+        return 1;
+    }
+
+    int ret = link->parse_client_content();
+    if ((ret == -3 || ret == -4) && link->clientTotalBytes < PACKET_BUFFER_SIZE) {
+        return 0;
+    }
+    return prepare_request(link) ? 1 : -2;
+}
+
+/**
+ * request head parsed and upstream known, arm its deadline and splice headers going with it
+ * @return false if client lines to replace can not all be left out, request must then be refused
+ */
+template <LbPolicy policy>
+bool LbManager<policy>::prepare_request(LbLink* link) {
+    link->requestPrepared = true;
+    if (config.requestTimeoutMs > 0) arm_deadline(link);
+    if (config.injects_headers() && link->parser.has_complete_header() && !link->prepare_inject_headers()) return false;
+    return link->prepare_headers(loopClock->mono_ns());
+}
+
+/**
+ * configured timeout, shortened by what client asked for in deadline header
+ */
+template <LbPolicy policy>
+int LbManager<policy>::request_timeout_ms(int clientTimeoutMs) const {
+    int timeoutMs = config.requestTimeoutMs;
+    if (clientTimeoutMs > 0 && (timeoutMs <= 0 || clientTimeoutMs < timeoutMs)) timeoutMs = clientTimeoutMs;
+    return timeoutMs;
+}
+
+/**
+ * deadline = route default, shortened by client deadline header, covers upstream pick until first response byte
+ */
+template <LbPolicy policy>
+void LbManager<policy>::arm_deadline(LbLink* link) {
+    link->requestPrepared = true;
+    int timeoutMs = request_timeout_ms(link->requestTimeoutMs);
+    if (timeoutMs <= 0 || link->hasDeadline) return;
+
+    int64_t nowNs = loopClock->mono_ns();
+    link->deadlineNs = nowNs + timeoutMs * 1000000LL;
+    link->deadlineIt = deadlines.emplace(link->deadlineNs, link);
+    link->hasDeadline = true;
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::clear_deadline(LbLink* link) {
+    if (link->hasDeadline) {
+        deadlines.erase(link->deadlineIt);
+        link->hasDeadline = false;
+    }
+}
+
+/**
+ * pipelined request has its own deadline from dispatch until first response byte, kept across a retry
+ */
+template <LbPolicy policy>
+void LbManager<policy>::arm_exchange_deadline(LbExchange* exchange, int64_t deadlineNs) {
+    if (deadlineNs <= 0 || exchange->hasDeadline) return;
+    exchange->deadlineIt = exchangeDeadlines.emplace(deadlineNs, exchange);
+    exchange->hasDeadline = true;
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::clear_exchange_deadline(LbExchange* exchange) {
+    if (exchange->hasDeadline) {
+        exchangeDeadlines.erase(exchange->deadlineIt);
+        exchange->hasDeadline = false;
+    }
+}
+
+/**
+ * current request of a link is ahead of all its pipelined ones, so its 504 goes out at once and link closes
+ * an expired pipelined request gets 504 as its response, written in its turn, and link closes after it
+ */
+template <LbPolicy policy>
+void LbManager<policy>::expire_deadlines() {
+    static const string header{"HTTP/1.1 504 Gateway Timeout\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"};
+    int64_t nowNs = loopClock->mono_ns();
+    while (!deadlines.empty() && deadlines.begin()->first <= nowNs) {
+        LbLink* link = deadlines.begin()->second;
+        deadlines.erase(deadlines.begin());
+        link->hasDeadline = false;
+
+        *os << loopClock->now_string() << " deadline exceeded " << link->clientEndpoint << " <--> "
+            << (link->pUpstream ? link->pUpstream->endpoint : "none") << endl;
+        if (link->pUpstream) {
+            link->pUpstream->limiter.on_drop();  // slow upstream, same signal as drop
+            link->pUpstream->metrics->timeouts.add();
+        }
+        send(link->clientFd, header.c_str(), header.size(), MSG_NOSIGNAL);
+        link->closeReason = static_cast<uint8_t>(AccessCloseReason::Timeout);
+        on_leave(link, link->serverFd);
+    }
+    while (!exchangeDeadlines.empty() && exchangeDeadlines.begin()->first <= nowNs) {
+        LbExchange* exchange = exchangeDeadlines.begin()->second;
+        exchangeDeadlines.erase(exchangeDeadlines.begin());
+        exchange->hasDeadline = false;
+        LbLink* link = fetch_link(exchange->serverFd);
+        if (link == nullptr) continue;
+
+        *os << loopClock->now_string() << " deadline exceeded " << link->clientEndpoint << " <--> "
+            << exchange->pUpstream->endpoint << endl;
+        exchange->pUpstream->limiter.on_drop();
+        exchange->pUpstream->metrics->timeouts.add();
+        detach_exchange(link, exchange, false);
+        exchange->response.assign(header);
+        exchange->responseSent = 0;
+        exchange->closeDelimited = true;
+        link->closeReason = static_cast<uint8_t>(AccessCloseReason::Timeout);
+        if (flush_pipeline(link)) update_events(link);
+    }
+}
+
+/**
+ * parse head of request at buffer start and pick its upstream
+ * @return 0 wait for complete head, 1 dispatched, 2 answered from cache or waiting for it, -1 link closed
+ */
+template <LbPolicy policy>
+int LbManager<policy>::l7_dispatch_request(LbLink* link) {
+    static const string badRequest{"HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"};
+    static const string rateLimited{
+        "HTTP/1.1 429 Too Many Requests\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"};
+
+    int ret = link->parse_client_content();
+    bool waiting = ret == -3 || ret == -4 || (ret == -2 && link->isAsyncCall);
+    if (waiting && link->clientTotalBytes < PACKET_BUFFER_SIZE) {
+        return 0;
+    }
+    if (!link->parser.has_complete_header()) {
+        reject_request(link, badRequest);
+        return -1;
+    }
+    // first one charged on accept
+    if (link->requestCount > 0 && (link->rateLimited || !rateLimiter.allow(link->clientIp, loopClock->mono_ns()))) {
+        reject_request(link, rateLimited);
+        return -1;
+    }
+
+    link->frame_request();
+    if (link->requestFramer.bad()) {  // length ambiguous, upstream might split it differently
+        reject_request(link, badRequest);
+        return -1;
+    }
+    if (capture.enabled()) capture_request(link);
+    return l7_route_request(link, true);
+}
+
+/**
+ * answer framed request from cache when possible, otherwise pick its upstream
+ * @return 1 dispatched, 2 answered from cache or waiting for fetch of same key, -1 link closed
+ */
+template <LbPolicy policy>
+int LbManager<policy>::l7_route_request(LbLink* link, bool mayWait) {
+    static const string badRequest{"HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"};
+    if (cache.enabled() && !link->l7Tunnel) {
+        int ret = l7_cache_request(link, mayWait);
+        if (ret != 0) return ret;
+    }
+    int routed = routed_pick_upstream(link);
+    bool picked = routed != 0 ? routed > 0
+                              : policy == LbPolicy::RANDOMED ? random_on_first_client_data_in(link) > 0
+                                                             : ip_hashed_pick_upstream(link);
+    if (!picked) {
+        shed_client(link);
+        return -1;
+    }
+    if (!prepare_request(link)) {
+        reject_request(link, badRequest);
+        return -1;
+    }
+    return 1;
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::l7_on_data_in(LbLink* link, int recvFd) {
+    if (link->is_server_side(recvFd)) {
+        l7_on_response_data(link);
+        return;
+    }
+    if (!link->is_client_side(recvFd)) {
+        LbExchange* exchange = link->find_exchange(recvFd);
+        if (exchange) l7_on_exchange_in(link, exchange);
+        return;
+    }
+
+    if (link->is_buffer_not_empty(recvFd)) {
+        update_events(link);
+        return;
+    }
+    int ret = link->on_client_recv();
+    if (ret == 0) {
+        return;
+    } else if (ret < 0) {
+        on_leave(link, recvFd);
+        return;
+    }
+    l7_on_client_data(link);
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::l7_on_data_out(LbLink* link, int sendFd) {
+    if (!link->is_client_side(sendFd) && !link->is_server_side(sendFd)) {
+        LbExchange* exchange = link->find_exchange(sendFd);
+        if (exchange) l7_on_exchange_out(link, exchange);
+        return;
+    }
+
+    if (link->cacheHit && link->is_client_side(sendFd)) {
+        if (write_cached(link)) l7_on_client_data(link);
+        return;
+    }
+
+    int ret = link->on_send(sendFd);
+    if (ret < 0) {
+        if (link->is_client_side(sendFd) || !failover(link)) {
+            *os << "on_data_out error " << sendFd << endl;
+            on_leave(link, sendFd);
+            return;
+        }
+    }
+    if (link->is_client_side(sendFd) && !flush_pipeline(link)) return;
+    if (link->requestCompleteNs == 0 && link->request_forwarded()) on_request_complete(link);
+    update_events(link);
+}
+
+/**
+ * client bytes buffered, dispatch request if none in flight then forward what belongs to current request
+ */
+template <LbPolicy policy>
+void LbManager<policy>::l7_on_client_data(LbLink* link) {
+    while (link->pUpstream == nullptr && link->pipeline.empty()) {
+        if (link->cacheHit || link->cacheWaiting || link->sendBufferLength == 0) {
+            update_events(link);
+            return;  // cached answer still being written, or waiting for a fetch, or nothing buffered
+        }
+        int ret = l7_dispatch_request(link);
+        if (ret < 0) return;
+        if (ret == 0) {
+            link->clearClientBuffer = false;
+            update_events(link);
+            return;  // wait for complete request head
+        }
+        if (ret == 1) {
+            link->clearClientBuffer = true;
+            break;
+        }
+    }
+    l7_forward_request(link);
+}
+
+/**
+ * forward bytes of current request to its upstream, then dispatch complete requests behind it
+ */
+template <LbPolicy policy>
+void LbManager<policy>::l7_forward_request(LbLink* link) {
+    static const string badRequest{"HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"};
+    link->frame_request_bytes();
+    if (link->requestFramer.bad() && link->serverTotalBytes == 0) {
+        send(link->clientFd, badRequest.c_str(), badRequest.size(), MSG_NOSIGNAL);
+        on_leave(link, link->clientFd);
+        return;
+    }
+    if (link->has_request_to_send() && link->on_server_send() < 0 && !failover(link)) {
+        on_leave(link, link->serverFd);
+        return;
+    }
+    if (link->requestCompleteNs == 0 && link->request_forwarded()) on_request_complete(link);
+    if (!dispatch_pipelined(link)) return;
+    if (link->pUpstream == nullptr) {
+        link->clearClientBuffer = false;  // pipeline still busy, collect rest of next request meanwhile
+    }
+    update_events(link);
+}
+
+/**
+ * forward response and watch for its end, then upstream is released and next buffered request dispatched
+ */
+template <LbPolicy policy>
+void LbManager<policy>::l7_on_response_data(LbLink* link) {
+    if (link->has_response_to_send()) {
+        update_events(link);
+        return;
+    }
+
+    bool responded = link->serverTotalBytes > 0;
+    int ret = link->on_server_recv();
+    if (ret == 0) {
+        update_events(link);
+        return;
+    }
+    bool closed = ret < 0;
+    if (closed) {
+        if (failover(link)) {
+            if (link->request_forwarded()) on_request_complete(link);
+            update_events(link);
+            return;
+        }
+        if (!link->has_held_response()) {
+            on_leave(link, link->serverFd);
+            return;
+        }
+        link->release_held_response();  // can not retry, forward the held error response as is
+    }
+    if (!responded) {
+        retryBudget.on_success();
+        clear_deadline(link);
+    }
+
+    if (!link->l7Tunnel) {
+        HttpFramer& framer = link->responseFramer;
+        int consumed = framer.feed(link->clientRecvBuffer + link->recvBufferOffset, link->recvBufferLength);
+        if (consumed < link->recvBufferLength) {  // bytes past end of response, connection not trusted any more
+            link->recvBufferLength = consumed;
+            framer.keepAlive = false;
+        }
+        if (closed) framer.keepAlive = false;
+        if (link->cacheFill) cache_capture(link);
+    }
+    if (link->on_client_send() < 0) {
+        on_leave(link, link->clientFd);
+        return;
+    }
+    if (!link->l7Tunnel && link->responseFramer.bad()) {  // end of response unknown, neither side can be reused
+        on_leave(link, link->serverFd);
+        return;
+    }
+
+    if (!link->l7Tunnel && link->responseFramer.complete()) {
+        if (!link->request_forwarded()) {  // answered before whole request arrived, its rest can not be told apart
+            on_leave(link, link->serverFd);
+            return;
+        }
+        on_response_complete(link);
+        if (!flush_pipeline(link)) return;
+        if (link->sendBufferLength > 0) {
+            l7_on_client_data(link);  // next request already buffered
+            return;
+        }
+    } else if (closed) {
+        on_leave(link, link->serverFd);  // close delimited response ends here, client connection goes with it
+        return;
+    }
+    update_events(link);
+}
+
+/**
+ * last byte of current request forwarded, response latency counts from here
+ */
+template <LbPolicy policy>
+void LbManager<policy>::on_request_complete(LbLink* link) {
+    link->requestCompleteNs = loopClock->mono_ns();
+}
+
+/**
+ * response complete, upstream connection goes back to pool when it can carry another request
+ */
+template <LbPolicy policy>
+void LbManager<policy>::on_response_complete(LbLink* link) {
+    Upstream* upstream = link->pUpstream;
+    int serverFd_ = link->serverFd;
+    int64_t latencyNs = link->requestCompleteNs > 0 ? loopClock->mono_ns() - link->requestCompleteNs : 0;
+    log_request_done(link, upstream, link->responseFramer.status, link->serverTotalBytes, latencyNs);
+    string filledKey;
+    if (link->cacheFill) {
+        if (cache.storable(link->responseFramer)) {
+            link->cacheFillEntry->expiresNs = loopClock->mono_ns() + link->responseFramer.maxAge * 1000000000LL;
+            cache.insert(link->cacheKey, link->cacheFillEntry);
+        }
+        filledKey.swap(link->cacheKey);
+    }
+    links.erase(serverFd_);
+    epoll_delete(epollFd, serverFd_);
+    clear_deadline(link);
+    upstream->limiter.release();
+    if (!link->responseFramer.reusable() || !upstream->put_idle(serverFd_)) {
+        close(serverFd_);
+    }
+    link->reset_request();
+    if (!filledKey.empty()) cache_fill_done(filledKey);
+}
+
+/**
+ * level triggered interest follows buffer state, a side is only read while its buffer can take bytes
+ */
+template <LbPolicy policy>
+void LbManager<policy>::update_events(LbLink* link) {
+    bool responsePending = link->has_response_to_send();
+    bool pipelinePending = link->pUpstream == nullptr && !link->pipeline.empty() && link->pipeline.front()->buffered() > 0;
+    bool clientReadable = link->is_buffer_empty(link->clientFd) &&
+                          (link->clearClientBuffer || link->sendBufferOffset + link->sendBufferLength < PACKET_BUFFER_SIZE);
+    bool cachePending = link->cacheHit != nullptr;
+    uint32_t clientWant =
+        (clientReadable ? EPOLLIN : 0) | (responsePending || pipelinePending || cachePending ? EPOLLOUT : 0);
+    if (clientWant != link->clientEvents) {
+        epoll_mod(epollFd, link->clientFd, clientWant);
+        link->clientEvents = clientWant;
+    }
+
+    for (LbExchange* exchange : link->pipeline) {
+        if (exchange->serverFd < 0) continue;
+        uint32_t want = (exchange_can_recv(link, exchange) ? EPOLLIN : 0) | (exchange->has_request_to_send() ? EPOLLOUT : 0);
+        if (want != exchange->serverEvents) {
+            epoll_mod(epollFd, exchange->serverFd, want);
+            exchange->serverEvents = want;
+        }
+    }
+    if (link->serverFd < 0) return;
+
+    uint32_t serverWant = (responsePending ? 0 : EPOLLIN) | (link->has_request_to_send() ? EPOLLOUT : 0);
+    if (serverWant != link->serverEvents) {
+        epoll_mod(epollFd, link->serverFd, serverWant);
+        link->serverEvents = serverWant;
+    }
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::reject_request(LbLink* link, const string& header) {
+    send(link->clientFd, header.c_str(), header.size(), MSG_NOSIGNAL);
+    shard->requestsRejected.add();
+    link->closeReason = static_cast<uint8_t>(AccessCloseReason::Rejected);
+    client_on_leave(link);
+}
+
+/**
+ * cacheable GET is answered from a fresh entry, or waits for the link already fetching its key,
+ * or makes this link the fetcher whose response is stored; pipelined requests always go to upstream
+ * @return 0 go to upstream, 2 answered or waiting, -1 link closed
+ */
+template <LbPolicy policy>
+int LbManager<policy>::l7_cache_request(LbLink* link, bool mayWait) {
+    const HttpFramer& request = link->requestFramer;
+    if (!request.complete() || request.bodyBytes > 0 || !cache.cacheable_request(link->parser)) return 0;
+
+    string key = cache.key_of(link->parser);
+    shared_ptr<CacheEntry> entry = cache.lookup(key, loopClock->mono_ns());
+    if (entry) return serve_cached(link, std::move(entry));
+    if (cache.is_filling(key)) {
+        if (!mayWait) return 0;  // waited once already, fetch it alone
+        cache.wait_fill(key, link);
+        link->cacheKey.swap(key);
+        link->cacheWaiting = true;
+        link->clearClientBuffer = false;  // keep collecting what client sends meanwhile
+        return 2;
+    }
+    cache.begin_fill(key);
+    link->cacheKey.swap(key);
+    link->cacheFill = true;
+    link->cacheFillEntry = make_shared<CacheEntry>(&cache);
+    return 0;
+}
+
+/**
+ * request taken out of client buffer and answered with stored bytes, no upstream involved
+ * @return 2 answered, -1 link closed
+ */
+template <LbPolicy policy>
+int LbManager<policy>::serve_cached(LbLink* link, shared_ptr<CacheEntry> entry) {
+    log_request_done(link, nullptr, 200, entry->size, 0);
+    link->sendBufferOffset += static_cast<int>(link->requestLength);
+    link->sendBufferLength -= static_cast<int>(link->requestLength);
+    link->doneServerBytes += entry->size;
+    link->reset_request();
+    link->cacheHit = std::move(entry);
+    link->cacheHitSent = 0;
+    return write_cached(link) ? 2 : -1;
+}
+
+/**
+ * @return false if link closed
+ */
+template <LbPolicy policy>
+bool LbManager<policy>::write_cached(LbLink* link) {
+    int ret = link->send_cache_hit();
+    if (ret < 0) {
+        on_leave(link, link->clientFd);
+        return false;
+    }
+    if (ret > 0) link->cacheHit.reset();
+    return true;
+}
+
+/**
+ * response of a fill copied aside while forwarded, given up as soon as it turns out not storable
+ */
+template <LbPolicy policy>
+void LbManager<policy>::cache_capture(LbLink* link) {
+    const HttpFramer& framer = link->responseFramer;
+    bool keep = !framer.head_done() || cache.storable(framer);
+    if (keep) keep = link->cacheFillEntry->append(link->clientRecvBuffer + link->recvBufferOffset, link->recvBufferLength);
+    if (keep) return;
+
+    string key;
+    key.swap(link->cacheKey);
+    link->cacheFill = false;
+    link->cacheFillEntry.reset();
+    cache_fill_done(key);
+}
+
+/**
+ * fetch of key ended, stored or not, links waiting on it look it up again and go to upstream on a miss
+ */
+template <LbPolicy policy>
+void LbManager<policy>::cache_fill_done(const string& key) {
+    for (LbLink* waiter : cache.end_fill(key)) {
+        waiter->cacheWaiting = false;
+        waiter->cacheKey.clear();
+        int ret = l7_route_request(waiter, false);
+        if (ret < 0) continue;
+        if (ret == 1) {
+            waiter->clearClientBuffer = true;
+            l7_forward_request(waiter);
+        } else {
+            l7_on_client_data(waiter);  // answered, next buffered request if any
+        }
+    }
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::release_cache(LbLink* link) {
+    if (link->cacheWaiting) cache.cancel_wait(link->cacheKey, link);
+    if (link->cacheFill) {
+        string key;
+        key.swap(link->cacheKey);
+        link->cacheFill = false;
+        link->cacheFillEntry.reset();
+        cache_fill_done(key);
+    }
+}
+
+/**
+ * complete requests buffered behind the one in flight go to upstreams of their own right away
+ * stops at first request that is partial, can not be framed or has no upstream, it waits for serial dispatch
+ * @return false if link closed
+ */
+template <LbPolicy policy>
+bool LbManager<policy>::dispatch_pipelined(LbLink* link) {
+    if (link->l7Tunnel || (link->pUpstream != nullptr && !link->requestFramer.complete())) return true;
+
+    while (link->pipeline.size() < static_cast<size_t>(MaxPipelinedRequests)) {
+        int begin = link->sendBufferOffset + (link->pUpstream ? static_cast<int>(link->requestRemaining) : 0);
+        int end = link->sendBufferOffset + link->sendBufferLength;
+        if (begin >= end) return true;
+
+        HttpParser& parser = link->pipelineParser;
+        parser.init(link->clientSendBuffer + begin, end - begin);
+        parser.parse();
+        if (!parser.has_complete_header() || LbLink::needs_tunnel(parser) ||
+            parser.get_query_path().ends_with(AsyncCallQueryPath)) {
+            return true;
+        }
+        HttpFramer framer;
+        framer.reset(HttpFramer::Request);
+        int length = framer.feed(link->clientSendBuffer + begin, end - begin);
+        if (!framer.complete()) return true;
+        int timeoutMs = 0;
+        const HttpHeader* deadline = nullptr;
+        if (config.requestTimeoutMs > 0) {
+            int clientTimeoutMs = 0;
+            deadline = LbLink::find_deadline(parser, config, clientTimeoutMs);
+            timeoutMs = request_timeout_ms(clientTimeoutMs);
+        }
+        bool withDeadline = timeoutMs > 0 && !config.deadlineHeader.empty();
+        bool spliced = config.injects_headers() || withDeadline;
+        HeaderSplice splice;
+        if (spliced) {  // kept aside whole anyway, so headers are spliced into the copy
+            std::vector<std::pair<int, int>> replaced;
+            splice.set_range(parser.requestLineEnd, length);
+            if (!LbLink::forward_headers(parser, config, link->clientAddress, splice.headers, replaced)) return true;
+            if (withDeadline) {  // whole budget still left, request goes out right away
+                if (deadline && parser.header_repeated(config.deadlineHeader)) return true;
+                if (deadline) replaced.emplace_back(deadline->lineBegin, deadline->lineEnd);
+                splice.headers += config.deadlineHeader + ": " + std::to_string(timeoutMs) + "\r\n";
+            }
+            for (const auto& skip : replaced) {
+                if (!splice.add_skip(skip.first, skip.second)) return true;  // serial dispatch refuses it
+            }
+        }
+        if (link->rateLimited) return true;
+
+        bool randomed = policy == LbPolicy::RANDOMED &&
+                        parser.get_header(HttpHeaderId::UserAgent).find("python") != boost::string_view::npos;
+        const Route* route = routeTable.match(parser);
+        int pool = route ? route->pool : -1;
+        int serverFd_ = -1;
+        Upstream* upstream = pick_upstream_for_pipelined(link, randomed, pool, serverFd_, false);
+        if (upstream == nullptr) return true;  // serial dispatch charges rate limit then
+        if (!rateLimiter.allow(link->clientIp, loopClock->mono_ns())) {  // charged once, answered 429 in turn
+            if (!upstream->put_idle(serverFd_)) close(serverFd_);
+            link->rateLimited = true;
+            return true;
+        }
+
+        auto exchange = new LbExchange();
+        if (spliced) {
+            splice.append_to(link->clientSendBuffer + begin, exchange->request);
+        } else {
+            exchange->request.assign(link->clientSendBuffer + begin, static_cast<size_t>(length));
+        }
+        exchange->framer.reset(HttpFramer::Response, framer.is_method("HEAD"));
+        exchange->randomed = randomed;
+        exchange->pool = pool;
+        link->remove_client_bytes(begin, length);
+        link->pipeline.push_back(exchange);
+        attach_exchange(link, exchange, upstream, serverFd_);
+        if (timeoutMs > 0) arm_exchange_deadline(exchange, loopClock->mono_ns() + timeoutMs * 1000000LL);
+        if (exchange->on_server_send() < 0 && !retry_exchange(link, exchange)) {
+            on_leave(link, exchange->serverFd);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * same upstream the link policy, or policy of routed pool, would start from, then next available ones
+ * @param retryPaid caller already withdrew from retry budget, connect failures here are not charged again
+ */
+template <LbPolicy policy>
+Upstream* LbManager<policy>::pick_upstream_for_pipelined(LbLink* link, bool randomed, int pool, int& serverFd_,
+                                                         bool retryPaid) {
+    const vector<Upstream*>& members = pool >= 0 ? routeTable.pools[pool].members : upstreams;
+    int size = pool >= 0 ? static_cast<int>(members.size()) : upstreamSize;
+    if (size == 0) return nullptr;
+    int start = randomed ? uid(generator) : link->firstUpstreamIndex;
+    if (pool >= 0) {
+        start = routeTable.pools[pool].policy == LbPolicyRandom ? static_cast<int>(generator() % size)
+                                                                : ip_hashed_index(link->clientAddress, size);
+    }
+    bool retry = false;
+    for (int i = 0; i < size; ++i) {
+        Upstream* upstream = members[(start + i) % size];
+        if (!is_upstream_available(link, upstream)) continue;
+        if (retry && !retryPaid && !retryBudget.try_withdraw(loopClock->mono_ns())) return nullptr;
+
+        serverFd_ = acquire_upstream_fd(upstream);
+        if (serverFd_ > 0) return upstream;
+        retry = true;
+    }
+    return nullptr;
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::attach_exchange(LbLink* link, LbExchange* exchange, Upstream* upstream, int serverFd_) {
+    exchange->pUpstream = upstream;
+    exchange->serverFd = serverFd_;
+    link->lastUpstream = upstream;
+    upstream->limiter.acquire();
+    upstream->metrics->picks.add();
+    trace_upstream(link, TraceEvent::Pick, upstream, pickNs);
+    link->trace.record(TraceEvent::Connected, connectedNs);
+
+    set_nonblock(serverFd_);
+    links[serverFd_] = link;
+    epoll_add(epollFd, serverFd_);
+    exchange->serverEvents = EPOLLIN;
+    *os << loopClock->now_string() << " open " << LbPolicyPipelined << " " << link->clientEndpoint << " <--> "
+        << upstream->endpoint << endl;
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::detach_exchange(LbLink* link, LbExchange* exchange, bool reuse) {
+    clear_exchange_deadline(exchange);
+    int serverFd_ = exchange->serverFd;
+    links.erase(serverFd_);
+    epoll_delete(epollFd, serverFd_);
+    exchange->pUpstream->limiter.release();
+    if (!reuse || !exchange->pUpstream->put_idle(serverFd_)) {
+        close(serverFd_);
+    }
+    exchange->serverFd = -1;
+}
+
+/**
+ * upstream closed before any response byte, request is still whole so send it once more elsewhere
+ */
+template <LbPolicy policy>
+bool LbManager<policy>::retry_exchange(LbLink* link, LbExchange* exchange) {
+    if (exchange->retried || exchange->serverTotalBytes > 0) return false;
+    if (!retryBudget.try_withdraw(loopClock->mono_ns())) {
+        *os << loopClock->now_string() << " retry budget exhausted, no failover " << link->clientEndpoint << endl;
+        return false;
+    }
+
+    int serverFd_ = -1;
+    Upstream* upstream = pick_upstream_for_pipelined(link, exchange->randomed, exchange->pool, serverFd_, true);
+    if (upstream == nullptr) return false;
+
+    exchange->pUpstream->metrics->failovers.add();
+    exchange->pUpstream->limiter.on_drop();
+    int64_t deadlineNs = exchange->hasDeadline ? exchange->deadlineIt->first : 0;
+    detach_exchange(link, exchange, false);
+    exchange->reset_for_retry(upstream, serverFd_);
+    attach_exchange(link, exchange, upstream, serverFd_);
+    arm_exchange_deadline(exchange, deadlineNs);  // same deadline as first attempt
+    *os << loopClock->now_string() << " failover " << link->clientEndpoint << " <--> " << upstream->endpoint << endl;
+    return exchange->on_server_send() >= 0;
+}
+
+/**
+ * response at head of the queue is bounded by itself so it always drains, those behind it share the link bound
+ */
+template <LbPolicy policy>
+bool LbManager<policy>::exchange_can_recv(LbLink* link, LbExchange* exchange) {
+    if (exchange->serverFd < 0) return false;
+    if (link->pUpstream == nullptr && link->pipeline.front() == exchange) {
+        return exchange->buffered() < MaxPipelineBufferedBytes;
+    }
+    return link->pipeline_buffered() < MaxPipelineBufferedBytes;
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::l7_on_exchange_in(LbLink* link, LbExchange* exchange) {
+    if (!exchange_can_recv(link, exchange)) {
+        update_events(link);
+        return;
+    }
+
+    bool responded = exchange->serverTotalBytes > 0;
+    int ret = exchange->on_server_recv();
+    if (ret == 0) {
+        return;
+    } else if (ret < 0) {
+        if (!responded && !exchange->framer.bad() && retry_exchange(link, exchange)) {
+            update_events(link);
+            return;
+        }
+        if (!exchange->framer.until_close()) {  // response cut short, later ones can not be delivered in order
+            on_leave(link, exchange->serverFd);
+            return;
+        }
+        exchange->closeDelimited = true;
+        detach_exchange(link, exchange, false);
+    } else {
+        if (!responded) {
+            retryBudget.on_success();
+            clear_exchange_deadline(exchange);
+        }
+        if (exchange->framer.complete()) {
+            log_request_done(link, exchange->pUpstream, exchange->framer.status, exchange->serverTotalBytes,
+                             exchange->requestCompleteNs > 0 ? loopClock->mono_ns() - exchange->requestCompleteNs : 0);
+            detach_exchange(link, exchange, exchange->framer.reusable());
+        }
+    }
+
+    if (!flush_pipeline(link)) return;
+    if (link->pUpstream == nullptr && link->pipeline.empty() && link->sendBufferLength > 0) {
+        l7_on_client_data(link);
+        return;
+    }
+    update_events(link);
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::l7_on_exchange_out(LbLink* link, LbExchange* exchange) {
+    if (exchange->on_server_send() < 0 && !retry_exchange(link, exchange)) {
+        on_leave(link, exchange->serverFd);
+        return;
+    }
+    update_events(link);
+}
+
+/**
+ * once link itself has nothing in flight, queued responses are written to client in request order
+ * @return false if link closed
+ */
+template <LbPolicy policy>
+bool LbManager<policy>::flush_pipeline(LbLink* link) {
+    while (link->pUpstream == nullptr && link->recvBufferLength == 0 && !link->pipeline.empty()) {
+        LbExchange* exchange = link->pipeline.front();
+        int ret = exchange->on_client_send(link->clientFd);
+        if (ret < 0) {
+            on_leave(link, link->clientFd);
+            return false;
+        }
+        if (ret > 0) link->trace.lastByteNs = loopClock->mono_ns();
+        if (ret == 0 || exchange->serverFd >= 0) break;  // client busy, or response not complete yet
+
+        link->pipeline.pop_front();
+        link->doneServerBytes += exchange->serverTotalBytes;
+        ++link->requestCount;
+        bool closeDelimited = exchange->closeDelimited;
+        delete exchange;
+        if (closeDelimited) {  // client reads that response until close, requests behind it are dropped
+            on_leave(link, link->clientFd);
+            return false;
+        }
+    }
+    return true;
+}
+
+template <LbPolicy policy>
+void LbManager<policy>::drop_pipeline(LbLink* link) {
+    for (LbExchange* exchange : link->pipeline) {
+        if (exchange->serverFd >= 0) detach_exchange(link, exchange, false);
+        delete exchange;
+    }
+    link->pipeline.clear();
 }
 
 #endif
@@ -0,0 +1,68 @@
+#include <arpa/inet.h>
+#include <cstdio>
+#include "AccessLog.h"
+#include "LinkTrace.h"
+
+/**
+ * without per request latency, as for l4 links, slowest is first request forwarded until last byte to client
+ */
+void LinkTrace::finish(int64_t ns, uint8_t reason, uint32_t requests_) {
+    closeReason = reason;
+    requests = requests_;
+    int64_t lastNs = count > 0 ? entries[count - 1].ns : 0;
+    if (lastByteNs > 0 && lastByteNs < lastNs) lastByteNs = lastNs;
+    if (ns < lastNs) ns = lastNs;
+    if (slowestNs == 0 && lastByteNs > 0) {
+        for (int i = 0; i < count; ++i) {
+            if (entries[i].event == TraceEvent::RequestSent) {
+                slowestNs = lastByteNs - entries[i].ns;
+                break;
+            }
+        }
+    }
+    if (lastByteNs > 0) entries[count++] = {lastByteNs, 0, 0, TraceEvent::LastByte};
+    entries[count++] = {ns, 0, 0, TraceEvent::Close};
+}
+
+/**
+ * client ip:port, summary, then every event as offset from accept
+ */
+void LinkTrace::format(std::string& out) const {
+    char text[128];
+    struct in_addr addr {};
+    addr.s_addr = clientIp;
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+    const char* reason = closeReason < sizeof(AccessCloseReasonNames) / sizeof(AccessCloseReasonNames[0])
+                             ? AccessCloseReasonNames[closeReason]
+                             : "unknown";
+    snprintf(text, sizeof(text), "trace %s:%u reason %s requests %u slowest_us %ld dropped %u", ip, clientPort, reason,
+             requests, static_cast<long>(slowestNs / 1000), dropped);
+    out += text;
+
+    int64_t startNs = count > 0 ? entries[0].ns : 0;
+    for (int i = 0; i < count; ++i) {
+        const TraceEntry& entry = entries[i];
+        snprintf(text, sizeof(text), " %s+%ldus", TraceEventNames[static_cast<int>(entry.event)],
+                 static_cast<long>((entry.ns - startNs) / 1000));
+        out += text;
+        if (entry.upstreamIp || entry.upstreamPort) {
+            addr.s_addr = entry.upstreamIp;
+            inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+            snprintf(text, sizeof(text), "(%s:%u)", ip, entry.upstreamPort);
+            out += text;
+        }
+    }
+    out += '\n';
+}
+
+void TraceRing::push(const LinkTrace& trace) {
+    traces[pushed % traces.size()] = trace;
+    ++pushed;
+}
+
+void TraceRing::dump(std::string& out) const {
+    size_t size = traces.size();
+    uint64_t first = pushed > size ? pushed - size : 0;
+    for (uint64_t i = first; i < pushed; ++i) traces[i % size].format(out);
+}
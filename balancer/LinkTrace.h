@@ -0,0 +1,81 @@
+#ifndef NETUTILS_LINK_TRACE_H
+#define NETUTILS_LINK_TRACE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class TraceEvent : uint8_t {
+    None,
+    Accept,         // client connection accepted
+    Pick,           // upstream chosen, connect or idle connection take starts
+    Connected,      // upstream connection ready
+    RequestSent,    // first byte of a request forwarded to upstream
+    FirstResponse,  // first byte of a response received from upstream
+    Failover,       // request moved to another upstream, connect starts
+    LastByte,       // last byte written to client, kept once and emitted at close
+    Close,
+};
+
+const char* const TraceEventNames[] = {"none",           "accept",   "pick",      "connected", "request_sent",
+                                       "first_response", "failover", "last_byte", "close"};
+
+struct TraceEntry {
+    int64_t ns{0};  // monotonic clock
+    uint32_t upstreamIp{0};  // network order, pick and failover only
+    uint16_t upstreamPort{0};
+    TraceEvent event{TraceEvent::None};
+};
+
+/**
+ * lifecycle stamps of one link, fixed size so a finished trace is copied into ring without allocation
+ * events take loop clock, so events of one loop iteration share a stamp and cost no clock read,
+ * a blocking connect stamps its own end and events after it are kept from going back before it
+ * events past capacity are counted instead of kept, last_byte and close always have their slots
+ */
+struct LinkTrace {
+    static constexpr int Capacity = 16;
+
+    uint32_t clientIp{0};
+    uint16_t clientPort{0};
+    uint8_t count{0};
+    uint8_t dropped{0};      // events that did not fit
+    uint8_t closeReason{0};  // AccessCloseReason
+    uint32_t requests{0};
+    int64_t lastByteNs{0};
+    int64_t slowestNs{0};  // slowest request, tail sampling threshold applies to it
+    TraceEntry entries[Capacity];
+
+    void record(TraceEvent event, int64_t ns, uint32_t upstreamIp = 0, uint16_t upstreamPort = 0) {
+        if (count > 0 && ns < entries[count - 1].ns) ns = entries[count - 1].ns;
+        if (count < Capacity - 2) {
+            entries[count++] = {ns, upstreamIp, upstreamPort, event};
+        } else if (dropped < UINT8_MAX) {
+            ++dropped;
+        }
+    }
+
+    void on_request_done(int64_t latencyNs) {
+        if (latencyNs > slowestNs) slowestNs = latencyNs;
+    }
+
+    void finish(int64_t ns, uint8_t reason, uint32_t requests_);
+    void format(std::string& out) const;
+};
+
+/**
+ * last finished traces of a reactor, oldest overwritten, only the reactor thread touches it
+ */
+struct TraceRing {
+    uint64_t pushed{0};
+
+    void init(size_t capacity) { traces.resize(capacity); }
+    bool enabled() const { return !traces.empty(); }
+    void push(const LinkTrace& trace);
+    void dump(std::string& out) const;  // oldest first, one line per trace
+
+private:
+    std::vector<LinkTrace> traces;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "LoopProfiler.h"
+
+LoopProfiler::Interval LoopProfiler::roll() {
+    Interval interval;
+    uint64_t busyNs = metrics->busyNs.get() - lastBusyNs;
+    uint64_t waitNs = metrics->waitNs.get() - lastWaitNs;
+    if (busyNs + waitNs > 0) interval.busyRatio = static_cast<double>(busyNs) / (busyNs + waitNs);
+    interval.wakeups = metrics->wakeups.get() - lastWakeups;
+    interval.events = metrics->events.get() - lastEvents;
+    interval.fullWakeups = metrics->fullWakeups.get() - lastFullWakeups;
+    interval.slowestNs = slowestNs;
+    interval.slowestFd = slowestFd;
+    metrics->slowestHandlerNs.set(static_cast<uint64_t>(slowestNs));
+
+    lastBusyNs += busyNs;
+    lastWaitNs += waitNs;
+    lastWakeups += interval.wakeups;
+    lastEvents += interval.events;
+    lastFullWakeups += interval.fullWakeups;
+    slowestNs = 0;
+    slowestFd = -1;
+    return interval;
+}
+
+bool listen_queue(int listenFd, uint32_t& queued, uint32_t& backlog) {
+    struct tcp_info info {};
+    socklen_t length = sizeof(info);
+    if (getsockopt(listenFd, IPPROTO_TCP, TCP_INFO, &info, &length) < 0) return false;
+    queued = info.tcpi_unacked;
+    backlog = info.tcpi_sacked;
+    return true;
+}
+
+/**
+ * file has pairs of lines per protocol, names then values
+ */
+bool listen_overflows(uint64_t& overflows, uint64_t& drops) {
+    std::ifstream netstat("/proc/net/netstat");
+    std::string names, values;
+    while (std::getline(netstat, names) && std::getline(netstat, values)) {
+        if (names.compare(0, 7, "TcpExt:") != 0) continue;
+        std::istringstream nameStream(names), valueStream(values);
+        std::string name, value;
+        int found = 0;
+        while (nameStream >> name && valueStream >> value) {
+            if (name == "ListenOverflows") {
+                overflows = std::stoull(value);
+                ++found;
+            } else if (name == "ListenDrops") {
+                drops = std::stoull(value);
+                ++found;
+            }
+        }
+        return found == 2;
+    }
+    return false;
+}
@@ -0,0 +1,83 @@
+#ifndef NETUTILS_LOOP_PROFILER_H
+#define NETUTILS_LOOP_PROFILER_H
+
+#include <cstdint>
+#include "Metrics.h"
+#include "Utils.h"
+
+/**
+ * reactor self profile: time blocked in epoll_wait against time handling events, events per wakeup,
+ * and slowest single handler; costs one clock read per wakeup and one per handled event
+ */
+struct LoopProfiler {
+    /**
+     * summary of one stats interval
+     */
+    struct Interval {
+        double busyRatio{0};
+        uint64_t wakeups{0};
+        uint64_t events{0};
+        uint64_t fullWakeups{0};
+        int64_t slowestNs{0};
+        int slowestFd{-1};
+    };
+
+    LoopMetrics* metrics{nullptr};
+
+    void before_wait() {
+        int64_t nowNs = steady_nanos();
+        if (wakeNs > 0) metrics->busyNs.add(nowNs - wakeNs);
+        waitStartNs = nowNs;
+    }
+
+    /**
+     * @param nowNs monotonic clock read right after epoll_wait, loop clock of this iteration
+     */
+    void on_wake(int64_t nowNs, int count, int capacity) {
+        if (waitStartNs > 0) metrics->waitNs.add(nowNs - waitStartNs);
+        wakeNs = nowNs;
+        handlerStartNs = nowNs;
+        if (count <= 0) return;
+        metrics->wakeups.add();
+        metrics->events.add(count);
+        metrics->eventsPerWakeup.record(count);
+        if (count >= capacity) metrics->fullWakeups.add();
+    }
+
+    void on_handled(int fd) {
+        int64_t nowNs = steady_nanos();
+        int64_t spentNs = nowNs - handlerStartNs;
+        metrics->handlerNs.record(spentNs);
+        if (spentNs > slowestNs) {
+            slowestNs = spentNs;
+            slowestFd = fd;
+        }
+        handlerStartNs = nowNs;
+    }
+
+    Interval roll();
+
+private:
+    int64_t waitStartNs{0};
+    int64_t wakeNs{0};
+    int64_t handlerStartNs{0};
+    int64_t slowestNs{0};
+    int slowestFd{-1};
+    uint64_t lastBusyNs{0};
+    uint64_t lastWaitNs{0};
+    uint64_t lastWakeups{0};
+    uint64_t lastEvents{0};
+    uint64_t lastFullWakeups{0};
+};
+
+/**
+ * accept queue of a listen socket from TCP_INFO, unacked is queued connections and sacked the backlog
+ */
+bool listen_queue(int listenFd, uint32_t& queued, uint32_t& backlog);
+
+/**
+ * host wide TcpExt ListenOverflows and ListenDrops from /proc/net/netstat
+ */
+bool listen_overflows(uint64_t& overflows, uint64_t& drops);
+
+#endif
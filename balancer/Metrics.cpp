@@ -0,0 +1,280 @@
+#include <algorithm>
+#include <cstdio>
+#include "Metrics.h"
+
+namespace {
+
+const char* const StatusClassNames[] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+
+std::string upstream_label(const std::string& name) { return "upstream=\"" + name + "\""; }
+
+/**
+ * exported bucket bounds are powers of two within [minExp, maxExp], scaled to prometheus base unit
+ */
+struct HistogramFamily {
+    const char* name;
+    const char* help;
+    LogLinearHistogram UpstreamMetrics::*member;
+    double scale;  // recorded unit to exported unit
+    int minExp;
+    int maxExp;
+};
+
+const HistogramFamily HistogramFamilies[] = {
+    {"lb_upstream_connect_seconds", "tcp connect time of new upstream connections", &UpstreamMetrics::connectNs, 1e-9,
+     10, 34},
+    {"lb_upstream_first_byte_seconds", "request sent until first response byte", &UpstreamMetrics::firstByteNs, 1e-9,
+     10, 34},
+    {"lb_link_lifetime_seconds", "client link lifetime by upstream it last used", &UpstreamMetrics::linkLifetimeNs,
+     1e-9, 16, 40},
+    {"lb_link_bytes", "bytes of client link both directions by upstream it last used", &UpstreamMetrics::linkBytes, 1,
+     6, 34},
+};
+
+struct CounterFamily {
+    const char* name;
+    const char* help;
+    MetricCounter UpstreamMetrics::*member;
+};
+
+const CounterFamily CounterFamilies[] = {
+    {"lb_upstream_picks_total", "links or requests sent to upstream", &UpstreamMetrics::picks},
+    {"lb_upstream_failovers_total", "requests moved away from upstream", &UpstreamMetrics::failovers},
+    {"lb_upstream_connect_errors_total", "failed connects to upstream", &UpstreamMetrics::connectErrors},
+    {"lb_upstream_timeouts_total", "requests answered 504 waiting for upstream", &UpstreamMetrics::timeouts},
+    {"lb_upstream_response_bytes_total", "bytes received from upstream", &UpstreamMetrics::responseBytes},
+};
+
+/**
+ * cumulative buckets at powers of two within [minExp, maxExp], then +Inf, sum and count
+ */
+void append_histogram(std::string& out, const std::string& name, const std::string& label,
+                      const std::vector<uint64_t>& counts, uint64_t count, uint64_t sum, double scale, int minExp,
+                      int maxExp) {
+    std::string bucketName = name + "_bucket";
+    std::string prefix = label.empty() ? "" : label + ",";
+    uint64_t cumulative = 0;
+    int bucket = 0;
+    for (int e = minExp; e <= maxExp; ++e) {
+        int end = LogLinearHistogram::bucket_of(1ULL << e);
+        for (; bucket < end; ++bucket) cumulative += counts[bucket];
+        char le[32];
+        snprintf(le, sizeof(le), "%.9g", static_cast<double>(1ULL << e) * scale);
+        append_metric(out, bucketName.c_str(), prefix + "le=\"" + le + "\"", cumulative);
+    }
+    append_metric(out, bucketName.c_str(), prefix + "le=\"+Inf\"", count);
+    append_metric(out, (name + "_sum").c_str(), label, static_cast<double>(sum) * scale);
+    append_metric(out, (name + "_count").c_str(), label, count);
+}
+
+void add_counts(std::vector<uint64_t>& counts, const LogLinearHistogram& histogram) {
+    for (int b = 0; b < LogLinearHistogram::BucketCount; ++b) {
+        counts[b] += histogram.counts[b].load(std::memory_order_relaxed);
+    }
+}
+
+}  // namespace
+
+void HistogramWindow::roll(const LogLinearHistogram& histogram, int64_t nowNs, int64_t windowNs) {
+    if (current.empty()) {
+        previous.assign(LogLinearHistogram::BucketCount, 0);
+        current.assign(LogLinearHistogram::BucketCount, 0);
+    }
+    if (nowNs - rolledNs < windowNs) return;
+    previous.swap(current);
+    for (int b = 0; b < LogLinearHistogram::BucketCount; ++b) {
+        current[b] = histogram.counts[b].load(std::memory_order_relaxed);
+    }
+    rolledNs = nowNs;
+}
+
+uint64_t HistogramWindow::samples(const LogLinearHistogram& histogram) const {
+    uint64_t total = 0;
+    for (int b = 0; b < LogLinearHistogram::BucketCount; ++b) {
+        total += histogram.counts[b].load(std::memory_order_relaxed) - previous[b];
+    }
+    return total;
+}
+
+uint64_t HistogramWindow::quantile(const LogLinearHistogram& histogram, double q) const {
+    uint64_t total = samples(histogram);
+    if (total == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(q * (total - 1)) + 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < LogLinearHistogram::BucketCount; ++b) {
+        seen += histogram.counts[b].load(std::memory_order_relaxed) - previous[b];
+        if (seen >= rank) {
+            return b + 1 < LogLinearHistogram::BucketCount ? LogLinearHistogram::bucket_lower(b + 1) - 1 : UINT64_MAX;
+        }
+    }
+    return 0;
+}
+
+MetricsShard* Metrics::add_shard() {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    shards.emplace_back(new MetricsShard(upstreamNames.size()));
+    return shards.back().get();
+}
+
+void append_metric_header(std::string& out, const char* name, const char* type, const char* help) {
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void append_metric(std::string& out, const char* name, const std::string& labels, uint64_t value) {
+    out.append(name);
+    if (!labels.empty()) out.append("{").append(labels).append("}");
+    out.append(" ").append(std::to_string(value)).append("\n");
+}
+
+void append_metric(std::string& out, const char* name, const std::string& labels, double value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.9g", value);
+    out.append(name);
+    if (!labels.empty()) out.append("{").append(labels).append("}");
+    out.append(" ").append(text).append("\n");
+}
+
+void Metrics::render(std::string& out) {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    const size_t slots = upstreamNames.size() + 1;
+    auto slot_label = [this](size_t i) { return upstream_label(i < upstreamNames.size() ? upstreamNames[i] : "none"); };
+
+    struct ShardCounter {
+        const char* name;
+        const char* help;
+        MetricCounter MetricsShard::*member;
+    };
+    const ShardCounter shardCounters[] = {
+        {"lb_links_accepted_total", "client connections accepted", &MetricsShard::linksAccepted},
+        {"lb_links_closed_total", "client links closed", &MetricsShard::linksClosed},
+        {"lb_links_rate_limited_total", "client connections refused by rate limit", &MetricsShard::linksRateLimited},
+        {"lb_links_shed_total", "links answered 503 for no available upstream", &MetricsShard::linksShed},
+        {"lb_requests_rejected_total", "requests answered 400 or 429", &MetricsShard::requestsRejected},
+    };
+    for (const auto& family : shardCounters) {
+        uint64_t total = 0;
+        for (const auto& shard : shards) total += ((*shard).*family.member).get();
+        append_metric_header(out, family.name, "counter", family.help);
+        append_metric(out, family.name, "", total);
+    }
+
+    for (const auto& family : CounterFamilies) {
+        append_metric_header(out, family.name, "counter", family.help);
+        for (size_t i = 0; i + 1 < slots; ++i) {
+            uint64_t total = 0;
+            for (const auto& shard : shards) total += (shard->upstreams[i].*family.member).get();
+            append_metric(out, family.name, slot_label(i), total);
+        }
+    }
+
+    append_metric_header(out, "lb_upstream_responses_total", "counter", "responses by status class");
+    for (size_t i = 0; i + 1 < slots; ++i) {
+        for (int c = 0; c < static_cast<int>(StatusClass::Count); ++c) {
+            uint64_t total = 0;
+            for (const auto& shard : shards) total += shard->upstreams[i].responses[c].get();
+            append_metric(out, "lb_upstream_responses_total",
+                          slot_label(i) + ",code=\"" + StatusClassNames[c] + "\"", total);
+        }
+    }
+
+    std::vector<uint64_t> counts(LogLinearHistogram::BucketCount);
+    for (const auto& family : HistogramFamilies) {
+        append_metric_header(out, family.name, "histogram", family.help);
+        for (size_t i = 0; i < slots; ++i) {
+            std::fill(counts.begin(), counts.end(), 0);
+            uint64_t count = 0, sum = 0;
+            for (const auto& shard : shards) {
+                const LogLinearHistogram& histogram = shard->upstreams[i].*family.member;
+                add_counts(counts, histogram);
+                count += histogram.count.get();
+                sum += histogram.sum.get();
+            }
+            if (count == 0 && i + 1 == slots) continue;  // no link left without upstream
+            append_histogram(out, family.name, slot_label(i), counts, count, sum, family.scale, family.minExp,
+                             family.maxExp);
+        }
+    }
+
+    render_loop(out);
+}
+
+/**
+ * counters summed over reactors, gauges take the largest reactor value, listen counters are host wide anyway
+ */
+void Metrics::render_loop(std::string& out) {
+    struct LoopCounter {
+        const char* name;
+        const char* help;
+        MetricCounter LoopMetrics::*member;
+    };
+    const LoopCounter loopCounters[] = {
+        {"lb_loop_wakeups_total", "epoll_wait returns with events", &LoopMetrics::wakeups},
+        {"lb_loop_events_total", "events handled by reactor", &LoopMetrics::events},
+        {"lb_loop_full_wakeups_total", "epoll_wait returns that filled the whole event buffer",
+         &LoopMetrics::fullWakeups},
+    };
+    for (const auto& family : loopCounters) {
+        uint64_t total = 0;
+        for (const auto& shard : shards) total += (shard->loop.*family.member).get();
+        append_metric_header(out, family.name, "counter", family.help);
+        append_metric(out, family.name, "", total);
+    }
+
+    uint64_t busyNs = 0, waitNs = 0;
+    for (const auto& shard : shards) {
+        busyNs += shard->loop.busyNs.get();
+        waitNs += shard->loop.waitNs.get();
+    }
+    append_metric_header(out, "lb_loop_busy_seconds_total", "counter", "reactor time spent handling events");
+    append_metric(out, "lb_loop_busy_seconds_total", "", busyNs * 1e-9);
+    append_metric_header(out, "lb_loop_wait_seconds_total", "counter", "reactor time blocked in epoll_wait");
+    append_metric(out, "lb_loop_wait_seconds_total", "", waitNs * 1e-9);
+
+    struct LoopHistogram {
+        const char* name;
+        const char* help;
+        LogLinearHistogram LoopMetrics::*member;
+        double scale;
+        int minExp;
+        int maxExp;
+    };
+    const LoopHistogram loopHistograms[] = {
+        {"lb_loop_events_per_wakeup", "events returned by one epoll_wait", &LoopMetrics::eventsPerWakeup, 1, 0, 8},
+        {"lb_loop_handler_seconds", "time to handle one event", &LoopMetrics::handlerNs, 1e-9, 8, 34},
+    };
+    std::vector<uint64_t> counts(LogLinearHistogram::BucketCount);
+    for (const auto& family : loopHistograms) {
+        std::fill(counts.begin(), counts.end(), 0);
+        uint64_t count = 0, sum = 0;
+        for (const auto& shard : shards) {
+            const LogLinearHistogram& histogram = shard->loop.*family.member;
+            add_counts(counts, histogram);
+            count += histogram.count.get();
+            sum += histogram.sum.get();
+        }
+        append_metric_header(out, family.name, "histogram", family.help);
+        append_histogram(out, family.name, "", counts, count, sum, family.scale, family.minExp, family.maxExp);
+    }
+
+    struct LoopGauge {
+        const char* name;
+        const char* help;
+        MetricGauge LoopMetrics::*member;
+        double scale;
+    };
+    const LoopGauge loopGauges[] = {
+        {"lb_loop_slowest_handler_seconds", "slowest single event over last stats interval",
+         &LoopMetrics::slowestHandlerNs, 1e-9},
+        {"lb_listen_queue_length", "connections waiting for accept", &LoopMetrics::listenQueue, 1},
+        {"lb_listen_backlog", "accept queue limit of listen socket", &LoopMetrics::listenBacklog, 1},
+        {"lb_listen_overflows", "host ListenOverflows since balancer start", &LoopMetrics::listenOverflows, 1},
+        {"lb_listen_drops", "host ListenDrops since balancer start", &LoopMetrics::listenDrops, 1},
+    };
+    for (const auto& family : loopGauges) {
+        uint64_t largest = 0;
+        for (const auto& shard : shards) largest = std::max(largest, (shard->loop.*family.member).get());
+        append_metric_header(out, family.name, "gauge", family.help);
+        append_metric(out, family.name, "", largest * family.scale);
+    }
+}
@@ -0,0 +1,161 @@
+#ifndef NETUTILS_METRICS_H
+#define NETUTILS_METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * counter written by one thread only, a plain load and store so recording needs no locked instruction,
+ * scrapes from elsewhere still read whole values
+ */
+struct MetricCounter {
+    std::atomic<uint64_t> value{0};
+
+    void add(uint64_t n = 1) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+/**
+ * last value set by owning thread, read by scrapes
+ */
+struct MetricGauge {
+    std::atomic<uint64_t> value{0};
+
+    void set(uint64_t v) { value.store(v, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+/**
+ * log-linear histogram: values bucketed by power of two, each power split into SubBuckets linear steps,
+ * so relative error stays under 1 / SubBuckets over the whole uint64 range; recording is a clz and two adds
+ * bucket bounds fall on every power of two, exported buckets are those powers
+ */
+struct LogLinearHistogram {
+    static constexpr int SubBucketBits = 3;
+    static constexpr int SubBuckets = 1 << SubBucketBits;
+    static constexpr int BucketCount = (64 - SubBucketBits + 1) * SubBuckets;
+
+    std::atomic<uint64_t> counts[BucketCount]{};
+    MetricCounter count;
+    MetricCounter sum;
+
+    static int bucket_of(uint64_t value) {
+        if (value < SubBuckets) return static_cast<int>(value);
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - SubBucketBits;
+        return (shift + 1) * SubBuckets + static_cast<int>((value >> shift) & (SubBuckets - 1));
+    }
+
+    static uint64_t bucket_lower(int bucket) {
+        if (bucket < SubBuckets) return static_cast<uint64_t>(bucket);
+        return static_cast<uint64_t>(SubBuckets + bucket % SubBuckets) << (bucket / SubBuckets - 1);
+    }
+
+    void record(uint64_t value) {
+        std::atomic<uint64_t>& bucket = counts[bucket_of(value)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        count.add();
+        sum.add(value);
+    }
+};
+
+enum class StatusClass { Informational, Success, Redirect, ClientError, ServerError, Count };
+
+/**
+ * per upstream series of one shard, last slot of a shard gathers links that had no upstream when they left
+ */
+struct UpstreamMetrics {
+    MetricCounter picks;  // links or requests sent to upstream
+    MetricCounter responses[static_cast<int>(StatusClass::Count)];
+    MetricCounter failovers;  // requests moved away from upstream
+    MetricCounter connectErrors;
+    MetricCounter timeouts;
+    MetricCounter responseBytes;  // received from upstream
+    LogLinearHistogram connectNs;
+    LogLinearHistogram firstByteNs;  // request sent until first response byte
+    LogLinearHistogram linkLifetimeNs;
+    LogLinearHistogram linkBytes;  // both directions
+    char pad[64];
+
+    void on_status(int status) {
+        if (status >= 100 && status < 600) responses[status / 100 - 1].add();
+    }
+};
+
+/**
+ * quantiles of a cumulative histogram over its recent samples, counts are diffed against a snapshot
+ * taken one to two windows ago, rolled by the thread that writes the histogram
+ */
+struct HistogramWindow {
+    std::vector<uint64_t> previous;  // counts at start of last window
+    std::vector<uint64_t> current;   // counts at start of this window
+    int64_t rolledNs{0};
+
+    void roll(const LogLinearHistogram& histogram, int64_t nowNs, int64_t windowNs);
+    uint64_t samples(const LogLinearHistogram& histogram) const;
+    uint64_t quantile(const LogLinearHistogram& histogram, double q) const;  // upper bound of its bucket
+};
+
+/**
+ * self profile of a reactor loop
+ */
+struct LoopMetrics {
+    MetricCounter wakeups;
+    MetricCounter events;
+    MetricCounter fullWakeups;  // epoll_wait filled its whole event buffer, more may be waiting
+    MetricCounter busyNs;       // handling events
+    MetricCounter waitNs;       // blocked in epoll_wait
+    LogLinearHistogram eventsPerWakeup;
+    LogLinearHistogram handlerNs;  // one event, from previous event done or wakeup
+    MetricGauge slowestHandlerNs;  // over last stats interval
+    MetricGauge listenQueue;       // connections waiting for accept
+    MetricGauge listenBacklog;
+    MetricGauge listenOverflows;  // host wide TcpExt counters since balancer start
+    MetricGauge listenDrops;
+};
+
+/**
+ * counters of one reactor thread, only that thread writes them
+ */
+struct MetricsShard {
+    MetricCounter linksAccepted;
+    MetricCounter linksClosed;
+    MetricCounter linksRateLimited;
+    MetricCounter linksShed;
+    MetricCounter requestsRejected;
+    char pad[64];
+    LoopMetrics loop;
+    std::vector<UpstreamMetrics> upstreams;
+
+    explicit MetricsShard(size_t upstreamCount) : upstreams(upstreamCount + 1) {}
+    UpstreamMetrics& none() { return upstreams.back(); }
+};
+
+/**
+ * shards of every reactor, summed at scrape and rendered in prometheus text format
+ */
+struct Metrics {
+    std::vector<std::string> upstreamNames;
+
+    MetricsShard* add_shard();
+    void render(std::string& out);
+
+private:
+    std::vector<std::unique_ptr<MetricsShard>> shards;
+
+    void render_loop(std::string& out);
+    std::mutex shardsMutex;
+};
+
+/**
+ * prometheus text helpers, also used for gauges owned by callers
+ */
+void append_metric_header(std::string& out, const char* name, const char* type, const char* help);
+void append_metric(std::string& out, const char* name, const std::string& labels, uint64_t value);
+void append_metric(std::string& out, const char* name, const std::string& labels, double value);
+
+#endif
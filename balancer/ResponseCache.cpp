@@ -0,0 +1,197 @@
+#include <strings.h>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <boost/algorithm/string/predicate.hpp>
+#include "LbConstants.h"
+#include "ResponseCache.h"
+#include "Utils.h"
+
+static bool header_has_token(HttpParser& request, HttpHeaderId name, const char* token) {
+    const HttpHeader* header = request.find_header(name);
+    return header && boost::algorithm::icontains(header->value, token);
+}
+
+CacheEntry::~CacheEntry() {
+    for (char* block : blocks) cache->give_block(block);
+}
+
+bool CacheEntry::append(const char* data, size_t len) {
+    if (size + len > MaxCacheEntryBytes) return false;
+    while (len > 0) {
+        size_t used = size % CacheBlockSize;
+        if (used == 0 && size == blocks.size() * CacheBlockSize) {
+            char* block = cache->take_block();
+            if (block == nullptr) return false;
+            blocks.push_back(block);
+        }
+        size_t n = std::min(len, CacheBlockSize - used);
+        memcpy(blocks.back() + used, data, n);
+        size += n;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * iovecs over stored bytes from offset on, so a partially written response resumes where client stopped
+ */
+int CacheEntry::to_iovec(size_t offset, struct iovec* iov, int maxCount) const {
+    int count = 0;
+    for (size_t i = offset / CacheBlockSize; i < blocks.size() && count < maxCount; ++i) {
+        size_t begin = i == offset / CacheBlockSize ? offset % CacheBlockSize : 0;
+        size_t end = std::min(CacheBlockSize, size - i * CacheBlockSize);
+        iov[count].iov_base = blocks[i] + begin;
+        iov[count].iov_len = end - begin;
+        ++count;
+    }
+    return count;
+}
+
+ResponseCache::~ResponseCache() {
+    index.clear();
+    lru.clear();
+    for (char* block : freeBlocks) delete[] block;
+    freeBlocks.clear();
+}
+
+void ResponseCache::init(size_t budgetBytes_, const std::string& varyHeaders_) {
+    budgetBytes = budgetBytes_;
+    varyHeaders.clear();
+    for (const auto& name : split(varyHeaders_, ',')) {
+        if (!name.empty()) varyHeaders.push_back(name);
+    }
+}
+
+/**
+ * plain GET without credentials, client asking to bypass caches is sent to upstream untouched
+ */
+bool ResponseCache::cacheable_request(HttpParser& request) const {
+    return request.method == "GET" && !request.has_header(HttpHeaderId::Authorization) &&
+           !header_has_token(request, HttpHeaderId::CacheControl, "no-cache") &&
+           !header_has_token(request, HttpHeaderId::CacheControl, "no-store") &&
+           !header_has_token(request, HttpHeaderId::Pragma, "no-cache");
+}
+
+/**
+ * 200 with positive max-age and fitting size, nothing private, per user or varying on headers outside key
+ */
+bool ResponseCache::storable(const HttpFramer& response) const {
+    if (response.status != 200 || !response.keepAlive || response.maxAge <= 0 || response.noStore ||
+        response.setCookie) {
+        return false;
+    }
+    if (response.hasContentLength &&
+        static_cast<size_t>(response.contentLength) > std::min(MaxCacheEntryBytes, budgetBytes)) {
+        return false;  // known too large before anything is evicted for it
+    }
+    // names scanned in place, nothing allocated per response
+    const char* vary = response.vary;
+    int at = 0;
+    while (at < response.varyLength) {
+        int begin = at;
+        while (at < response.varyLength && vary[at] != ',') ++at;
+        int end = at++;
+        while (begin < end && (vary[begin] == ' ' || vary[begin] == '\t')) ++begin;
+        while (end > begin && (vary[end - 1] == ' ' || vary[end - 1] == '\t')) --end;
+        if (begin == end) continue;
+        size_t length = static_cast<size_t>(end - begin);
+        auto it = std::find_if(varyHeaders.begin(), varyHeaders.end(), [&](const std::string& header) {
+            return header.size() == length && strncasecmp(header.data(), vary + begin, length) == 0;
+        });
+        if (it == varyHeaders.end()) return false;  // includes Vary: *
+    }
+    return true;
+}
+
+std::string ResponseCache::key_of(HttpParser& request) const {
+    std::string key;
+    key.reserve(128);
+    key.append(request.method.data(), request.method.size()).append(" ");
+    key.append(request.queryPath.data(), request.queryPath.size());
+    const HttpHeader* host = request.find_header(HttpHeaderId::Host);
+    key.append("\n");
+    if (host) key.append(host->value.data(), host->value.size());
+    for (const auto& name : varyHeaders) {
+        const HttpHeader* header = request.find_header(name);
+        key.append("\n");
+        if (header) key.append(header->value.data(), header->value.size());
+    }
+    return key;
+}
+
+std::shared_ptr<CacheEntry> ResponseCache::lookup(const std::string& key, int64_t nowNs) {
+    auto found = index.find(key);
+    if (found == index.end()) {
+        ++misses;
+        return nullptr;
+    }
+    if (found->second->second->expiresNs <= nowNs) {
+        erase(found->second);
+        ++misses;
+        return nullptr;
+    }
+    lru.splice(lru.begin(), lru, found->second);
+    ++hits;
+    return found->second->second;
+}
+
+void ResponseCache::insert(const std::string& key, std::shared_ptr<CacheEntry> entry) {
+    auto found = index.find(key);
+    if (found != index.end()) erase(found->second);
+    lru.emplace_front(key, std::move(entry));
+    index[key] = lru.begin();
+    ++stored;
+}
+
+void ResponseCache::wait_fill(const std::string& key, LbLink* link) {
+    fills[key].push_back(link);
+    ++collapsed;
+}
+
+void ResponseCache::cancel_wait(const std::string& key, LbLink* link) {
+    auto found = fills.find(key);
+    if (found == fills.end()) return;
+    auto& waiters = found->second;
+    waiters.erase(std::remove(waiters.begin(), waiters.end(), link), waiters.end());
+}
+
+std::vector<LbLink*> ResponseCache::end_fill(const std::string& key) {
+    std::vector<LbLink*> waiters;
+    auto found = fills.find(key);
+    if (found == fills.end()) return waiters;
+    waiters.swap(found->second);
+    fills.erase(found);
+    return waiters;
+}
+
+size_t ResponseCache::used_bytes() const { return usedBlocks * CacheBlockSize; }
+
+/**
+ * block for a response being stored, least recently used entries are dropped to stay within budget
+ * a dropped entry still written to some client returns its blocks once that write is done
+ */
+char* ResponseCache::take_block() {
+    while ((usedBlocks + 1) * CacheBlockSize > budgetBytes && !lru.empty()) {
+        erase(std::prev(lru.end()));
+        ++evicted;
+    }
+    if ((usedBlocks + 1) * CacheBlockSize > budgetBytes) return nullptr;
+
+    ++usedBlocks;
+    if (freeBlocks.empty()) return new char[CacheBlockSize];
+    char* block = freeBlocks.back();
+    freeBlocks.pop_back();
+    return block;
+}
+
+void ResponseCache::give_block(char* block) {
+    --usedBlocks;
+    freeBlocks.push_back(block);
+}
+
+void ResponseCache::erase(LruList::iterator it) {
+    index.erase(it->first);
+    lru.erase(it);
+}
@@ -0,0 +1,87 @@
+#ifndef NETUTILS_RESPONSE_CACHE_H
+#define NETUTILS_RESPONSE_CACHE_H
+
+#include <sys/uio.h>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "HttpFramer.h"
+#include "HttpParser.h"
+
+struct LbLink;
+struct ResponseCache;
+
+/**
+ * one stored response, bytes exactly as upstream sent them, kept in fixed size blocks taken from cache pool
+ * shared with links still writing it to their clients, blocks go back to pool when last holder lets go
+ */
+struct CacheEntry {
+    ResponseCache* cache{nullptr};
+    std::vector<char*> blocks;
+    size_t size{0};
+    int64_t expiresNs{0};
+
+    explicit CacheEntry(ResponseCache* cache_) : cache(cache_) {}
+    ~CacheEntry();
+
+    bool append(const char* data, size_t len);  // false when over entry limit or no block left in budget
+    int to_iovec(size_t offset, struct iovec* iov, int maxCount) const;
+};
+
+/**
+ * GET responses keyed on method, path, host and configured request headers, fresh for their max-age
+ * bounded by byte budget over pooled blocks, least recently used entries evicted first
+ * a miss makes its link the only fetcher of that key, other links asking meanwhile wait for it
+ */
+struct ResponseCache {
+    size_t budgetBytes{0};  // 0 disables cache
+    std::vector<std::string> varyHeaders;
+
+    uint64_t hits{0};
+    uint64_t misses{0};
+    uint64_t collapsed{0};  // misses that waited for fetch of another link
+    uint64_t stored{0};
+    uint64_t evicted{0};
+
+    ResponseCache() = default;
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+    ~ResponseCache();
+
+    void init(size_t budgetBytes_, const std::string& varyHeaders_);
+    bool enabled() const { return budgetBytes > 0; }
+
+    bool cacheable_request(HttpParser& request) const;
+    bool storable(const HttpFramer& response) const;
+    std::string key_of(HttpParser& request) const;
+
+    std::shared_ptr<CacheEntry> lookup(const std::string& key, int64_t nowNs);
+    void insert(const std::string& key, std::shared_ptr<CacheEntry> entry);
+
+    bool is_filling(const std::string& key) const { return fills.find(key) != fills.end(); }
+    void begin_fill(const std::string& key) { fills[key]; }
+    void wait_fill(const std::string& key, LbLink* link);
+    void cancel_wait(const std::string& key, LbLink* link);
+    std::vector<LbLink*> end_fill(const std::string& key);  // links waited on key, to be looked up again
+
+    size_t entries() const { return index.size(); }
+    size_t used_bytes() const;
+
+    char* take_block();
+    void give_block(char* block);
+
+private:
+    typedef std::list<std::pair<std::string, std::shared_ptr<CacheEntry>>> LruList;
+    LruList lru;  // most recently used first
+    std::unordered_map<std::string, LruList::iterator> index;
+    std::unordered_map<std::string, std::vector<LbLink*>> fills;  // keys being fetched, links waiting for each
+    std::vector<char*> freeBlocks;
+    size_t usedBlocks{0};
+
+    void erase(LruList::iterator it);
+};
+
+#endif
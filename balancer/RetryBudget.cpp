@@ -0,0 +1,30 @@
+#include <algorithm>
+#include "RetryBudget.h"
+
+void RetryBudget::init(double ratio_, double floorPerSecond, double maxTokens_) {
+    ratio = std::max(0.0, ratio_);
+    floorPerNs = std::max(0.0, floorPerSecond) / 1e9;
+    maxTokens = std::max(1.0, maxTokens_);
+    tokens = maxTokens;
+    lastNs = 0;
+}
+
+void RetryBudget::on_success() {
+    ++deposits;
+    tokens = std::min(maxTokens, tokens + ratio);
+}
+
+bool RetryBudget::try_withdraw(int64_t nowNs) {
+    if (lastNs > 0 && nowNs > lastNs) {
+        tokens = std::min(maxTokens, tokens + (nowNs - lastNs) * floorPerNs);
+    }
+    lastNs = nowNs;
+
+    if (tokens >= 1.0) {
+        tokens -= 1.0;
+        ++retriesAllowed;
+        return true;
+    }
+    ++retriesDenied;
+    return false;
+}
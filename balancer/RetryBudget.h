@@ -0,0 +1,28 @@
+#ifndef NETUTILS_RETRY_BUDGET_H
+#define NETUTILS_RETRY_BUDGET_H
+
+#include <cstdint>
+
+/**
+ * token bucket shared by all retries: each successful request deposits ratio token, a floor refills over time
+ * so a quiet balancer can still retry, each retry withdraws one token
+ */
+struct RetryBudget {
+    double ratio{0};
+    double floorPerNs{0};
+    double maxTokens{0};
+    double tokens{0};
+    int64_t lastNs{0};
+
+    uint64_t deposits{0};
+    uint64_t retriesAllowed{0};
+    uint64_t retriesDenied{0};
+
+    void init(double ratio_, double floorPerSecond, double maxTokens_);
+
+    void on_success();
+    bool try_withdraw(int64_t nowNs);
+    double remaining() const { return tokens; }
+};
+
+#endif
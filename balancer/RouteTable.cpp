@@ -0,0 +1,179 @@
+#include <strings.h>
+#include <algorithm>
+#include <cstring>
+#include <boost/algorithm/string/predicate.hpp>
+#include "LbConstants.h"
+#include "RouteTable.h"
+#include "Utils.h"
+
+static std::string trim(const std::string& s) {
+    auto begin = s.find_first_not_of(" \t");
+    if (begin == std::string::npos) return "";
+    auto end = s.find_last_not_of(" \t");
+    return s.substr(begin, end - begin + 1);
+}
+
+static std::vector<std::string> tokens_of(const std::string& s) {
+    std::vector<std::string> result;
+    for (const auto& item : split(s, ' ')) {
+        if (!item.empty()) result.push_back(item);
+    }
+    return result;
+}
+
+bool RouteTable::add_pool(const std::string& spec) {
+    auto tokens = tokens_of(spec);
+    if (tokens.size() != 3 || find_pool(tokens[0]) >= 0) return false;
+
+    UpstreamPool pool;
+    pool.name = tokens[0];
+    if (tokens[1] == "random") {
+        pool.policy = LbPolicyRandom;
+    } else if (tokens[1] == "ip_hashed") {
+        pool.policy = LbPolicyIpHashed;
+    } else {
+        return false;
+    }
+    for (const auto& endpoint : split(tokens[2], ',')) {
+        if (!endpoint.empty()) pool.endpoints.push_back(endpoint);
+    }
+    if (pool.endpoints.empty()) return false;
+    pools.push_back(pool);
+    return true;
+}
+
+bool RouteTable::add_route(const std::string& spec) {
+    auto arrow = spec.find("->");
+    if (arrow == std::string::npos) return false;
+    auto tokens = tokens_of(spec.substr(0, arrow));
+    if (tokens.empty() || tokens.size() > 2 || tokens[0][0] != '/') return false;
+
+    Route route;
+    route.spec = trim(spec);
+    route.path = tokens[0];
+    if (route.path.back() == '*') {
+        route.prefix = true;
+        route.path.pop_back();
+    }
+    if (tokens.size() == 2) {
+        auto op = tokens[1].find_first_of("~=");
+        if (op == std::string::npos || op == 0) return false;
+        route.headerName = tokens[1].substr(0, op);
+        route.headerValue = tokens[1].substr(op + 1);
+        route.contains = tokens[1][op] == '~';
+    }
+    route.pool = find_pool(trim(spec.substr(arrow + 2)));
+    if (route.pool < 0) return false;
+    routes.push_back(route);
+    return true;
+}
+
+void RouteTable::compile() {
+    nodes.clear();
+    nodes.emplace_back();
+    for (int i = 0; i < static_cast<int>(routes.size()); ++i) insert(i);
+}
+
+int RouteTable::find_pool(const std::string& name) const {
+    for (int i = 0; i < static_cast<int>(pools.size()); ++i) {
+        if (pools[i].name == name) return i;
+    }
+    return -1;
+}
+
+int RouteTable::child_of(int node, char c) const {
+    const auto& children = nodes[node].children;
+    auto it = std::lower_bound(children.begin(), children.end(), std::make_pair(c, -1));
+    return (it != children.end() && it->first == c) ? it->second : -1;
+}
+
+/**
+ * walk key down the trie, an edge sharing only part of its label is split so every route ends on a node
+ */
+void RouteTable::insert(int route) {
+    const std::string& key = routes[route].path;
+    int node = 0;
+    size_t pos = 0;
+    while (pos < key.size()) {
+        int child = child_of(node, key[pos]);
+        if (child < 0) {
+            child = static_cast<int>(nodes.size());
+            nodes.emplace_back();
+            nodes[child].label = key.substr(pos);
+            auto& children = nodes[node].children;
+            children.insert(std::lower_bound(children.begin(), children.end(), std::make_pair(key[pos], -1)),
+                            std::make_pair(key[pos], child));
+            node = child;
+            break;
+        }
+
+        size_t common = 0;
+        const size_t labelLength = nodes[child].label.size();
+        while (common < labelLength && pos + common < key.size() && nodes[child].label[common] == key[pos + common]) {
+            ++common;
+        }
+        if (common < labelLength) {
+            int middle = static_cast<int>(nodes.size());
+            nodes.emplace_back();
+            nodes[middle].label = nodes[child].label.substr(0, common);
+            nodes[child].label.erase(0, common);
+            nodes[middle].children.emplace_back(nodes[child].label[0], child);
+            auto& children = nodes[node].children;
+            std::lower_bound(children.begin(), children.end(), std::make_pair(key[pos], -1))->second = middle;
+            child = middle;
+        }
+        node = child;
+        pos += common;
+    }
+    if (routes[route].prefix) {
+        nodes[node].prefix.push_back(route);
+    } else {
+        nodes[node].exact.push_back(route);
+    }
+}
+
+bool RouteTable::header_matches(const Route& route, HttpParser& request) const {
+    if (route.headerName.empty()) return true;
+    const HttpHeader* header = request.find_header(route.headerName);
+    if (header == nullptr) return false;
+    if (route.contains) return boost::algorithm::icontains(header->value, route.headerValue);
+    return header->value.size() == route.headerValue.size() &&
+           strncasecmp(header->value.data(), route.headerValue.data(), route.headerValue.size()) == 0;
+}
+
+/**
+ * @return route of request path without query, nullptr if none applies
+ */
+const Route* RouteTable::match(HttpParser& request) const {
+    if (nodes.empty()) return nullptr;
+    boost::string_view path = request.get_query_path();
+    auto query = path.find('?');
+    if (query != boost::string_view::npos) path = path.substr(0, query);
+
+    int visited[MaxDepth];
+    int depth = 0;
+    int node = 0;
+    size_t pos = 0;
+    visited[depth++] = node;
+    while (pos < path.size() && depth < MaxDepth) {
+        int child = child_of(node, path[pos]);
+        if (child < 0) break;
+        const std::string& label = nodes[child].label;
+        if (path.size() - pos < label.size() || memcmp(path.data() + pos, label.data(), label.size()) != 0) break;
+        pos += label.size();
+        node = child;
+        visited[depth++] = node;
+    }
+
+    if (pos == path.size()) {
+        for (int route : nodes[node].exact) {
+            if (header_matches(routes[route], request)) return &routes[route];
+        }
+    }
+    while (depth > 0) {
+        for (int route : nodes[visited[--depth]].prefix) {
+            if (header_matches(routes[route], request)) return &routes[route];
+        }
+    }
+    return nullptr;
+}
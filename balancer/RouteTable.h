@@ -0,0 +1,67 @@
+#ifndef NETUTILS_ROUTE_TABLE_H
+#define NETUTILS_ROUTE_TABLE_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "HttpParser.h"
+
+struct Upstream;
+
+/**
+ * named set of upstreams a route sends requests to, picked from by its own policy
+ */
+struct UpstreamPool {
+    std::string name;
+    char policy{'h'};  // LbPolicyIpHashed or LbPolicyRandom
+    std::vector<std::string> endpoints;
+    std::vector<Upstream*> members;
+};
+
+/**
+ * path exact or prefix, optionally also a request header containing or equal to a value
+ */
+struct Route {
+    std::string spec;  // as configured, for logs
+    std::string path;
+    bool prefix{false};
+    std::string headerName;  // empty when path alone decides
+    std::string headerValue;
+    bool contains{false};  // header value contains headerValue, otherwise equals it, both case insensitive
+    int pool{-1};
+};
+
+/**
+ * routes compiled into a radix trie over path bytes, lookup walks the path once whatever the number of routes
+ * exact route at the node where path ends wins, then prefix routes from longest to shortest;
+ * routes on same node are tried in configured order until one's header condition holds
+ */
+struct RouteTable {
+    std::vector<UpstreamPool> pools;
+    std::vector<Route> routes;
+
+    bool add_pool(const std::string& spec);   // "name ip_hashed|random host:port,host:port"
+    bool add_route(const std::string& spec);  // "/path[*] [Header~value|Header=value] -> pool"
+    void compile();
+    bool empty() const { return routes.empty(); }
+
+    const Route* match(HttpParser& request) const;
+
+private:
+    static constexpr int MaxDepth = 64;  // nodes on one path, prefix routes deeper than this are not seen
+
+    struct Node {
+        std::string label;                         // bytes on edge from parent
+        std::vector<std::pair<char, int>> children;  // by first byte of label, sorted
+        std::vector<int> exact;                    // routes, configured order
+        std::vector<int> prefix;
+    };
+    std::vector<Node> nodes;
+
+    int find_pool(const std::string& name) const;
+    int child_of(int node, char c) const;
+    void insert(int route);
+    bool header_matches(const Route& route, HttpParser& request) const;
+};
+
+#endif
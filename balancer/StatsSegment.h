@@ -0,0 +1,190 @@
+#ifndef NETUTILS_STATS_SEGMENT_H
+#define NETUTILS_STATS_SEGMENT_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/**
+ * posix shared memory segment the balancer publishes its live stats into, read by lbtop
+ * layout: StatsHeader, one StatsSlot<StatsGlobal>, then upstreamCount StatsSlot<StatsUpstream>
+ * each slot is a seqlock, single writer never waits, readers retry when they raced a publish
+ */
+struct StatsHeader {
+    char magic[4]{'L', 'B', 'S', 'T'};
+    uint16_t version{1};
+    uint16_t upstreamCount{0};
+    uint32_t globalSlotSize{0};
+    uint32_t upstreamSlotSize{0};
+    int32_t pid{0};
+    int64_t startNs{0};  // wall clock
+    char pad[32]{};
+};
+static_assert(sizeof(StatsHeader) == 64, "stats segment layout is shared with lbtop");
+
+struct StatsGlobal {
+    int64_t publishedNs{0};  // wall clock of last publish
+    uint64_t linksAccepted{0};
+    uint64_t linksClosed{0};
+    uint64_t linksRateLimited{0};
+    uint64_t linksShed{0};
+    uint64_t requestsRejected{0};
+    double retryBudgetRemaining{0};
+};
+
+struct StatsUpstream {
+    char endpoint[48]{};
+    uint32_t good{0};
+    int32_t inflight{0};
+    int32_t limit{0};  // concurrency limit, 0 when limiter is off
+    uint32_t reserved{0};
+    uint64_t picks{0};
+    uint64_t failovers{0};
+    uint64_t connectErrors{0};
+    uint64_t timeouts{0};
+    uint64_t responses[5]{};  // by status class 1xx..5xx
+    uint64_t responseBytes{0};
+    uint64_t windowSamples{0};  // first byte samples behind quantiles below
+    uint64_t p50Ns{0};
+    uint64_t p90Ns{0};
+    uint64_t p99Ns{0};
+};
+
+/**
+ * sequence is odd while a publish is in progress, own cache lines so slots never share one
+ */
+template <typename T>
+struct alignas(64) StatsSlot {
+    std::atomic<uint32_t> seq{0};
+    T value;
+};
+
+/**
+ * writer side, owned by the reactor; publish is two sequence stores around a copy, no locked instruction
+ */
+template <typename T>
+inline void stats_publish(StatsSlot<T>& slot, const T& value) {
+    uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&slot.value, &value, sizeof(T));
+    slot.seq.store(seq + 2, std::memory_order_release);
+}
+
+/**
+ * reader side, copies slot until it saw no publish in between
+ * @return false if writer kept publishing over every attempt
+ */
+template <typename T>
+inline bool stats_read(const StatsSlot<T>& slot, T& value, int attempts = 64) {
+    for (int i = 0; i < attempts; ++i) {
+        uint32_t before = slot.seq.load(std::memory_order_acquire);
+        if (before & 1) continue;
+        memcpy(&value, &slot.value, sizeof(T));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == before) return true;
+    }
+    return false;
+}
+
+inline size_t stats_segment_bytes(int upstreamCount) {
+    return sizeof(StatsHeader) + sizeof(StatsSlot<StatsGlobal>) + upstreamCount * sizeof(StatsSlot<StatsUpstream>);
+}
+
+/**
+ * mapping of a segment, created by balancer and removed when it exits, attached read only by viewers
+ */
+struct StatsSegment {
+    StatsSegment() = default;
+    StatsSegment(const StatsSegment&) = delete;
+    StatsSegment& operator=(const StatsSegment&) = delete;
+    ~StatsSegment() {
+        detach();
+        if (!created.empty()) shm_unlink(created.c_str());
+    }
+
+    /**
+     * new zeroed segment replaces one left by a previous run of same name
+     */
+    std::string create(const std::string& name, int upstreamCount, int64_t startNs) {
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return "shm_open " + name + " failed: " + strerror(errno);
+        size_t size = stats_segment_bytes(upstreamCount);
+        if (ftruncate(fd, size) < 0) {
+            close(fd);
+            return "ftruncate " + name + " failed: " + strerror(errno);
+        }
+        void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) return "mmap " + name + " failed: " + strerror(errno);
+        base = static_cast<char*>(mapped);
+        bytes = size;
+        created = name;
+
+        StatsHeader h;
+        h.upstreamCount = static_cast<uint16_t>(upstreamCount);
+        h.globalSlotSize = sizeof(StatsSlot<StatsGlobal>);
+        h.upstreamSlotSize = sizeof(StatsSlot<StatsUpstream>);
+        h.pid = getpid();
+        h.startNs = startNs;
+        memcpy(base, &h, sizeof(h));
+        return "";
+    }
+
+    bool enabled() const { return base != nullptr; }
+
+    /**
+     * @return empty on success, otherwise why segment can not be used
+     */
+    std::string attach(const std::string& name) {
+        detach();
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) return "shm_open " + name + " failed: " + strerror(errno);
+        struct stat st {};
+        if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(StatsHeader)) {
+            close(fd);
+            return "segment " + name + " too small";
+        }
+        void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) return "mmap " + name + " failed: " + strerror(errno);
+        base = static_cast<char*>(mapped);
+        bytes = st.st_size;
+
+        const StatsHeader& h = header();
+        if (memcmp(h.magic, "LBST", 4) != 0 || h.version != 1 || h.globalSlotSize != sizeof(StatsSlot<StatsGlobal>) ||
+            h.upstreamSlotSize != sizeof(StatsSlot<StatsUpstream>) || bytes < stats_segment_bytes(h.upstreamCount)) {
+            detach();
+            return "segment " + name + " has unknown layout";
+        }
+        return "";
+    }
+
+    void detach() {
+        if (base) munmap(base, bytes);
+        base = nullptr;
+        bytes = 0;
+    }
+
+    const StatsHeader& header() const { return *reinterpret_cast<const StatsHeader*>(base); }
+    StatsSlot<StatsGlobal>& global() const {
+        return *reinterpret_cast<StatsSlot<StatsGlobal>*>(base + sizeof(StatsHeader));
+    }
+    StatsSlot<StatsUpstream>& upstream(int i) const {
+        return reinterpret_cast<StatsSlot<StatsUpstream>*>(base + sizeof(StatsHeader) +
+                                                            sizeof(StatsSlot<StatsGlobal>))[i];
+    }
+
+private:
+    char* base{nullptr};
+    size_t bytes{0};
+    std::string created;  // name to unlink, only set by balancer side
+};
+
+#endif
@@ -0,0 +1,42 @@
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include "LbConstants.h"
+#include "TcpPathStats.h"
+
+/**
+ * degraded when smoothed rtt is well above baseline, or sampled sockets keep retransmitting
+ */
+void TcpPathStats::sample(int fd, int64_t nowNs) {
+    nextSampleNs = nowNs + TcpInfoSampleMilliseconds * 1000000LL;
+    struct tcp_info info {};
+    socklen_t length = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &length) < 0 || info.tcpi_rtt == 0) return;
+
+    // kernel total covers whole socket life, only what happened since last look counts, so a path can recover
+    // first look at a socket only records its baseline, its earlier history would spike the average
+    if (lastTotalRetrans.size() >= TcpInfoTrackedSockets) lastTotalRetrans.clear();
+    auto last = lastTotalRetrans.find(fd);
+    bool seen = last != lastTotalRetrans.end() && last->second <= info.tcpi_total_retrans;  // less: fd reused
+    uint32_t retrans = seen ? info.tcpi_total_retrans - last->second : 0;
+    lastTotalRetrans[fd] = info.tcpi_total_retrans;
+
+    if (samples == 0) {
+        srttUs = info.tcpi_rtt;
+        rttVarUs = info.tcpi_rttvar;
+        cwnd = info.tcpi_snd_cwnd;
+        retransmits = retrans;
+        baseRttUs = info.tcpi_rtt;
+    } else {
+        srttUs += (info.tcpi_rtt - srttUs) / 8;
+        rttVarUs += (info.tcpi_rttvar - rttVarUs) / 8;
+        cwnd += (info.tcpi_snd_cwnd - cwnd) / 8;
+        if (seen) retransmits += (retrans - retransmits) / 8;
+        baseRttUs = std::min(baseRttUs * (1 + 1.0 / 256), static_cast<double>(info.tcpi_rtt));
+    }
+    ++samples;
+
+    degraded = (srttUs > baseRttUs * TcpDegradedRttFactor && srttUs - baseRttUs > TcpDegradedRttFloorUs) ||
+               retransmits > TcpDegradedRetransmits;
+}
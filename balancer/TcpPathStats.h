@@ -0,0 +1,31 @@
+#ifndef NETUTILS_TCP_PATH_STATS_H
+#define NETUTILS_TCP_PATH_STATS_H
+
+#include <cstdint>
+#include <unordered_map>
+
+/**
+ * network path quality of one upstream from kernel TCP_INFO of its live sockets
+ * a socket is sampled when its first response byte arrives, at most once per TcpInfoSampleMilliseconds per upstream,
+ * so cost is one getsockopt per upstream per interval however busy the upstream is
+ * kernel values are already smoothed per socket, these average them across sockets
+ */
+struct TcpPathStats {
+    double srttUs{0};
+    double rttVarUs{0};
+    double cwnd{0};         // segments
+    double retransmits{0};  // segments a sampled socket retransmitted since its previous sample
+    double baseRttUs{0};    // lowest srtt seen, drifts up slowly so a changed path becomes the new baseline
+    uint64_t samples{0};
+    bool degraded{false};
+    bool reportedDegraded{false};  // state last logged
+
+    bool due(int64_t nowNs) const { return nowNs >= nextSampleNs; }
+    void sample(int fd, int64_t nowNs);
+
+private:
+    int64_t nextSampleNs{0};
+    std::unordered_map<int, uint32_t> lastTotalRetrans;  // by fd, pooled sockets are sampled many times
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include "LbConstants.h"
+#include "TrafficCapture.h"
+#include "Utils.h"
+
+/**
+ * truncate path and write header, ring rounded up to power of two
+ */
+bool TrafficCapture::open(const std::string& path, size_t ringBytes, double sampleRatio_, int64_t nowNs) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    CaptureFileHeader header;
+    header.startWallNs = wall_nanos();
+    if (write(fd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header))) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    size_t capacity = 1;
+    while (capacity < ringBytes) capacity <<= 1;
+    ring.resize(capacity);
+    mask = capacity - 1;
+    sampleRatio = sampleRatio_;
+    startNs = nowNs;
+    writer = std::thread(&TrafficCapture::write_loop, this);
+    return true;
+}
+
+/**
+ * writer drains what is left before file is closed
+ */
+void TrafficCapture::close() {
+    if (writer.joinable()) {
+        stopping.store(true, std::memory_order_release);
+        writer.join();
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+void TrafficCapture::copy_in(size_t at, const void* data, size_t length) {
+    size_t begin = at & mask;
+    size_t first = std::min(length, ring.size() - begin);
+    memcpy(ring.data() + begin, data, first);
+    memcpy(ring.data(), static_cast<const char*>(data) + first, length - first);
+}
+
+void TrafficCapture::append(uint32_t clientIp, uint8_t flags, const char* data, size_t length, int64_t nowNs) {
+    static const char zeros[8]{};
+    if (failed.load(std::memory_order_relaxed)) return;
+    length = std::min(length, MaxCaptureRequestBytes);
+    CaptureRecord record;
+    record.length = static_cast<uint32_t>(length);
+    record.size = static_cast<uint32_t>(sizeof(record) + ((length + 7) & ~static_cast<size_t>(7)));
+    record.offsetNs = nowNs - startNs;
+    record.clientIp = clientIp;
+    record.flags = flags;
+
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h + record.size - cachedTail > ring.size()) {
+        cachedTail = tail.load(std::memory_order_acquire);
+        if (h + record.size - cachedTail > ring.size()) {
+            ++dropped;
+            return;
+        }
+    }
+    copy_in(h, &record, sizeof(record));
+    copy_in(h + sizeof(record), data, length);
+    copy_in(h + sizeof(record) + length, zeros, record.size - sizeof(record) - length);
+    head.store(h + record.size, std::memory_order_release);
+    ++captured;
+}
+
+/**
+ * records start 8 byte aligned in a power of two ring, so size field never wraps
+ */
+uint64_t TrafficCapture::count_records(size_t from, size_t to) const {
+    uint64_t count = 0;
+    for (size_t at = from; at < to; ++count) {
+        uint32_t size;
+        memcpy(&size, ring.data() + (at & mask), sizeof(size));
+        at += size;
+    }
+    return count;
+}
+
+/**
+ * published bytes written as one or two ranges ending on a record boundary, so file holds whole records up to tail
+ * on a failed write file is cut back to tail and capture stops, pending records are counted lost
+ * @return true if anything was pending
+ */
+bool TrafficCapture::drain() {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    if (t == h) return false;
+    if (failed.load(std::memory_order_relaxed)) {  // appended before producer saw capture stop
+        lost.fetch_add(count_records(t, h), std::memory_order_relaxed);
+        tail.store(h, std::memory_order_release);
+        return true;
+    }
+    size_t written = t;
+    while (written < h) {
+        size_t begin = written & mask;
+        size_t length = std::min(h - written, ring.size() - begin);
+        ssize_t ret = write(fd, ring.data() + begin, length);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) {
+            writeFailures.fetch_add(1, std::memory_order_relaxed);
+            if (ftruncate(fd, static_cast<off_t>(sizeof(CaptureFileHeader) + t)) != 0) {
+                writeFailures.fetch_add(1, std::memory_order_relaxed);  // torn record left, reader stops at it
+            }
+            lost.fetch_add(count_records(t, h), std::memory_order_relaxed);
+            failed.store(true, std::memory_order_relaxed);
+            written = h;
+            break;
+        }
+        written += ret;
+    }
+    tail.store(written, std::memory_order_release);
+    return true;
+}
+
+void TrafficCapture::write_loop() {
+    while (true) {
+        bool stop = stopping.load(std::memory_order_acquire);
+        if (drain()) continue;
+        if (stop) break;
+        usleep(CaptureWriterIdleMicros);
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef NETUTILS_TRAFFIC_CAPTURE_H
+#define NETUTILS_TRAFFIC_CAPTURE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum CaptureFlag : uint8_t {
+    CaptureFirstChunk = 1,  // first bytes of a non l7 link, may end inside a request or hold more than one
+};
+
+/**
+ * one captured request, payload of length bytes follows padded to 8 bytes, readers step over records by size
+ */
+struct CaptureRecord {
+    uint32_t size{0};      // record header plus padded payload
+    uint32_t length{0};    // request bytes in payload
+    int64_t offsetNs{0};   // since capture started, replay keeps these gaps
+    uint32_t clientIp{0};  // ipv4 in network order
+    uint8_t flags{0};      // CaptureFlag
+    uint8_t reserved[3]{};
+};
+static_assert(sizeof(CaptureRecord) == 24, "capture record layout is part of file format");
+
+/**
+ * starts every capture file, file is truncated on open so offsets of one file share one start
+ */
+struct CaptureFileHeader {
+    char magic[4]{'L', 'B', 'C', 'P'};
+    uint16_t version{1};
+    uint16_t recordSize{sizeof(CaptureRecord)};
+    int64_t startWallNs{0};
+};
+
+/**
+ * sampled client requests copied into a single producer single consumer byte ring on event loop thread,
+ * a writer thread drains ring into file, a request finding ring full is dropped and counted, never waited for
+ * only whole records are published so file always ends on a record boundary,
+ * a failed write stops capture and cuts file back to last whole record
+ */
+struct TrafficCapture {
+    uint64_t captured{0};
+    uint64_t dropped{0};
+    std::atomic<uint64_t> writeFailures{0};
+    std::atomic<uint64_t> lost{0};  // published but not on file because of a write failure
+
+    TrafficCapture() = default;
+    TrafficCapture(const TrafficCapture&) = delete;
+    TrafficCapture& operator=(const TrafficCapture&) = delete;
+    ~TrafficCapture() { close(); }
+
+    bool open(const std::string& path, size_t ringBytes, double sampleRatio, int64_t nowNs);
+    void close();
+    bool enabled() const { return fd >= 0; }
+    bool stopped() const { return failed.load(std::memory_order_relaxed); }
+
+    /**
+     * spreads sampled requests evenly, ratio 0.25 takes every 4th
+     */
+    bool sample() {
+        credit += sampleRatio;
+        if (credit < 1) return false;
+        credit -= 1;
+        return true;
+    }
+    void append(uint32_t clientIp, uint8_t flags, const char* data, size_t length, int64_t nowNs);
+
+private:
+    int fd{-1};
+    std::vector<char> ring;
+    size_t mask{0};
+    double sampleRatio{1};
+    double credit{0};
+    int64_t startNs{0};
+    std::thread writer;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> failed{false};
+    char pad0[64];
+    std::atomic<size_t> head{0};
+    size_t cachedTail{0};  // producer's view of tail
+    char pad1[64];
+    std::atomic<size_t> tail{0};
+
+    void copy_in(size_t at, const void* data, size_t length);
+    uint64_t count_records(size_t from, size_t to) const;
+    void write_loop();
+    bool drain();
+};
+
+#endif
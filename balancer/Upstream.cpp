@@ -1,4 +1,8 @@
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
 #include <iostream>
+#include "CachedClock.h"
 #include "RawSocket.h"
 #include "Upstream.h"
 #include "Utils.h"
@@ -43,8 +47,37 @@ void Upstream::set_status(bool status) {
         if (good) {
             good = false;
         }
-        badTimestamp = time(nullptr);  // update bad time every time
+        badTimestamp = thread_clock().now();  // update bad time every time
     }
 }
 
 bool Upstream::is_host_match(const string& host_) { return endpoint == host_ || aliasedEndpoint == host_; }
+
+/**
+ * most recently parked connection first, a peek tells whether upstream closed it meanwhile
+ */
+int Upstream::take_idle() {
+    while (!idleFds.empty()) {
+        int fd = idleFds.back();
+        idleFds.pop_back();
+        char c;
+        ssize_t ret = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            ++reused;
+            return fd;
+        }
+        close(fd);  // closed by upstream, or unexpected bytes on an idle connection
+    }
+    return -1;
+}
+
+bool Upstream::put_idle(int fd) {
+    if (static_cast<int>(idleFds.size()) >= maxIdle) return false;
+    idleFds.push_back(fd);
+    return true;
+}
+
+void Upstream::close_idle() {
+    for (int fd : idleFds) close(fd);
+    idleFds.clear();
+}
@@ -4,9 +4,14 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <string>
+#include <vector>
+#include "ConcurrencyLimiter.h"
+#include "TcpPathStats.h"
 
 using namespace std;
 
+struct UpstreamMetrics;
+
 struct Upstream {
     string endpoint;
     string aliasedEndpoint;
@@ -15,11 +20,21 @@ struct Upstream {
     struct sockaddr_in serverAddr;
     bool good{true};
     time_t badTimestamp{0};
+    ConcurrencyLimiter limiter;
+    std::vector<int> idleFds;  // keep-alive connections parked between requests, not registered in epoll
+    int maxIdle{0};
+    uint64_t reused{0};
+    UpstreamMetrics* metrics{nullptr};  // slot in shard of reactor using this upstream
+    TcpPathStats path;
 
     Upstream(const string& endpoint_);
     bool check();
     void set_status(bool status);
     bool is_host_match(const string& host_);
+
+    int take_idle();
+    bool put_idle(int fd);
+    void close_idle();
 };
 
 #endif
@@ -6,6 +6,27 @@ p3 PostServer.py 18123
 ./balancer/balancer -p 18180 -u localhost:18121,localhost:18122,localhost:18123
 ./balancer/balancer -p 18180 -u 192.168.2.101:18121,192.168.2.101:18122,192.168.2.101:18123
 ./balancer/balancer -m random -p 18180 -u 192.168.2.101:18121,192.168.2.101:18122,192.168.2.101:18123
+./balancer/balancer -p 18180 --limiter gradient --limit-init 20 -u localhost:18121,localhost:18122,localhost:18123
+./balancer/balancer -m random --l7 -p 18180 -u localhost:18121,localhost:18122,localhost:18123
+./balancer/balancer -m random --l7 --cache-bytes 67108864 -p 18180 -u localhost:18121,localhost:18122,localhost:18123
+./balancer/balancer -m random --l7 --forwarded-for --request-id --set-header "X-Env: prod" -p 18180 -u localhost:18121,localhost:18122,localhost:18123
+./balancer/balancer -m random --l7 -p 18180 -u localhost:18121 --pool "api random localhost:18122,localhost:18123" --route "/api/* -> api" --route "/api/v2/* X-Version=2 -> api"
+./balancer/balancer -m random --l7 -p 18180 -u localhost:18121,localhost:18122 --access-log /tmp/lb.access
+./lblog/lblog /tmp/lb.access --event done --agg upstream
+# prometheus metrics
+./balancer/balancer -m random --l7 -p 18180 -u localhost:18121,localhost:18122 --admin-port 18190
+curl localhost:18190/metrics
+# live view through shared memory
+./balancer/balancer -m random --l7 -p 18180 -u localhost:18121,localhost:18122 --stats-shm /lb_18180
+./lbtop/lbtop /lb_18180
+# link lifecycle traces, slow ones logged in full, ring dumped to log on SIGUSR1 or served on admin port
+./balancer/balancer -m random --l7 -p 18180 -u localhost:18121,localhost:18122 --admin-port 18190 --trace-slow-ms 200
+kill -USR1 $(pidof balancer)
+curl localhost:18190/traces
+
+# capture a tenth of requests, replay them at twice recorded rate over 32 connections
+./balancer/balancer -m random --l7 -p 18180 -u localhost:18121,localhost:18122 --capture /tmp/lb.capture --capture-sample 0.1
+./replay/replay /tmp/lb.capture -t localhost:18180 -s 2 -c 32
 
 nohup /home/kun/github/NetUtils/cmake-build-debug/balancer/balancer -p 18180 -u localhost:18121,localhost:18122,localhost:18123 2>&1 > /tmp/lb.kun.log &
 
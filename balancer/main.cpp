@@ -27,6 +27,10 @@ void on_signal(int sig) {
     cout << "recv signal:" << signo << " going to shutdown system gracefully" << endl;
 }
 
+void on_dump_signal(int) {
+    if (manager) manager->traceDumpRequested.store(true, std::memory_order_relaxed);
+}
+
 void clear(bool force) {
     if (manager) {
         if (force) {
@@ -51,6 +55,7 @@ void serve_forever() {
     signo = 0;
     signal(SIGINT, on_signal);
     signal(SIGTERM, on_signal);
+    signal(SIGUSR1, on_dump_signal);
 
     usleep(1000 * 1000);  // wait for manager thread up
     while (true) {
@@ -79,17 +84,56 @@ void serve_forever() {
 }
 
 int main(int argc, char *argv[]) {
-    uint16_t listenPort;
-    string upstreams;
+    LbConfig config;
     string method;
+    string limiter;
+    string failoverStatuses;
     string logPrefix;
+    string logOverflow;
+    size_t logRingRecords;
+    vector<string> setHeaders;
     po::options_description desc("Program options");
     desc.add_options()
     ("help,h", "listen on port and direct request to upstream server")
-    ("port,p", po::value<uint16_t>(&listenPort)->default_value(8081), "port to listen")
-    ("upstreams,u", po::value<string>(&upstreams)->default_value("localhost:8080"), "upstream servers for load balance")
+    ("port,p", po::value<uint16_t>(&config.listenPort)->default_value(8081), "port to listen")
+    ("upstreams,u", po::value<string>(&config.upstreamHosts)->default_value("localhost:8080"), "upstream servers for load balance")
     ("method,m", po::value<string>(&method)->default_value("ip_hashed"), "method to load balance (ip_hashed|random)")
-    ("log,l", po::value<string>(&logPrefix)->default_value("/tmp/rolling.log."), "create log file with this prefix");
+    ("log,l", po::value<string>(&logPrefix)->default_value("/tmp/rolling.log."), "create log file with this prefix")
+    ("admin-port", po::value<uint16_t>(&config.adminPort)->default_value(0), "serve prometheus metrics on GET /metrics of this port, 0 to disable")
+    ("stats-shm", po::value<string>(&config.statsShmName), "publish live stats into this posix shared memory segment (e.g. /lb_18180) for lbtop")
+    ("loop-busy-warn", po::value<double>(&config.loopBusyWarnRatio)->default_value(DefaultLoopBusyWarnRatio), "warn in log when reactor spent this share of a stats interval handling events, 0 to disable")
+    ("heavy-hitters", po::value<size_t>(&config.heavyHitters)->default_value(DefaultHeavyHitters), "client ips tracked as top by links and by bytes per minute, logged and served by GET /clients on admin port, 0 to disable")
+    ("trace-ring", po::value<size_t>(&config.traceRingSize)->default_value(DefaultTraceRingSize), "finished link lifecycle traces kept in memory, dumped to log on SIGUSR1 or by GET /traces on admin port, 0 to disable")
+    ("trace-slow-ms", po::value<int>(&config.traceSlowMs)->default_value(0), "log full trace of every link with a request slower than this, 0 to disable")
+    ("avoid-degraded", po::bool_switch(&config.avoidDegraded), "skip upstreams whose sampled tcp rtt or retransmits show a degraded path, unless all are degraded")
+    ("access-log", po::value<string>(&config.accessLogPath), "append binary access records to this file instead of text open/done/leave lines, decode with lblog")
+    ("capture", po::value<string>(&config.capturePath), "write sampled client requests with their timing to this file for replay, truncated on start")
+    ("capture-sample", po::value<double>(&config.captureSample)->default_value(1), "share of requests captured, 0.01 takes every 100th")
+    ("capture-ring-bytes", po::value<size_t>(&config.captureRingBytes)->default_value(DefaultCaptureRingBytes), "capture buffer between event loop and file writer thread, requests finding it full are dropped")
+    ("log-overflow", po::value<string>(&logOverflow)->default_value("drop"), "log lines go through per thread ring to writer thread, on full ring drop and count them or block, sync writes on caller thread")
+    ("log-ring", po::value<size_t>(&logRingRecords)->default_value(DefaultLogRingRecords), "records of per thread log ring")
+    ("limiter", po::value<string>(&limiter)->default_value("none"), "adaptive concurrency limit per upstream (none|aimd|gradient)")
+    ("limit-init", po::value<int>(&config.initialConcurrencyLimit)->default_value(DefaultInitialConcurrencyLimit), "initial concurrency limit per upstream")
+    ("limit-min", po::value<int>(&config.minConcurrencyLimit)->default_value(DefaultMinConcurrencyLimit), "min concurrency limit per upstream")
+    ("limit-max", po::value<int>(&config.maxConcurrencyLimit)->default_value(DefaultMaxConcurrencyLimit), "max concurrency limit per upstream")
+    ("client-rate", po::value<double>(&config.clientRatePerSecond)->default_value(0), "connections per second allowed per client ip, 0 means unlimited")
+    ("client-burst", po::value<double>(&config.clientRateBurst)->default_value(0), "burst allowed per client ip, 0 means same as client-rate")
+    ("client-table-log2", po::value<int>(&config.clientRateTableSizeLog2)->default_value(DefaultClientRateTableSizeLog2), "log2 of client ip slots tracked by rate limiter")
+    ("retry-ratio", po::value<double>(&config.retryBudgetRatio)->default_value(DefaultRetryBudgetRatio), "retries allowed per successful request")
+    ("retry-floor", po::value<double>(&config.retryBudgetFloorPerSecond)->default_value(DefaultRetryBudgetFloorPerSecond), "retries allowed per second regardless of traffic")
+    ("retry-max", po::value<double>(&config.retryBudgetMaxTokens)->default_value(DefaultRetryBudgetMaxTokens), "max retries saved up in budget")
+    ("failover-status", po::value<string>(&failoverStatuses)->default_value(DefaultFailoverStatuses), "upstream response status retried on other upstream, empty to disable")
+    ("request-timeout-ms", po::value<int>(&config.requestTimeoutMs)->default_value(0), "request deadline until first response byte, answer 504 when exceeded, 0 to disable, l7 mode only")
+    ("deadline-header", po::value<string>(&config.deadlineHeader)->default_value(DefaultDeadlineHeader), "header carrying request timeout from client, remaining budget forwarded to upstream in it, l7 mode only")
+    ("forwarded-for", po::bool_switch(&config.forwardedFor), "append client address to X-Forwarded-For of each request, l7 mode only")
+    ("request-id", po::bool_switch(&config.requestId), "add generated X-Request-Id to requests without one, l7 mode only")
+    ("set-header", po::value<vector<string>>(&setHeaders), "\"Name: value\" added to each request replacing client one, may repeat, l7 mode only")
+    ("pool", po::value<vector<string>>(&config.pools), "\"name ip_hashed|random host:port,host:port\" upstream pool for routes, may repeat")
+    ("route", po::value<vector<string>>(&config.routes), "\"/exact|/prefix* [Header~contains|Header=equals] -> pool\", may repeat, unmatched requests go to upstreams")
+    ("l7", po::bool_switch(&config.l7Mode), "pick upstream per request on keep-alive client connections")
+    ("max-idle", po::value<int>(&config.maxIdlePerUpstream)->default_value(DefaultMaxIdlePerUpstream), "idle connections pooled per upstream in l7 mode")
+    ("cache-bytes", po::value<size_t>(&config.cacheBytes)->default_value(0), "memory for cached GET responses in l7 mode, 0 to disable")
+    ("cache-vary", po::value<string>(&config.cacheVaryHeaders)->default_value(DefaultCacheVaryHeaders), "request headers taken into cache key, comma separated");
 
     po::variables_map vm;
     auto parsed = po::parse_command_line(argc, argv, desc);
@@ -102,23 +146,65 @@ int main(int argc, char *argv[]) {
     }
 
     RollingLog logger(logPrefix);
+    if (logOverflow == "block") {
+        logger.start_async(LogOverflow::Block, logRingRecords);
+    } else if (logOverflow != "sync") {
+        logger.start_async(LogOverflow::Drop, logRingRecords);
+    }
+    ostream &log = *logger.update();
+    log << "log overflow " << logOverflow << endl;
 
     if (method == "random") {
         policy = LbPolicy::RANDOMED;
-        *logger.ofs << "lb policy use random method" << endl;
+        log << "lb policy use random method" << endl;
     } else {
         policy = LbPolicy::IP_HASHED;
-        *logger.ofs << "lb policy use ip hashed method" << endl;
+        log << "lb policy use ip hashed method" << endl;
+    }
+
+    if (limiter == "aimd") {
+        config.limiterAlgorithm = LimiterAlgorithm::AIMD;
+    } else if (limiter == "gradient") {
+        config.limiterAlgorithm = LimiterAlgorithm::GRADIENT;
+    } else if (limiter == "none") {
+        config.limiterAlgorithm = LimiterAlgorithm::NONE;
+    } else {
+        cerr << "unknown limiter " << limiter << ", expect none|aimd|gradient" << endl;
+        return -1;
+    }
+    log << "concurrency limiter " << limiter << endl;
+    config.set_failover_statuses(failoverStatuses);
+    for (const auto &line : setHeaders) config.add_set_header(line);
+    if (!config.l7Mode && config.injects_headers()) {
+        // without l7 only first request of a keep-alive link is seen, later ones would pass with client headers
+        log << "inject headers needs l7 mode, disabled" << endl;
+        config.forwardedFor = false;
+        config.requestId = false;
+        config.setHeaders.clear();
+    }
+    if (config.injects_headers()) {
+        log << "inject headers forwarded-for " << config.forwardedFor << " request-id " << config.requestId
+            << " set " << config.setHeaders.size() << endl;
+    }
+    if (config.l7Mode) log << "l7 mode, max idle per upstream " << config.maxIdlePerUpstream << endl;
+    if (!config.l7Mode && (config.requestTimeoutMs > 0 || !config.deadlineHeader.empty())) {
+        // without l7 only first request of a keep-alive link is seen, later ones would pass without deadline
+        if (config.requestTimeoutMs > 0) log << "request timeout needs l7 mode, disabled" << endl;
+        config.requestTimeoutMs = 0;
+        config.deadlineHeader.clear();
+    }
+    if (config.l7Mode && config.cacheBytes > 0) {
+        log << "response cache " << config.cacheBytes << " bytes, vary on " << config.cacheVaryHeaders << endl;
     }
 
     if (policy == LbPolicy::IP_HASHED)
-        manager = new LbManager<LbPolicy::IP_HASHED>(listenPort, upstreams, logger);
+        manager = new LbManager<LbPolicy::IP_HASHED>(config, logger);
     else
-        manager = new LbManager<LbPolicy::RANDOMED>(listenPort, upstreams, logger);
+        manager = new LbManager<LbPolicy::RANDOMED>(config, logger);
 
     if (manager->startup()) {
         pthread_create(&(manager->thread), nullptr, &proc, manager);  // remember to pthread_join
-        *logger.ofs << "manager localhost:" << listenPort << " <--> " << upstreams << endl;
+        log << "manager localhost:" << config.listenPort << " <--> " << config.upstreamHosts << endl;
     } else {
         cerr << "manager start up failed " << endl;
         return -1;
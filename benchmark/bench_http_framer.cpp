@@ -0,0 +1,182 @@
+/**
+ * HttpFramer: split and mutation fuzzing first, then throughput per framing kind
+ * a streaming framer must reach the same verdict however the bytes are split across recvs,
+ * so every message is fed whole and in random pieces, also after random byte mutations
+ */
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "HttpFramer.h"
+
+using namespace std;
+
+namespace {
+
+struct Sample {
+    const char* name;
+    HttpFramer::Direction direction;
+    bool noBody;
+    string message;
+};
+
+string chunked_body(int chunks, int chunkSize) {
+    string body;
+    char size[32];
+    snprintf(size, sizeof(size), "%x;ext=1\r\n", chunkSize);
+    for (int i = 0; i < chunks; ++i) {
+        body += size;
+        body += string(chunkSize, 'c');
+        body += "\r\n";
+    }
+    body += "0\r\nX-Checksum: 42\r\nX-Trace: done\r\n\r\n";
+    return body;
+}
+
+vector<Sample> samples() {
+    vector<Sample> result;
+    result.push_back({"request get", HttpFramer::Request, false,
+                      "GET /api/v1/strategy?id=1 HTTP/1.1\r\nHost: lb\r\nUser-Agent: python-requests/2.22\r\n\r\n"});
+    result.push_back({"request content-length", HttpFramer::Request, false,
+                      "POST /api/v1/async_query_ticket HTTP/1.1\r\nHost: lb\r\nContent-Length: 24\r\n\r\n"
+                      "{\"host\":\"10.0.0.1:8080\"}"});
+    result.push_back({"request chunked", HttpFramer::Request, false,
+                      "POST /upload HTTP/1.1\r\nHost: lb\r\nTransfer-Encoding: chunked\r\n\r\n" + chunked_body(4, 100)});
+    result.push_back({"response content-length", HttpFramer::Response, false,
+                      "HTTP/1.1 200 OK\r\nServer: test\r\nContent-Length: 4096\r\n\r\n" + string(4096, 'b')});
+    result.push_back({"response interim", HttpFramer::Response, false,
+                      "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 201 Created\r\nContent-Length: 2\r\n\r\nok"});
+    result.push_back({"response chunked", HttpFramer::Response, false,
+                      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nConnection: keep-alive\r\n\r\n" +
+                          chunked_body(64, 1024)});
+    result.push_back({"response head", HttpFramer::Response, true,
+                      "HTTP/1.1 200 OK\r\nContent-Length: 4096\r\n\r\n"});
+    result.push_back({"response no content", HttpFramer::Response, false, "HTTP/1.1 204 No Content\r\n\r\n"});
+    return result;
+}
+
+/**
+ * heads other parsers may frame differently, framer must find them bad however they are split
+ */
+vector<Sample> malformed() {
+    vector<Sample> result;
+    result.push_back({"request line without colon", HttpFramer::Request, false,
+                      "POST / HTTP/1.1\r\nHost: lb\r\nNoColon\r\nContent-Length: 5\r\n\r\nhello"});
+    result.push_back({"request space before colon", HttpFramer::Request, false,
+                      "POST / HTTP/1.1\r\nHost: lb\r\nContent-Length : 5\r\n\r\nhello"});
+    result.push_back({"request folded line", HttpFramer::Request, false,
+                      "POST / HTTP/1.1\r\nHost: lb\r\n Content-Length: 5\r\n\r\nhello"});
+    result.push_back({"request content-length and chunked", HttpFramer::Request, false,
+                      "POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n"});
+    result.push_back({"response line without colon", HttpFramer::Response, false,
+                      "HTTP/1.1 200 OK\r\nNoColon\r\nContent-Length: 2\r\n\r\nok"});
+    return result;
+}
+
+struct Verdict {
+    int consumed;
+    HttpFramer::State state;
+    int status;
+    bool keepAlive;
+    int64_t bodyBytes;
+
+    bool operator==(const Verdict& o) const {
+        return consumed == o.consumed && state == o.state && status == o.status && keepAlive == o.keepAlive &&
+               bodyBytes == o.bodyBytes;
+    }
+};
+
+Verdict frame(const Sample& sample, const string& bytes, const vector<int>& cuts) {
+    HttpFramer framer;
+    framer.reset(sample.direction, sample.noBody);
+    int consumed = 0;
+    int begin = 0;
+    for (size_t i = 0; i <= cuts.size(); ++i) {
+        int end = i < cuts.size() ? cuts[i] : static_cast<int>(bytes.size());
+        int n = framer.feed(bytes.data() + begin, end - begin);
+        if (n < 0 || n > end - begin) return {-1, HttpFramer::Bad, 0, false, 0};
+        consumed += n;
+        if (n < end - begin) break;  // message ended inside this piece
+        begin = end;
+    }
+    return {consumed, framer.state, framer.status, framer.keepAlive, framer.bodyBytes};
+}
+
+vector<int> random_cuts(mt19937& rng, int length) {
+    vector<int> cuts;
+    uniform_int_distribution<int> step(1, 64);
+    for (int pos = step(rng); pos < length; pos += step(rng)) cuts.push_back(pos);
+    return cuts;
+}
+
+int fuzz(int rounds) {
+    mt19937 rng(20191231);
+    int failures = 0;
+    for (const Sample& sample : samples()) {
+        Verdict whole = frame(sample, sample.message, {});
+        if (whole.state != HttpFramer::Done || whole.consumed != static_cast<int>(sample.message.size())) {
+            cout << "FAIL " << sample.name << " not framed to its end, consumed " << whole.consumed << endl;
+            ++failures;
+        }
+        string pipelined = sample.message + sample.message;  // second message must not be consumed
+        if (!(frame(sample, pipelined, random_cuts(rng, static_cast<int>(pipelined.size()))) == whole)) {
+            cout << "FAIL " << sample.name << " pipelined" << endl;
+            ++failures;
+        }
+
+        for (int round = 0; round < rounds; ++round) {
+            string bytes = sample.message;
+            int mutations = round % 4;  // round 0 of each four is split only
+            for (int m = 0; m < mutations; ++m) {
+                bytes[rng() % bytes.size()] = static_cast<char>(rng() & 0xff);
+            }
+            Verdict expected = frame(sample, bytes, {});
+            Verdict split = frame(sample, bytes, random_cuts(rng, static_cast<int>(bytes.size())));
+            if (!(split == expected)) {
+                cout << "FAIL " << sample.name << " round " << round << " split verdict differs" << endl;
+                ++failures;
+                break;
+            }
+        }
+    }
+    for (const Sample& sample : malformed()) {
+        Verdict whole = frame(sample, sample.message, {});
+        Verdict split = frame(sample, sample.message, random_cuts(rng, static_cast<int>(sample.message.size())));
+        if (whole.state != HttpFramer::Bad || !(split == whole)) {
+            cout << "FAIL " << sample.name << " not found bad, consumed " << whole.consumed << endl;
+            ++failures;
+        }
+    }
+    cout << "fuzz " << rounds << " rounds per sample, failures " << failures << endl;
+    return failures;
+}
+
+void throughput(int iterations) {
+    vector<Sample> all = samples();
+    for (const Sample& sample : malformed()) all.push_back(sample);
+    for (const Sample& sample : all) {
+        HttpFramer framer;
+        int64_t sink = 0;
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            framer.reset(sample.direction, sample.noBody);
+            sink += framer.feed(sample.message.data(), static_cast<int>(sample.message.size()));
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        double bytes = static_cast<double>(sample.message.size()) * iterations;
+        cout << sample.name << " " << sample.message.size() << " bytes, " << bytes / seconds / (1 << 20) << " MB/s, "
+             << seconds / iterations * 1e9 << " ns/message" << (sink == 0 ? " (no bytes framed)" : "") << endl;
+    }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+    int iterations = argc > 2 ? atoi(argv[2]) : 100000;
+    int failures = fuzz(rounds);
+    throughput(iterations);
+    return failures == 0 ? 0 : 1;
+}
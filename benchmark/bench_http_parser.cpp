@@ -0,0 +1,135 @@
+/**
+ * microbenchmark: request header parse as done in LbLink::parse_client_content, request arriving in several recvs
+ * legacy: fresh parser per recv, rescans from byte 0 with strchr and copies every header into a map
+ * current: one resumable HttpParser per link, fed with appended length
+ */
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include "HttpParser.h"
+
+using namespace std;
+
+namespace {
+
+const char* const Request =
+    "POST /api/v1/async_query_ticket HTTP/1.1\r\n"
+    "Host: 192.168.2.101:18180\r\n"
+    "User-Agent: python-requests/2.22.0\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept: */*\r\n"
+    "Connection: keep-alive\r\n"
+    "X-Request-Timeout-Ms: 5000\r\n"
+    "X-Forwarded-For: 10.1.2.3\r\n"
+    "Cookie: session=8f2d9c1b7a6e4f3d2c1b0a9f8e7d6c5b; theme=dark\r\n"
+    "Content-Length: 48\r\n"
+    "Content-Type: application/json\r\n"
+    "\r\n"
+    "{\"type\": \"query\", \"ticket\": \"42\", \"host\": \"x\"}";
+
+/**
+ * copy of HttpParser header parsing before it became resumable
+ */
+struct LegacyHttpParser {
+    char* msg{nullptr};
+    char* endChar{nullptr};
+    int len{0};
+    int methodEndPos{-1};
+    int headerEndPos{-1};
+    std::unordered_map<std::string, std::string> keyValues;
+
+    LegacyHttpParser(char* const msg_, int len_) : msg(msg_), len(len_) {
+        if (len) endChar = msg + len;
+    }
+
+    void parse_method() {
+        if (len > 0) {
+            char* itr = strchr(msg, '\n');
+            if (itr != nullptr) methodEndPos = static_cast<int>(itr - msg);
+        }
+    }
+
+    void parse_header() {
+        if (methodEndPos >= 0 and methodEndPos + 1 < len) {
+            char* itr = msg + methodEndPos + 1;
+            char* prevItr = itr;
+            while (itr < endChar) {
+                itr = strchr(itr, '\n');
+                if (itr == nullptr) break;
+                int pos = static_cast<int>(itr - msg);
+
+                string header(prevItr, (itr - prevItr) - 1);
+                size_t posColon = header.find_first_of(':', 0);
+                if (posColon != string::npos) {
+                    if (posColon + 2 < header.size()) keyValues[header.substr(0, posColon)] = header.substr(posColon + 2);
+                }
+                ++itr;
+                prevItr = itr;
+                if ((itr + 1) < endChar && *itr == '\r' && *(itr + 1) == '\n') {
+                    headerEndPos = pos + 2;
+                    break;
+                }
+            }
+        }
+    }
+
+    string get_header(const string& key) {
+        auto itr = keyValues.find(key);
+        return itr != keyValues.end() ? itr->second : "";
+    }
+};
+
+template <typename F>
+double measure_ns(int iterations, F&& f) {
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) f();
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / iterations;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+    int chunks = argc > 2 ? atoi(argv[2]) : 3;  // recvs the request arrives in
+
+    char buffer[2048 + 1];
+    int length = static_cast<int>(strlen(Request));
+    memcpy(buffer, Request, length);
+    size_t sink = 0;
+
+    double legacy = measure_ns(iterations, [&]() {
+        for (int c = 1; c <= chunks; ++c) {
+            int received = length * c / chunks;
+            char next = buffer[received];
+            buffer[received] = '\0';
+            LegacyHttpParser parser(buffer, received);
+            parser.parse_method();
+            if (parser.methodEndPos > 0) parser.parse_header();
+            buffer[received] = next;  // next recv overwrites terminator
+            if (parser.headerEndPos > 0) {
+                sink += parser.get_header("User-Agent").size();
+                break;
+            }
+        }
+    });
+
+    double current = measure_ns(iterations, [&]() {
+        HttpParser parser(buffer, 0);
+        for (int c = 1; c <= chunks; ++c) {
+            parser.update_length(length * c / chunks);
+            parser.parse();
+            if (parser.has_complete_header()) {
+                sink += parser.get_header(HttpHeaderId::UserAgent).size();
+                break;
+            }
+        }
+    });
+
+    cout << "request " << length << " bytes in " << chunks << " recvs, " << iterations << " iterations" << endl;
+    cout << "legacy  HttpParser " << legacy << " ns/request" << endl;
+    cout << "current HttpParser " << current << " ns/request, speedup " << legacy / current << "x" << endl;
+    return sink == 0 ? 1 : 0;
+}
@@ -0,0 +1,76 @@
+/**
+ * microbenchmark: cycles per byte of header line scanning (LF, colon, invalid bytes) per implementation
+ * input is a realistic request header block scanned line by line as HttpParser does
+ */
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "HttpScanner.h"
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+const char* const Headers =
+    "POST /api/v1/strategy/async_query_ticket?account=10086&mode=full HTTP/1.1\r\n"
+    "Host: 192.168.2.101:18180\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/79.0.3945.88\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,image/apng,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: en-US,en;q=0.9,zh-CN;q=0.8,zh;q=0.7\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: session=8f2d9c1b7a6e4f3d2c1b0a9f8e7d6c5b; theme=dark; _ga=GA1.2.1234567890.1577836800\r\n"
+    "X-Request-Timeout-Ms: 5000\r\n"
+    "X-Forwarded-For: 10.1.2.3, 10.4.5.6\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 48\r\n"
+    "\r\n";
+
+uint64_t cycles() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+double cycles_per_byte(HttpScanLineFn fn, const char* begin, int length, int iterations, size_t& sink) {
+    const char* end = begin + length;
+    uint64_t start = cycles();
+    for (int i = 0; i < iterations; ++i) {
+        const char* p = begin;
+        HttpLineScan scan;
+        while (p < end) {
+            fn(p, end, scan);
+            if (scan.lineEnd < 0) break;
+            sink += scan.colon;
+            p += scan.lineEnd + 1;
+        }
+    }
+    return static_cast<double>(cycles() - start) / (static_cast<double>(length) * iterations);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+    int length = static_cast<int>(strlen(Headers));
+    size_t sink = 0;
+
+    cout << "header block " << length << " bytes, dispatch picks " << http_scanner_name() << endl;
+    cout << "scalar " << cycles_per_byte(http_scan_line_scalar, Headers, length, iterations, sink) << " cycles/byte"
+         << endl;
+#if defined(__x86_64__)
+    cout << "sse2   " << cycles_per_byte(http_scan_line_sse2, Headers, length, iterations, sink) << " cycles/byte" << endl;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        cout << "avx2   " << cycles_per_byte(http_scan_line_avx2, Headers, length, iterations, sink) << " cycles/byte"
+             << endl;
+    }
+#endif
+    return sink == 0 ? 1 : 0;
+}
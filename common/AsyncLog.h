@@ -0,0 +1,139 @@
+#ifndef NETUTILS_ASYNC_LOG_H
+#define NETUTILS_ASYNC_LOG_H
+
+#include <sched.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+
+constexpr size_t LogRecordSize = 256;            // longer lines span several records
+constexpr size_t DefaultLogRingRecords = 4096;   // per producing thread
+constexpr size_t LogWriterBatchBytes = 64 * 1024;
+constexpr int LogWriterIdleMicros = 1000;
+
+enum class LogOverflow {
+    Drop,   // ring full, line is formatted into a spare record and counted as dropped
+    Block,  // ring full, producer yields until writer frees a record
+};
+
+struct LogRecord {
+    uint16_t length;
+    char data[LogRecordSize - sizeof(uint16_t)];
+};
+
+/**
+ * single producer single consumer ring of preallocated records, neither side locks or allocates
+ * each side caches the other side's index and only reloads it when ring looks full or empty
+ */
+struct LogRing {
+    explicit LogRing(size_t capacity_) {
+        capacity = 1;
+        while (capacity < capacity_) capacity <<= 1;
+        mask = capacity - 1;
+        records = new LogRecord[capacity];
+    }
+    LogRing(const LogRing&) = delete;
+    LogRing& operator=(const LogRing&) = delete;
+    ~LogRing() { delete[] records; }
+
+    // producer side, same slot is returned until it is published
+    LogRecord* claim() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - cachedTail == capacity) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (h - cachedTail == capacity) return nullptr;
+        }
+        return &records[h & mask];
+    }
+    void publish() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // consumer side
+    const LogRecord* peek() {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == cachedHead) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (t == cachedHead) return nullptr;
+        }
+        return &records[t & mask];
+    }
+    void release() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+    LogRecord* records{nullptr};
+    size_t capacity{0};
+    size_t mask{0};
+    char pad0[64];
+    std::atomic<size_t> head{0};
+    size_t cachedTail{0};  // producer's view of tail
+    char pad1[64];
+    std::atomic<size_t> tail{0};
+    size_t cachedHead{0};  // consumer's view of head
+};
+
+/**
+ * ostream formats straight into claimed record, flush (std::endl) publishes it, so callers keep writing *os << ...
+ */
+struct LogStreamBuf : public std::streambuf {
+    LogStreamBuf(LogRing& ring_, LogOverflow overflow_, std::atomic<uint64_t>& dropped_)
+        : ring(ring_), overflowPolicy(overflow_), dropped(dropped_) {
+        commit();
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        commit();
+        if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+        return c;
+    }
+
+    int sync() override {
+        commit();
+        return 0;
+    }
+
+private:
+    LogRing& ring;
+    LogOverflow overflowPolicy;
+    std::atomic<uint64_t>& dropped;
+    LogRecord* record{nullptr};
+    LogRecord spare;  // formatting target while ring is full under drop policy
+
+    void commit() {
+        size_t length = pptr() - pbase();
+        if (length > 0) {
+            if (record == &spare) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                record->length = static_cast<uint16_t>(length);
+                ring.publish();
+            }
+        }
+        record = ring.claim();
+        while (record == nullptr && overflowPolicy == LogOverflow::Block) {
+            sched_yield();
+            record = ring.claim();
+        }
+        if (record == nullptr) record = &spare;
+        setp(record->data, record->data + sizeof(record->data));
+    }
+};
+
+/**
+ * log front end of one thread
+ */
+struct LogProducer {
+    std::thread::id thread;
+    LogRing ring;
+    LogStreamBuf buf;
+    std::ostream stream;
+
+    LogProducer(size_t ringRecords, LogOverflow overflow, std::atomic<uint64_t>& dropped)
+        : thread(std::this_thread::get_id()), ring(ringRecords), buf(ring, overflow, dropped), stream(&buf) {}
+};
+
+#endif
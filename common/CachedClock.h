@@ -0,0 +1,50 @@
+#ifndef NETUTILS_CACHED_CLOCK_H
+#define NETUTILS_CACHED_CLOCK_H
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include "Utils.h"
+
+/**
+ * clock read once per reactor loop iteration, everything stamped within that iteration shares it
+ * wall clock is the coarse one, good to a tick, and its second resolution text is only formatted when second changes
+ * monotonic clock stays fine grained, upstream latencies fed to limiters are often below a tick
+ * both are vDSO reads, no syscall either way
+ */
+struct CachedClock {
+    CachedClock() { update(); }
+
+    void update() {
+        struct timespec ts {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        monoNs = static_cast<int64_t>(ts.tv_sec) * 1000000000L + ts.tv_nsec;
+        clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        wallNs = static_cast<int64_t>(ts.tv_sec) * 1000000000L + ts.tv_nsec;
+        if (ts.tv_sec != seconds) {
+            seconds = ts.tv_sec;
+            text = time_t2string(seconds);
+        }
+    }
+
+    int64_t mono_ns() const { return monoNs; }
+    int64_t wall_ns() const { return wallNs; }
+    time_t now() const { return seconds; }
+    const std::string& now_string() const { return text; }  // same format as now_string()
+
+private:
+    int64_t monoNs{0};
+    int64_t wallNs{0};
+    time_t seconds{-1};
+    std::string text;
+};
+
+/**
+ * clock of calling thread, a reactor updates it each loop iteration and code running on that reactor reads it
+ */
+inline CachedClock& thread_clock() {
+    static thread_local CachedClock clock;
+    return clock;
+}
+
+#endif
@@ -35,6 +35,13 @@ void epoll_mod2in(int epollfd, int fd) {
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev);
 }
 
+void epoll_mod(int epollfd, int fd, uint32_t events) {
+    struct epoll_event ev {};
+    ev.data.fd = fd;
+    ev.events = events;
+    epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
 void epoll_delete(int epollfd, int fd) {
     struct epoll_event ev {};
     ev.data.fd = fd;
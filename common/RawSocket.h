@@ -12,6 +12,8 @@ void epoll_mod2both(int epollfd, int fd);
 
 void epoll_mod2in(int epollfd, int fd);
 
+void epoll_mod(int epollfd, int fd, uint32_t events);
+
 void epoll_delete(int epollfd, int fd);
 
 int make_tcp_socket_server(char const *addrListen, uint16_t portListen);
@@ -1,17 +1,34 @@
 #ifndef NETUTILS_ROLLINGLOG_H
 #define NETUTILS_ROLLINGLOG_H
 
+#include <unistd.h>
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "AsyncLog.h"
+#include "CachedClock.h"
 #include "Utils.h"
 
+/**
+ * log file rotated by time, written synchronously by caller until start_async
+ * after that each thread formats into its own ring via update() and a writer thread batches rings into the file
+ * lines of one thread keep their order, lines of different threads may interleave by batch
+ */
 struct RollingLog {
     std::ofstream* ofs{nullptr};
-    double ts{-1};
-    double rollingInterval{1.0};
+    time_t ts{-1};                        // when current file was opened
+    time_t rollingSeconds{24 * 60 * 60};
     std::string logPrefix;
 
-    RollingLog(const std::string& logPrefix_ = "/tmp/rolling.log.") : logPrefix(logPrefix_) { update(); }
+    LogOverflow overflow{LogOverflow::Drop};
+    size_t ringRecords{DefaultLogRingRecords};
+    std::atomic<uint64_t> dropped{0};  // records lost to full rings
+
+    RollingLog(const std::string& logPrefix_ = "/tmp/rolling.log.") : logPrefix(logPrefix_) { rotate(); }
 
     void init(const std::string& logPrefix_) {
         logPrefix = logPrefix_;
@@ -19,21 +36,62 @@ struct RollingLog {
             delete ofs;
             ofs = nullptr;
         }
-        update();
+        rotate();
     }
 
     ~RollingLog() {
+        if (writer.joinable()) {
+            stopping.store(true, std::memory_order_release);
+            writer.join();
+        }
         if (ofs) {
             ofs->flush();
             delete ofs;
         }
     }
 
-    std::ofstream* update() {
-        std::string nowTsStr = now_string();
-        double nowTs = std::atof(nowTsStr.c_str());
+    void start_async(LogOverflow overflow_, size_t ringRecords_) {
+        if (writer.joinable()) return;
+        overflow = overflow_;
+        ringRecords = ringRecords_;
+        if (ofs) ofs->flush();
+        writer = std::thread(&RollingLog::write_loop, this);
+    }
+
+    bool async() const { return writer.joinable(); }
+
+    /**
+     * stream for calling thread, its pending partial line is published so heartbeat callers never sit on text
+     */
+    std::ostream* update() {
+        if (!async()) return rotate();
+
+        LogProducer* producer = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(producersMutex);
+            for (auto& item : producers) {
+                if (item->thread == std::this_thread::get_id()) producer = item.get();
+            }
+            if (producer == nullptr) {
+                producers.emplace_back(new LogProducer(ringRecords, overflow, dropped));
+                producer = producers.back().get();
+            }
+        }
+        producer->stream.flush();
+        return &producer->stream;
+    }
+
+private:
+    std::vector<std::unique_ptr<LogProducer>> producers;
+    std::mutex producersMutex;  // guards producers, only taken on registration and by writer to copy the list
+    std::thread writer;
+    std::atomic<bool> stopping{false};
 
-        if (ts < 0 || (nowTs - ts) > rollingInterval) {
+    std::ofstream* rotate() {
+        const CachedClock& clock = thread_clock();
+        const std::string& nowTsStr = clock.now_string();
+
+        if (ts < 0 || clock.now() - ts >= rollingSeconds) {
             if (ofs) {
                 ofs->flush();
                 delete ofs;
@@ -48,10 +106,58 @@ struct RollingLog {
             }
             *ofs << "open log " << logName << endl;
             std::cout << "open log " << logName << endl;
-            ts = nowTs;
+            ts = clock.now();
         }
         return ofs;
     }
+
+    void write_batch(std::string& batch) {
+        ofs->write(batch.data(), batch.size());
+        ofs->flush();
+        batch.clear();
+    }
+
+    /**
+     * drain every ring into one buffer written with few large writes, rotation only happens here once async
+     * producers are never removed, so list is copied under lock and rings drained and written without it
+     */
+    void write_loop() {
+        std::string batch;
+        batch.reserve(LogWriterBatchBytes);
+        std::vector<LogProducer*> draining;
+        uint64_t reportedDrops = 0;
+        while (true) {
+            thread_clock().update();
+            bool stop = stopping.load(std::memory_order_acquire);
+            {
+                std::lock_guard<std::mutex> lock(producersMutex);
+                draining.clear();
+                for (auto& producer : producers) draining.push_back(producer.get());
+            }
+            for (LogProducer* producer : draining) {
+                while (const LogRecord* record = producer->ring.peek()) {
+                    batch.append(record->data, record->length);
+                    producer->ring.release();
+                    if (batch.size() >= LogWriterBatchBytes) write_batch(batch);
+                }
+            }
+            uint64_t drops = dropped.load(std::memory_order_relaxed);
+            if (drops != reportedDrops) {
+                batch += thread_clock().now_string() + " log dropped " + std::to_string(drops - reportedDrops) +
+                         " records\n";
+                reportedDrops = drops;
+            }
+
+            if (!batch.empty()) {
+                write_batch(batch);
+            } else if (stop) {
+                break;
+            } else {
+                usleep(LogWriterIdleMicros);
+            }
+            rotate();
+        }
+    }
 };
 
 #endif
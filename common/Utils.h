@@ -2,6 +2,7 @@
 #define BEAUTY_UTILS_H
 
 #include <sys/epoll.h>
+#include <cstdint>
 #include <ctime>
 #include <iomanip>
 #include <sstream>
@@ -34,4 +35,22 @@ inline std::string now_string() {
     return time_t2string(tNow);
 }
 
+/**
+ * monotonic clock in nanoseconds, used for latency measurement
+ */
+inline int64_t steady_nanos() {
+    struct timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * wall clock in nanoseconds since epoch, used for log timestamps
+ */
+inline int64_t wall_nanos() {
+    struct timespec ts {};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000L + ts.tv_nsec;
+}
+
 #endif
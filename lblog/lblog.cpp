@@ -0,0 +1,391 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "AccessLog.h"
+#include "Utils.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+/**
+ * decode, filter and aggregate binary access logs written by balancer --access-log
+ * files are mapped and scanned record by record, nothing is parsed beyond fixed offsets
+ */
+
+enum class OutputFormat { Text, Csv, Json };
+enum class AggregateKey { None, Upstream, Client, Status, Reason, Event };
+
+struct Filter {
+    int event{0};
+    bool hasClient{false};
+    uint32_t clientIp{0};
+    bool hasUpstream{false};
+    uint32_t upstreamIp{0};
+    uint16_t upstreamPort{0};  // 0 matches any port
+    int status{0};
+    int reason{-1};
+    int64_t sinceNs{0};
+    int64_t untilNs{0};
+    int64_t slowerNs{0};
+
+    bool match(const AccessRecord& r) const {
+        if (event && r.event != event) return false;
+        if (hasClient && r.clientIp != clientIp) return false;
+        if (hasUpstream && (r.upstreamIp != upstreamIp || (upstreamPort && r.upstreamPort != upstreamPort))) {
+            return false;
+        }
+        if (status && r.status != status) return false;
+        if (reason >= 0 && r.closeReason != reason) return false;
+        if (sinceNs && r.timeNs < sinceNs) return false;
+        if (untilNs && r.timeNs >= untilNs) return false;
+        if (slowerNs && r.durationNs < slowerNs) return false;
+        return true;
+    }
+};
+
+struct Aggregate {
+    uint64_t count{0};
+    uint64_t clientBytes{0};
+    uint64_t serverBytes{0};
+    int64_t totalNs{0};
+    int64_t maxNs{0};
+};
+
+static int index_of(const char* const* names, int size, const string& name) {
+    for (int i = 0; i < size; ++i) {
+        if (name == names[i]) return i;
+    }
+    return -1;
+}
+
+/**
+ * yyyymmdd.hhmmss as written in text logs, local time
+ */
+static int64_t parse_time(const string& text) {
+    struct tm tm {};
+    if (strptime(text.c_str(), "%Y%m%d.%H%M%S", &tm) == nullptr) return -1;
+    tm.tm_isdst = -1;
+    return static_cast<int64_t>(mktime(&tm)) * 1000000000L;
+}
+
+static bool parse_ip(const string& text, uint32_t& ip) {
+    struct in_addr addr {};
+    if (inet_pton(AF_INET, text.c_str(), &addr) != 1) return false;
+    ip = addr.s_addr;
+    return true;
+}
+
+static char* format_endpoint(char* out, uint32_t ip, uint16_t port) {
+    if (ip == 0 && port == 0) return out + sprintf(out, "none");
+    struct in_addr addr {};
+    addr.s_addr = ip;
+    inet_ntop(AF_INET, &addr, out, INET_ADDRSTRLEN);
+    out += strlen(out);
+    return out + sprintf(out, ":%u", port);
+}
+
+static char* format_time(char* out, int64_t timeNs) {
+    string seconds = time_t2string(static_cast<time_t>(timeNs / 1000000000L));
+    memcpy(out, seconds.data(), seconds.size());
+    out += seconds.size();
+    return out + sprintf(out, ".%06ld", static_cast<long>(timeNs % 1000000000L / 1000));
+}
+
+static const char* event_name(uint8_t event) { return event <= 3 ? AccessEventNames[event] : "unknown"; }
+
+static const char* reason_name(uint8_t reason) {
+    return reason < sizeof(AccessCloseReasonNames) / sizeof(AccessCloseReasonNames[0]) ? AccessCloseReasonNames[reason]
+                                                                                        : "unknown";
+}
+
+/**
+ * text mirrors former text log lines, so old greps still work on decoded output
+ */
+static size_t format_record(char* line, const AccessRecord& r, OutputFormat format) {
+    char client[32], upstream[32];
+    format_endpoint(client, r.clientIp, r.clientPort);
+    format_endpoint(upstream, r.upstreamIp, r.upstreamPort);
+    char policy = r.policy ? r.policy : '-';
+    char* out = line;
+    if (format == OutputFormat::Text) {
+        out = format_time(out, r.timeNs);
+        if (r.event == static_cast<uint8_t>(AccessEvent::Open)) {
+            out += sprintf(out, " open %c %s <--> %s", policy, client, upstream);
+        } else if (r.event == static_cast<uint8_t>(AccessEvent::Done)) {
+            out += sprintf(out, " done %s <--> %s %u %lu %ldus", client, r.policy ? "cache" : upstream, r.status,
+                           static_cast<unsigned long>(r.serverBytes), static_cast<long>(r.durationNs / 1000));
+        } else {
+            out += sprintf(out, " leave %s %lu -> %s %lu requests %u %s %ldus", client,
+                           static_cast<unsigned long>(r.clientBytes), upstream,
+                           static_cast<unsigned long>(r.serverBytes), r.requests, reason_name(r.closeReason),
+                           static_cast<long>(r.durationNs / 1000));
+        }
+        if (r.failovers) out += sprintf(out, " failovers %u", r.failovers);
+    } else if (format == OutputFormat::Csv) {
+        out += sprintf(out, "%ld,%s,%c,%s,%s,%u,%lu,%lu,%u,%ld,%u,%s", static_cast<long>(r.timeNs), event_name(r.event),
+                       policy, client, upstream, r.status, static_cast<unsigned long>(r.clientBytes),
+                       static_cast<unsigned long>(r.serverBytes), r.requests, static_cast<long>(r.durationNs / 1000),
+                       r.failovers, reason_name(r.closeReason));
+    } else {
+        out += sprintf(out,
+                       "{\"time_ns\":%ld,\"event\":\"%s\",\"policy\":\"%c\",\"client\":\"%s\",\"upstream\":\"%s\","
+                       "\"status\":%u,\"client_bytes\":%lu,\"server_bytes\":%lu,\"requests\":%u,\"duration_us\":%ld,"
+                       "\"failovers\":%u,\"reason\":\"%s\"}",
+                       static_cast<long>(r.timeNs), event_name(r.event), policy, client, upstream, r.status,
+                       static_cast<unsigned long>(r.clientBytes), static_cast<unsigned long>(r.serverBytes),
+                       r.requests, static_cast<long>(r.durationNs / 1000), r.failovers, reason_name(r.closeReason));
+    }
+    *out++ = '\n';
+    return out - line;
+}
+
+static uint64_t key_of(const AccessRecord& r, AggregateKey by) {
+    switch (by) {
+        case AggregateKey::Upstream:
+            return (static_cast<uint64_t>(r.upstreamIp) << 16) | r.upstreamPort;
+        case AggregateKey::Client:
+            return r.clientIp;
+        case AggregateKey::Status:
+            return r.status;
+        case AggregateKey::Reason:
+            return r.closeReason;
+        case AggregateKey::Event:
+            return r.event;
+        default:
+            return 0;
+    }
+}
+
+static string key_name(uint64_t key, AggregateKey by) {
+    char text[32];
+    switch (by) {
+        case AggregateKey::Upstream:
+            format_endpoint(text, static_cast<uint32_t>(key >> 16), static_cast<uint16_t>(key & 0xFFFF));
+            return text;
+        case AggregateKey::Client:
+            format_endpoint(text, static_cast<uint32_t>(key), 0);
+            return string(text, strchr(text, ':') ? strchr(text, ':') : text + strlen(text));
+        case AggregateKey::Reason:
+            return reason_name(static_cast<uint8_t>(key));
+        case AggregateKey::Event:
+            return event_name(static_cast<uint8_t>(key));
+        default:
+            return to_string(key);
+    }
+}
+
+struct Scanner {
+    Filter filter;
+    OutputFormat format{OutputFormat::Text};
+    AggregateKey aggregateBy{AggregateKey::None};
+    bool countOnly{false};
+    uint64_t matched{0};
+    uint64_t scanned{0};
+    unordered_map<uint64_t, Aggregate> groups;
+    vector<char> out;
+    size_t used{0};
+
+    Scanner() : out(1 << 20) {}
+
+    void emit(const AccessRecord& r) {
+        if (used + 512 > out.size()) flush();
+        used += format_record(out.data() + used, r, format);
+    }
+
+    void flush() {
+        fwrite(out.data(), 1, used, stdout);
+        used = 0;
+    }
+
+    void on_record(const AccessRecord& r) {
+        ++scanned;
+        if (!filter.match(r)) return;
+        ++matched;
+        if (aggregateBy != AggregateKey::None) {
+            Aggregate& group = groups[key_of(r, aggregateBy)];
+            ++group.count;
+            group.clientBytes += r.clientBytes;
+            group.serverBytes += r.serverBytes;
+            group.totalNs += r.durationNs;
+            group.maxNs = std::max(group.maxNs, r.durationNs);
+        } else if (!countOnly) {
+            emit(r);
+        }
+    }
+
+    bool scan(const string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            cerr << "open " << path << " failed " << strerror(errno) << endl;
+            return false;
+        }
+        struct stat st {};
+        fstat(fd, &st);
+        size_t size = static_cast<size_t>(st.st_size);
+        if (size < sizeof(AccessLogHeader)) {
+            close(fd);
+            return size == 0;
+        }
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            cerr << "mmap " << path << " failed " << strerror(errno) << endl;
+            return false;
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+
+        const char* data = static_cast<const char*>(mapped);
+        AccessLogHeader expected;
+        bool ok = memcmp(data, expected.magic, sizeof(expected.magic)) == 0;
+        if (!ok) cerr << path << " is not an access log" << endl;
+        size_t offset = sizeof(AccessLogHeader);
+        AccessRecord record;
+        while (ok && offset + sizeof(uint16_t) <= size) {
+            uint16_t recordSize;
+            memcpy(&recordSize, data + offset, sizeof(recordSize));
+            if (recordSize < sizeof(uint16_t) || offset + recordSize > size) break;  // torn tail
+            record = AccessRecord();
+            memcpy(&record, data + offset, std::min<size_t>(recordSize, sizeof(record)));
+            on_record(record);
+            offset += recordSize;
+        }
+        munmap(mapped, size);
+        return ok;
+    }
+
+    void print_groups() {
+        vector<pair<uint64_t, Aggregate>> sorted(groups.begin(), groups.end());
+        std::sort(sorted.begin(), sorted.end(), [](const pair<uint64_t, Aggregate>& a,
+                                                   const pair<uint64_t, Aggregate>& b) {
+            return a.second.count > b.second.count;
+        });
+        if (format == OutputFormat::Csv) printf("key,count,client_bytes,server_bytes,avg_us,max_us\n");
+        for (const auto& item : sorted) {
+            const Aggregate& g = item.second;
+            string key = key_name(item.first, aggregateBy);
+            long avgUs = static_cast<long>(g.totalNs / static_cast<int64_t>(g.count) / 1000);
+            long maxUs = static_cast<long>(g.maxNs / 1000);
+            if (format == OutputFormat::Text) {
+                printf("%-24s count %lu client_bytes %lu server_bytes %lu avg_us %ld max_us %ld\n", key.c_str(),
+                       static_cast<unsigned long>(g.count), static_cast<unsigned long>(g.clientBytes),
+                       static_cast<unsigned long>(g.serverBytes), avgUs, maxUs);
+            } else if (format == OutputFormat::Csv) {
+                printf("%s,%lu,%lu,%lu,%ld,%ld\n", key.c_str(), static_cast<unsigned long>(g.count),
+                       static_cast<unsigned long>(g.clientBytes), static_cast<unsigned long>(g.serverBytes), avgUs,
+                       maxUs);
+            } else {
+                printf("{\"key\":\"%s\",\"count\":%lu,\"client_bytes\":%lu,\"server_bytes\":%lu,\"avg_us\":%ld,"
+                       "\"max_us\":%ld}\n",
+                       key.c_str(), static_cast<unsigned long>(g.count), static_cast<unsigned long>(g.clientBytes),
+                       static_cast<unsigned long>(g.serverBytes), avgUs, maxUs);
+            }
+        }
+    }
+};
+
+int main(int argc, char** argv) {
+    vector<string> files;
+    string format, event, client, upstream, reason, since, until, aggregate;
+    Scanner scanner;
+    Filter& filter = scanner.filter;
+    int64_t slowerUs = 0;
+
+    po::options_description desc("lblog [options] access.log...");
+    desc.add_options()
+    ("help,h", "produce help message")
+    ("file", po::value<vector<string>>(&files), "access log written by balancer --access-log, may repeat")
+    ("format,f", po::value<string>(&format)->default_value("text"), "text, csv or json (one object per line)")
+    ("event", po::value<string>(&event), "only open, done or leave records")
+    ("client", po::value<string>(&client), "only records of this client ip")
+    ("upstream", po::value<string>(&upstream), "only records of this upstream ip or ip:port")
+    ("status", po::value<int>(&filter.status), "only done records with this response status")
+    ("reason", po::value<string>(&reason), "only leave records closed for client, upstream, shed, timeout or rejected")
+    ("since", po::value<string>(&since), "records at or after yyyymmdd.hhmmss")
+    ("until", po::value<string>(&until), "records before yyyymmdd.hhmmss")
+    ("slower-us", po::value<int64_t>(&slowerUs), "records whose request latency or link lifetime is at least this")
+    ("agg", po::value<string>(&aggregate), "group matched records by upstream, client, status, reason or event")
+    ("count", po::bool_switch(&scanner.countOnly), "only print number of matched records");
+
+    po::positional_options_description positional;
+    positional.add("file", -1);
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help") || files.empty()) {
+        cout << desc << endl;
+        return files.empty() ? 1 : 0;
+    }
+
+    if (format == "csv") {
+        scanner.format = OutputFormat::Csv;
+    } else if (format == "json") {
+        scanner.format = OutputFormat::Json;
+    }
+    if (!event.empty() && (filter.event = index_of(AccessEventNames, 4, event)) <= 0) {
+        cerr << "unknown event " << event << endl;
+        return 1;
+    }
+    if (!client.empty() && !(filter.hasClient = parse_ip(client, filter.clientIp))) {
+        cerr << "bad client ip " << client << endl;
+        return 1;
+    }
+    if (!upstream.empty()) {
+        auto colon = upstream.find(':');
+        if (colon != string::npos) filter.upstreamPort = static_cast<uint16_t>(std::stoi(upstream.substr(colon + 1)));
+        if (!(filter.hasUpstream = parse_ip(upstream.substr(0, colon), filter.upstreamIp))) {
+            cerr << "bad upstream " << upstream << endl;
+            return 1;
+        }
+    }
+    if (!reason.empty() && (filter.reason = index_of(AccessCloseReasonNames, 6, reason)) < 0) {
+        cerr << "unknown reason " << reason << endl;
+        return 1;
+    }
+    if ((!since.empty() && (filter.sinceNs = parse_time(since)) < 0) ||
+        (!until.empty() && (filter.untilNs = parse_time(until)) < 0)) {
+        cerr << "time should look like 20180101.093000" << endl;
+        return 1;
+    }
+    filter.slowerNs = slowerUs * 1000;
+    if (aggregate == "upstream") {
+        scanner.aggregateBy = AggregateKey::Upstream;
+    } else if (aggregate == "client") {
+        scanner.aggregateBy = AggregateKey::Client;
+    } else if (aggregate == "status") {
+        scanner.aggregateBy = AggregateKey::Status;
+    } else if (aggregate == "reason") {
+        scanner.aggregateBy = AggregateKey::Reason;
+    } else if (aggregate == "event") {
+        scanner.aggregateBy = AggregateKey::Event;
+    } else if (!aggregate.empty()) {
+        cerr << "unknown aggregate key " << aggregate << endl;
+        return 1;
+    }
+
+    if (scanner.format == OutputFormat::Csv && scanner.aggregateBy == AggregateKey::None && !scanner.countOnly) {
+        printf("time_ns,event,policy,client,upstream,status,client_bytes,server_bytes,requests,duration_us,failovers,"
+               "reason\n");
+    }
+    bool ok = true;
+    for (const auto& path : files) ok = scanner.scan(path) && ok;
+    scanner.flush();
+
+    if (scanner.aggregateBy != AggregateKey::None) {
+        scanner.print_groups();
+    } else if (scanner.countOnly) {
+        printf("%lu\n", static_cast<unsigned long>(scanner.matched));
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,174 @@
+#include <unistd.h>
+#include <boost/program_options.hpp>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "StatsSegment.h"
+#include "Utils.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+/**
+ * live per upstream view of a balancer started with --stats-shm
+ * reads the shared memory segment only, balancer is never signalled or waited for
+ * rates are deltas between two publishes, so they do not depend on when this tool happens to wake up
+ */
+
+constexpr int64_t StaleNs = 2000000000L;  // balancer publishes every 100ms, older snapshot means it is gone
+
+struct Snapshot {
+    StatsGlobal global;
+    vector<StatsUpstream> upstreams;
+};
+
+static bool take_snapshot(const StatsSegment& segment, Snapshot& snapshot) {
+    if (!stats_read(segment.global(), snapshot.global)) return false;
+    snapshot.upstreams.resize(segment.header().upstreamCount);
+    for (size_t i = 0; i < snapshot.upstreams.size(); ++i) {
+        if (!stats_read(segment.upstream(static_cast<int>(i)), snapshot.upstreams[i])) return false;
+    }
+    return true;
+}
+
+static string format_ns(uint64_t ns) {
+    char text[32];
+    if (ns == 0) {
+        snprintf(text, sizeof(text), "-");
+    } else if (ns < 1000000) {
+        snprintf(text, sizeof(text), "%luus", static_cast<unsigned long>(ns / 1000));
+    } else if (ns < 1000000000) {
+        snprintf(text, sizeof(text), "%.1fms", ns / 1e6);
+    } else {
+        snprintf(text, sizeof(text), "%.2fs", ns / 1e9);
+    }
+    return text;
+}
+
+static string format_rate(double value) {
+    char text[32];
+    if (value < 1000) {
+        snprintf(text, sizeof(text), "%.0f", value);
+    } else if (value < 1000000) {
+        snprintf(text, sizeof(text), "%.1fK", value / 1e3);
+    } else {
+        snprintf(text, sizeof(text), "%.1fM", value / 1e6);
+    }
+    return text;
+}
+
+static uint64_t delta(uint64_t now, uint64_t before) { return now >= before ? now - before : 0; }
+
+static void render(string& frame, const string& name, const StatsHeader& header, const Snapshot& now,
+                   const Snapshot& before, int64_t wallNs) {
+    double seconds = (now.global.publishedNs - before.global.publishedNs) / 1e9;
+    auto rate = [seconds](uint64_t nowValue, uint64_t beforeValue) {
+        return seconds > 0 ? delta(nowValue, beforeValue) / seconds : 0.0;
+    };
+
+    char line[256];
+    const StatsGlobal& g = now.global;
+    bool stale = wallNs - g.publishedNs > StaleNs;
+    snprintf(line, sizeof(line), "lbtop %s  pid %d  up %lds  %s\n", name.c_str(), header.pid,
+             static_cast<long>((g.publishedNs - header.startNs) / 1000000000L), stale ? "STALE" : "live");
+    frame += line;
+    snprintf(line, sizeof(line),
+             "links active %lu  accepted/s %s  closed/s %s  rate limited/s %s  shed/s %s  rejected/s %s  "
+             "retry budget %.1f\n\n",
+             static_cast<unsigned long>(delta(g.linksAccepted, g.linksClosed)),
+             format_rate(rate(g.linksAccepted, before.global.linksAccepted)).c_str(),
+             format_rate(rate(g.linksClosed, before.global.linksClosed)).c_str(),
+             format_rate(rate(g.linksRateLimited, before.global.linksRateLimited)).c_str(),
+             format_rate(rate(g.linksShed, before.global.linksShed)).c_str(),
+             format_rate(rate(g.requestsRejected, before.global.requestsRejected)).c_str(), g.retryBudgetRemaining);
+    frame += line;
+    snprintf(line, sizeof(line), "%-22s %2s %5s %5s %7s %7s %6s %8s %6s %5s %5s %8s %8s %8s %6s\n", "UPSTREAM", "UP",
+             "INFL", "LIMIT", "PICK/s", "RESP/s", "5XX/s", "BYTES/s", "FAILOV", "CONNE", "TMOUT", "P50", "P90", "P99",
+             "N");
+    frame += line;
+
+    for (size_t i = 0; i < now.upstreams.size(); ++i) {
+        const StatsUpstream& u = now.upstreams[i];
+        const StatsUpstream& b = i < before.upstreams.size() ? before.upstreams[i] : u;
+        uint64_t responses = 0, responsesBefore = 0;
+        for (int c = 0; c < 5; ++c) {
+            responses += u.responses[c];
+            responsesBefore += b.responses[c];
+        }
+        string limit = u.limit > 0 ? to_string(u.limit) : "-";
+        snprintf(line, sizeof(line), "%-22.22s %2u %5d %5s %7s %7s %6s %8s %6lu %5lu %5lu %8s %8s %8s %6lu\n",
+                 u.endpoint, u.good, u.inflight, limit.c_str(), format_rate(rate(u.picks, b.picks)).c_str(),
+                 format_rate(rate(responses, responsesBefore)).c_str(),
+                 format_rate(rate(u.responses[4], b.responses[4])).c_str(),
+                 format_rate(rate(u.responseBytes, b.responseBytes)).c_str(), static_cast<unsigned long>(u.failovers),
+                 static_cast<unsigned long>(u.connectErrors), static_cast<unsigned long>(u.timeouts),
+                 format_ns(u.p50Ns).c_str(), format_ns(u.p90Ns).c_str(), format_ns(u.p99Ns).c_str(),
+                 static_cast<unsigned long>(u.windowSamples));
+        frame += line;
+    }
+}
+
+int main(int argc, char** argv) {
+    string name;
+    int intervalMs = 100;
+    bool once = false;
+
+    po::options_description desc("lbtop [options] /segment-name");
+    desc.add_options()
+    ("help,h", "produce help message")
+    ("name", po::value<string>(&name), "shared memory segment given to balancer --stats-shm")
+    ("interval-ms,i", po::value<int>(&intervalMs)->default_value(100), "refresh interval, balancer publishes every 100ms")
+    ("once", po::bool_switch(&once), "print one frame without clearing screen and exit");
+
+    po::positional_options_description positional;
+    positional.add("name", 1);
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help") || name.empty()) {
+        cout << desc << endl;
+        return name.empty() ? 1 : 0;
+    }
+    if (intervalMs < 10) intervalMs = 10;
+
+    StatsSegment segment;
+    string error = segment.attach(name);
+    if (!error.empty()) {
+        cerr << error << endl;
+        return 1;
+    }
+
+    Snapshot before, now;
+    if (!take_snapshot(segment, before)) {
+        cerr << "segment " << name << " keeps changing, can not read it" << endl;
+        return 1;
+    }
+    string frame;
+    while (true) {
+        usleep(static_cast<useconds_t>(intervalMs) * 1000);
+        if (!take_snapshot(segment, now)) continue;
+
+        int64_t wallNs = wall_nanos();
+        if (wallNs - now.global.publishedNs > StaleNs) {  // balancer restarted under same name, or exited
+            Snapshot fresh;
+            StatsSegment retry;
+            if (retry.attach(name).empty() && take_snapshot(retry, fresh) &&
+                wallNs - fresh.global.publishedNs <= StaleNs) {
+                segment.attach(name);
+                before = fresh;
+                continue;
+            }
+        }
+
+        frame.clear();
+        if (!once) frame += "\033[H\033[J";
+        render(frame, name, segment.header(), now, before, wallNs);
+        fwrite(frame.data(), 1, frame.size(), stdout);
+        fflush(stdout);
+        if (once) break;
+        if (now.global.publishedNs != before.global.publishedNs) before = now;
+    }
+    return 0;
+}
@@ -0,0 +1,450 @@
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "HttpFramer.h"
+#include "TrafficCapture.h"
+#include "Utils.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+/**
+ * re-issue requests captured by balancer --capture against a target, keeping their recorded gaps
+ * scaled by speed or as fast as connections allow, over a fixed number of keep-alive connections
+ * latency is taken from when a request was due, so a target too slow to keep up shows in it instead of
+ * silently slowing the send rate down; service time from first byte sent is reported next to it
+ */
+
+constexpr int ReplayRecvBytes = 64 * 1024;
+constexpr int ReplayTickMillis = 10;  // longest epoll wait, timeouts and schedule are checked this often
+
+struct Request {
+    int64_t offsetNs{0};
+    string bytes;
+    bool head{false};  // HEAD response has no body whatever its headers say
+};
+
+enum class ConnState { Closed, Connecting, Sending, Receiving };
+
+struct Conn {
+    int fd{-1};
+    ConnState state{ConnState::Closed};
+    bool busy{false};       // has a request
+    bool reused{false};     // connection already served a request, a close before any response byte is retried
+    size_t request{0};
+    size_t sent{0};
+    int64_t dueNs{0};
+    int64_t sentNs{0};
+    int64_t responseBytes{0};
+    HttpFramer framer;
+};
+
+struct Report {
+    uint64_t sent{0};
+    uint64_t completed{0};
+    uint64_t connectErrors{0};
+    uint64_t resets{0};
+    uint64_t timeouts{0};
+    uint64_t retried{0};
+    uint64_t statuses[6]{};  // by status class, 0 for unparsable
+    uint64_t responseBytes{0};
+    vector<int64_t> latencyNs;
+    vector<int64_t> serviceNs;
+};
+
+/**
+ * requests whose body was cut at capture get it padded back to their Content-Length, a request that can not be
+ * framed from captured bytes alone (head cut, chunked body cut) is skipped
+ */
+static bool load_capture(const string& path, size_t limit, vector<Request>& requests, size_t& skipped) {
+    ifstream in(path, ios::binary);
+    string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    CaptureFileHeader header;
+    if (data.size() < sizeof(header) || memcmp(data.data(), header.magic, sizeof(header.magic)) != 0) return false;
+
+    size_t at = sizeof(header);
+    while (at + sizeof(CaptureRecord) <= data.size() && (limit == 0 || requests.size() < limit)) {
+        CaptureRecord record;
+        memcpy(&record, data.data() + at, sizeof(record));
+        if (record.size < sizeof(record) || at + record.size > data.size()) break;
+        const char* payload = data.data() + at + sizeof(record);
+        at += record.size;
+
+        HttpFramer framer;
+        framer.reset(HttpFramer::Request);
+        int consumed = framer.feed(payload, static_cast<int>(record.length));
+        Request request;
+        request.offsetNs = record.offsetNs;
+        request.bytes.assign(payload, consumed);
+        if (framer.state == HttpFramer::Body) {
+            request.bytes.append(static_cast<size_t>(framer.bodyRemaining), 'x');
+        } else if (!framer.complete()) {
+            ++skipped;
+            continue;
+        }
+        request.head = framer.is_method("HEAD");
+        requests.push_back(std::move(request));
+    }
+    return true;
+}
+
+static bool resolve(const string& target, struct sockaddr_in& addr) {
+    auto colon = target.rfind(':');
+    if (colon == string::npos) return false;
+    struct addrinfo hints {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(target.substr(0, colon).c_str(), target.substr(colon + 1).c_str(), &hints, &result) != 0) {
+        return false;
+    }
+    memcpy(&addr, result->ai_addr, sizeof(addr));
+    freeaddrinfo(result);
+    return true;
+}
+
+static int64_t percentile(vector<int64_t>& values, double p) {
+    if (values.empty()) return 0;
+    size_t index = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static void print_latency(const char* name, vector<int64_t>& values) {
+    int64_t p50 = percentile(values, 0.5), p90 = percentile(values, 0.9), p99 = percentile(values, 0.99);
+    int64_t p999 = percentile(values, 0.999);
+    int64_t max = values.empty() ? 0 : *std::max_element(values.begin(), values.end());
+    printf("%-8s p50 %.3fms  p90 %.3fms  p99 %.3fms  p99.9 %.3fms  max %.3fms\n", name, p50 / 1e6, p90 / 1e6,
+           p99 / 1e6, p999 / 1e6, max / 1e6);
+}
+
+struct Replayer {
+    const vector<Request>& requests;
+    struct sockaddr_in target;
+    double speed;  // 0 for as fast as possible
+    int64_t timeoutNs;
+    vector<Conn> conns;
+    vector<size_t> idle;     // conns without request
+    deque<size_t> due;       // requests waiting for a conn
+    deque<int64_t> dueAtNs;  // when each of them was due
+    size_t next{0};          // first request not due yet
+    int64_t startNs{0};
+    int epollFd{-1};
+    Report report;
+
+    Replayer(const vector<Request>& requests_, const struct sockaddr_in& target_, double speed_, int concurrency,
+             int64_t timeoutNs_)
+        : requests(requests_), target(target_), speed(speed_), timeoutNs(timeoutNs_), conns(concurrency) {
+        for (int i = concurrency - 1; i >= 0; --i) idle.push_back(i);
+    }
+
+    void run();
+
+private:
+    void schedule(int64_t nowNs);
+    void dispatch(int64_t nowNs);
+    bool open(Conn& conn);
+    void close_conn(Conn& conn);
+    void on_event(size_t index, uint32_t events, int64_t nowNs);
+    bool send_request(Conn& conn);
+    void finish(size_t index, int64_t nowNs);
+    void fail(size_t index, uint64_t& counter);
+    void expire(int64_t nowNs);
+    int wait_millis(int64_t nowNs) const;
+};
+
+void Replayer::schedule(int64_t nowNs) {
+    while (next < requests.size()) {
+        int64_t dueNs = speed > 0 ? startNs + static_cast<int64_t>(requests[next].offsetNs / speed) : nowNs;
+        if (dueNs > nowNs) break;
+        if (speed <= 0 && due.size() >= conns.size()) break;  // max speed keeps just enough queued to fill conns
+        due.push_back(next++);
+        dueAtNs.push_back(dueNs);
+    }
+}
+
+void Replayer::dispatch(int64_t nowNs) {
+    while (!due.empty() && !idle.empty()) {
+        size_t index = idle.back();
+        idle.pop_back();
+        Conn& conn = conns[index];
+        conn.busy = true;
+        conn.request = due.front();
+        conn.dueNs = speed > 0 ? dueAtNs.front() : nowNs;
+        due.pop_front();
+        dueAtNs.pop_front();
+        conn.sent = 0;
+        conn.sentNs = 0;
+        conn.responseBytes = 0;
+        conn.framer.reset(HttpFramer::Response, requests[conn.request].head);
+        ++report.sent;
+
+        if (conn.fd < 0) {
+            if (!open(conn)) {
+                fail(index, report.connectErrors);
+                continue;
+            }
+        } else {
+            conn.state = ConnState::Sending;
+            if (!send_request(conn)) fail(index, report.resets);
+        }
+    }
+}
+
+bool Replayer::open(Conn& conn) {
+    conn.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (conn.fd < 0) return false;
+    int one = 1;
+    setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    conn.reused = false;
+    if (connect(conn.fd, reinterpret_cast<struct sockaddr*>(&target), sizeof(target)) < 0 && errno != EINPROGRESS) {
+        close_conn(conn);
+        return false;
+    }
+    struct epoll_event event {};
+    event.events = EPOLLIN | EPOLLOUT;
+    event.data.u64 = static_cast<uint64_t>(&conn - conns.data());
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, conn.fd, &event);
+    conn.state = ConnState::Connecting;
+    return true;
+}
+
+void Replayer::close_conn(Conn& conn) {
+    if (conn.fd >= 0) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, conn.fd, nullptr);
+        close(conn.fd);
+    }
+    conn.fd = -1;
+    conn.state = ConnState::Closed;
+}
+
+/**
+ * @return false on send error
+ */
+bool Replayer::send_request(Conn& conn) {
+    const string& bytes = requests[conn.request].bytes;
+    while (conn.sent < bytes.size()) {
+        ssize_t ret = send(conn.fd, bytes.data() + conn.sent, bytes.size() - conn.sent, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+            struct epoll_event event {};
+            event.events = EPOLLIN | EPOLLOUT;
+            event.data.u64 = static_cast<uint64_t>(&conn - conns.data());
+            epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &event);
+            return true;
+        }
+        if (conn.sentNs == 0) conn.sentNs = steady_nanos();
+        conn.sent += ret;
+    }
+    struct epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.u64 = static_cast<uint64_t>(&conn - conns.data());
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &event);
+    conn.state = ConnState::Receiving;
+    return true;
+}
+
+void Replayer::finish(size_t index, int64_t nowNs) {
+    Conn& conn = conns[index];
+    ++report.completed;
+    int statusClass = conn.framer.status / 100;
+    ++report.statuses[statusClass >= 1 && statusClass <= 5 ? statusClass : 0];
+    report.responseBytes += conn.responseBytes;
+    report.latencyNs.push_back(nowNs - conn.dueNs);
+    report.serviceNs.push_back(nowNs - conn.sentNs);
+    conn.busy = false;
+    if (conn.framer.reusable()) {
+        conn.reused = true;
+        conn.state = ConnState::Sending;
+    } else {
+        close_conn(conn);
+    }
+    idle.push_back(index);
+}
+
+void Replayer::fail(size_t index, uint64_t& counter) {
+    ++counter;
+    conns[index].busy = false;
+    close_conn(conns[index]);
+    idle.push_back(index);
+}
+
+void Replayer::on_event(size_t index, uint32_t events, int64_t nowNs) {
+    Conn& conn = conns[index];
+    if (!conn.busy) {
+        close_conn(conn);  // idle keep-alive connection closed by target, or sent something unasked
+        return;
+    }
+    if (conn.state == ConnState::Connecting) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+            fail(index, report.connectErrors);
+            return;
+        }
+        conn.state = ConnState::Sending;
+    }
+    if (conn.state == ConnState::Sending) {
+        if (!send_request(conn)) fail(index, report.resets);
+        return;
+    }
+    if (conn.state != ConnState::Receiving) return;
+
+    static char buffer[ReplayRecvBytes];
+    while (true) {
+        ssize_t ret = recv(conn.fd, buffer, sizeof(buffer), 0);
+        if (ret > 0) {
+            conn.responseBytes += ret;
+            conn.framer.feed(buffer, static_cast<int>(ret));
+            if (conn.framer.complete()) {
+                finish(index, nowNs);
+                return;
+            }
+            if (conn.framer.bad()) {
+                fail(index, report.resets);
+                return;
+            }
+            continue;
+        }
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (ret == 0 && conn.framer.until_close()) {
+            finish(index, nowNs);  // closed connection, finish leaves it closed
+        } else if (conn.reused && conn.responseBytes == 0) {
+            ++report.retried;  // keep-alive connection closed by target while idle, send again on a fresh one
+            --report.sent;
+            conn.busy = false;
+            close_conn(conn);
+            due.push_front(conn.request);
+            dueAtNs.push_front(conn.dueNs);
+            idle.push_back(index);
+        } else {
+            fail(index, report.resets);
+        }
+        return;
+    }
+}
+
+void Replayer::expire(int64_t nowNs) {
+    for (size_t i = 0; i < conns.size(); ++i) {
+        Conn& conn = conns[i];
+        if (conn.busy && nowNs - conn.dueNs > timeoutNs) {
+            fail(i, report.timeouts);
+        }
+    }
+}
+
+int Replayer::wait_millis(int64_t nowNs) const {
+    if (next >= requests.size() || speed <= 0) return ReplayTickMillis;
+    int64_t dueNs = startNs + static_cast<int64_t>(requests[next].offsetNs / speed);
+    return static_cast<int>(std::max<int64_t>(0, std::min<int64_t>(ReplayTickMillis, (dueNs - nowNs) / 1000000)));
+}
+
+void Replayer::run() {
+    epollFd = epoll_create1(0);
+    struct epoll_event events[256];
+    startNs = steady_nanos();
+    int64_t lastProgressNs = startNs;
+    uint64_t lastCompleted = 0;
+    while (next < requests.size() || !due.empty() || idle.size() < conns.size()) {
+        int64_t nowNs = steady_nanos();
+        schedule(nowNs);
+        dispatch(nowNs);
+        int count = epoll_wait(epollFd, events, 256, wait_millis(nowNs));
+        nowNs = steady_nanos();
+        for (int i = 0; i < count; ++i) on_event(events[i].data.u64, events[i].events, steady_nanos());
+        expire(nowNs);
+        if (nowNs - lastProgressNs >= 1000000000L) {
+            fprintf(stderr, "%5.1fs  sent %lu  done %lu  %lu/s  queued %lu\n", (nowNs - startNs) / 1e9,
+                    static_cast<unsigned long>(report.sent), static_cast<unsigned long>(report.completed),
+                    static_cast<unsigned long>((report.completed - lastCompleted) * 1e9 / (nowNs - lastProgressNs)),
+                    static_cast<unsigned long>(due.size()));
+            lastProgressNs = nowNs;
+            lastCompleted = report.completed;
+        }
+    }
+    for (Conn& conn : conns) close_conn(conn);
+    close(epollFd);
+
+    double seconds = (steady_nanos() - startNs) / 1e9;
+    printf("requests %lu  completed %lu  connect errors %lu  resets %lu  timeouts %lu  retried %lu\n",
+           static_cast<unsigned long>(report.sent), static_cast<unsigned long>(report.completed),
+           static_cast<unsigned long>(report.connectErrors), static_cast<unsigned long>(report.resets),
+           static_cast<unsigned long>(report.timeouts), static_cast<unsigned long>(report.retried));
+    printf("status 1xx %lu  2xx %lu  3xx %lu  4xx %lu  5xx %lu  other %lu\n",
+           static_cast<unsigned long>(report.statuses[1]), static_cast<unsigned long>(report.statuses[2]),
+           static_cast<unsigned long>(report.statuses[3]), static_cast<unsigned long>(report.statuses[4]),
+           static_cast<unsigned long>(report.statuses[5]), static_cast<unsigned long>(report.statuses[0]));
+    printf("elapsed %.3fs  throughput %.1f req/s  %.3f MB/s received\n", seconds, report.completed / seconds,
+           report.responseBytes / seconds / 1e6);
+    print_latency("latency", report.latencyNs);
+    print_latency("service", report.serviceNs);
+}
+
+int main(int argc, char** argv) {
+    string file, target;
+    double speed = 1;
+    int concurrency = 16;
+    int timeoutMs = 10000;
+    size_t limit = 0;
+
+    po::options_description desc("replay [options] capture-file");
+    desc.add_options()
+    ("help,h", "produce help message")
+    ("file", po::value<string>(&file), "file written by balancer --capture")
+    ("target,t", po::value<string>(&target)->default_value("127.0.0.1:8081"), "host:port requests are sent to")
+    ("speed,s", po::value<double>(&speed)->default_value(1), "gaps between captured requests divided by this, 0 sends as fast as connections allow")
+    ("concurrency,c", po::value<int>(&concurrency)->default_value(16), "keep-alive connections to target, one request in flight on each")
+    ("timeout-ms", po::value<int>(&timeoutMs)->default_value(10000), "request not answered this long after it was due counts as timeout")
+    ("limit,n", po::value<size_t>(&limit)->default_value(0), "replay only first n requests, 0 for all");
+
+    po::positional_options_description positional;
+    positional.add("file", 1);
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help") || file.empty()) {
+        cout << desc << endl;
+        return file.empty() ? 1 : 0;
+    }
+    if (concurrency < 1) concurrency = 1;
+
+    vector<Request> requests;
+    size_t skipped = 0;
+    if (!load_capture(file, limit, requests, skipped)) {
+        cerr << "read capture " << file << " failed" << endl;
+        return 1;
+    }
+    struct sockaddr_in addr {};
+    if (!resolve(target, addr)) {
+        cerr << "resolve target " << target << " failed" << endl;
+        return 1;
+    }
+    int64_t spanNs = requests.empty() ? 0 : requests.back().offsetNs - requests.front().offsetNs;
+    printf("loaded %lu requests spanning %.3fs, skipped %lu not framable from captured bytes\n",
+           static_cast<unsigned long>(requests.size()), spanNs / 1e9, static_cast<unsigned long>(skipped));
+    if (requests.empty()) return 0;
+
+    int64_t firstNs = requests.front().offsetNs;  // replay starts right away, not after capture's idle lead in
+    for (Request& request : requests) request.offsetNs -= firstNs;
+
+    Replayer replayer(requests, addr, speed, concurrency, timeoutMs * 1000000LL);
+    replayer.run();
+    return 0;
+}